@@ -0,0 +1,363 @@
+#include "batch.h"
+#include "jobs.h"
+#include "modelcache.h"
+#include "overdraw.h"
+#include "rasterizer.h"
+#include "texcache.h"
+#include "trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace batch {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double ms_since(Clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - begin)
+      .count();
+}
+
+// a file the batch reads, loaded once whatever the number of jobs using it
+struct Asset {
+  enum Kind { MODEL, TEXTURE, BLOCKS };
+  Kind kind;
+  std::string path;
+  int users = 0;
+  double load_ms = 0;
+  bool ok = false;
+
+  // keep the cache entry alive until the last job using it is done
+  int pending = 0;
+  std::shared_ptr<const void> pin = nullptr;
+};
+
+const char *const kind_names[] = {"model", "texture", "blocks"};
+
+struct Result {
+  double render_ms = 0;
+  double save_ms = 0;
+  const char *status = "ok";
+};
+
+bool parse_int(const std::string &value, int &out) {
+  char *end = nullptr;
+  long number = std::strtol(value.c_str(), &end, 10);
+  if (end == value.c_str() || *end != '\0' || number <= 0)
+    return false;
+  out = (int)number;
+  return true;
+}
+
+bool parse_vec3(const std::string &value, Vec3f &out) {
+  char trash;
+  return sscanf(value.c_str(), "%f,%f,%f%c", &out.x, &out.y, &out.z,
+                &trash) == 3;
+}
+
+/**
+ * @brief Apply one key=value item of a manifest line to a job
+ *
+ * @return true if the key is known and the value valid
+ */
+bool apply(const std::string &key, const std::string &value, Job &job) {
+  if (key == "obj") {
+    job.obj = value;
+  } else if (key == "diffuse") {
+    job.diffuse = value;
+  } else if (key == "normal") {
+    job.normal = value;
+  } else if (key == "specular") {
+    job.specular = value;
+  } else if (key == "output") {
+    job.output = value;
+  } else if (key == "mode") {
+    // modes without maps don't reset them on the command line, they do here
+    // so a job doesn't inherit the maps of the default mode
+    job.options.shadingmode = 0;
+    if (!parse_mode(value, job.options))
+      return false;
+    job.mode = value;
+  } else if (key == "width") {
+    return parse_int(value, job.options.width);
+  } else if (key == "height") {
+    return parse_int(value, job.options.height);
+  } else if (key == "depth") {
+    return parse_int(value, job.options.depth);
+  } else if (key == "compress") {
+    if (value != "0" && value != "1")
+      return false;
+    job.options.compress_textures = value == "1";
+  } else if (key == "parallel") {
+    return parse_parallel(value, job.options);
+  } else if (key == "camera") {
+    return parse_vec3(value, job.camera.position);
+  } else if (key == "target") {
+    return parse_vec3(value, job.camera.target);
+  } else if (key == "fov") {
+    char *end = nullptr;
+    job.camera.fov = std::strtof(value.c_str(), &end);
+    return end != value.c_str() && *end == '\0';
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Texture maps a job samples, the others are neither loaded nor bound
+ *
+ * @return std::vector<std::pair<std::string, ShadingType>> path and slot
+ */
+std::vector<std::pair<std::string, ShadingType>> job_maps(const Job &job) {
+  std::vector<std::pair<std::string, ShadingType>> maps;
+  unsigned int shading = used_maps(job.options);
+  if (shading & ShadingType::DIFFUSE)
+    maps.emplace_back(job.diffuse, DIFFUSE);
+  if (shading & ShadingType::NORMAL)
+    maps.emplace_back(job.normal, NORMAL);
+  if (shading & ShadingType::SPECULAR)
+    maps.emplace_back(job.specular, SPECULAR);
+  return maps;
+}
+
+/**
+ * @brief Render and save one job with the already loaded assets
+ *
+ * @param job job to render, its options are bound to the rasterizer
+ * @param result timings and status
+ */
+void render_job(Job &job, Result &result) {
+  TR_TRACE("job", "batch");
+  ModelHandle model = ModelCache::instance().find(job.obj);
+  if (!model) {
+    result.status = "no model";
+    return;
+  }
+  // jobs render side by side, the trace is written once the batch is done
+  job.options.dump_trace = false;
+  Rasterizer rst(job.options);
+  rst.set_camera(job.camera);
+  rst.bind_model(model);
+
+  TextureCache &textures = TextureCache::instance();
+  for (const auto &map : job_maps(job)) {
+    // cache hits: the preload already decoded (or failed on) every map
+    if (job.options.compress_textures) {
+      if (BlockHandle blocks = textures.load_blocks(map.first))
+        rst.bind_texture(blocks, map.second);
+    } else if (TextureHandle texture = textures.find(map.first)) {
+      rst.bind_texture(texture, map.second);
+    }
+  }
+
+  Clock::time_point begin = Clock::now();
+  rst.render();
+  result.render_ms = ms_since(begin);
+
+  begin = Clock::now();
+  bool saved = rst.save_frame(job.output);
+  if (const Overdraw *overdraw = rst.get_overdraw()) {
+    std::string stem = job.output;
+    if (stem.size() > 4 && stem.substr(stem.size() - 4) == ".tga")
+      stem.resize(stem.size() - 4);
+    for (Overdraw::Kind kind : {Overdraw::PASSED, Overdraw::SHADED}) {
+      std::string filename = stem + "_" + Overdraw::kind_name(kind) + ".tga";
+      saved &= overdraw->heatmap(kind).write_tga_file(filename.c_str());
+    }
+  }
+  result.save_ms = ms_since(begin);
+  if (!saved)
+    result.status = "save failed";
+}
+
+} // namespace
+
+/**
+ * @brief Read the jobs of a manifest
+ *
+ * @param filename manifest path
+ * @param defaults values of the keys a line leaves out
+ * @param jobs parsed jobs are appended here
+ * @return true if every line is valid
+ */
+bool parse(const std::string &filename, const Job &defaults,
+           std::vector<Job> &jobs) noexcept {
+  std::ifstream in(filename);
+  if (!in) {
+    std::cerr << "Error: Can't open batch manifest " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  int line_num = 0;
+  bool ok = true;
+  while (std::getline(in, line)) {
+    line_num++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream items(line);
+    std::string item;
+    Job job = defaults;
+    job.line = line_num;
+    job.output.clear();
+    bool empty = true;
+    while (items >> item) {
+      empty = false;
+      size_t eq = item.find('=');
+      if (eq == std::string::npos ||
+          !apply(item.substr(0, eq), item.substr(eq + 1), job)) {
+        std::cerr << "Error: " << filename << ":" << line_num
+                  << ": bad item " << item << std::endl;
+        ok = false;
+      }
+    }
+    if (empty)
+      continue;
+    if (job.output.empty()) {
+      std::cerr << "Error: " << filename << ":" << line_num
+                << ": job without output" << std::endl;
+      ok = false;
+      continue;
+    }
+    jobs.push_back(std::move(job));
+  }
+  return ok;
+}
+
+/**
+ * @brief Load every asset the jobs use once, then render the jobs in
+ * parallel on the job system and print the timings of each. Frames don't
+ * write the trace, the caller dumps it once this returns.
+ *
+ * @param jobs jobs to run
+ * @param report where the summary goes
+ * @return int failed jobs
+ */
+int run(std::vector<Job> &jobs, std::ostream &report) noexcept {
+  Clock::time_point start = Clock::now();
+  JobSystem &pool = JobSystem::instance();
+
+  // unique assets in order of first use, and the assets of every job
+  std::vector<Asset> assets;
+  std::vector<std::vector<size_t>> job_assets(jobs.size());
+  std::map<std::pair<int, std::string>, size_t> index;
+  auto use = [&](size_t job, Asset::Kind kind, const std::string &path) {
+    auto res = index.emplace(std::make_pair((int)kind, path), assets.size());
+    if (res.second)
+      assets.push_back(Asset{kind, path});
+    assets[res.first->second].users++;
+    job_assets[job].push_back(res.first->second);
+  };
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const Job &job = jobs[i];
+    use(i, Asset::MODEL, job.obj);
+    for (const auto &map : job_maps(job))
+      use(i, job.options.compress_textures ? Asset::BLOCKS : Asset::TEXTURE,
+          map.first);
+  }
+
+  pool.parallel_for(0, (int)assets.size(), 1, [&](int lo, int hi) {
+    for (int i = lo; i < hi; i++) {
+      TR_TRACE_ARG("asset", "batch", i);
+      Asset &asset = assets[i];
+      Clock::time_point begin = Clock::now();
+      switch (asset.kind) {
+      case Asset::MODEL:
+        asset.pin = ModelCache::instance().load(asset.path);
+        break;
+      case Asset::TEXTURE:
+        asset.pin = TextureCache::instance().load(asset.path);
+        break;
+      case Asset::BLOCKS:
+        asset.pin = TextureCache::instance().load_blocks(asset.path);
+        break;
+      }
+      asset.ok = asset.pin != nullptr;
+      asset.pending = asset.users;
+      asset.load_ms = ms_since(begin);
+    }
+  });
+  double load_ms = ms_since(start);
+  // everything is loaded at this point, it is the peak of the caches
+  size_t cached_models = ModelCache::instance().size();
+  size_t cached_textures = TextureCache::instance().size();
+  size_t resident_bytes = TextureCache::instance().resident_bytes();
+  size_t mapped_bytes = TextureCache::instance().mapped_bytes();
+
+  // once its last job is done an asset is dropped from the caches, so long
+  // batches don't keep every model and texture they went through
+  std::mutex pending_mutex;
+  size_t evicted = 0;
+  auto release = [&](size_t job) {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    bool unused = false;
+    for (size_t i : job_assets[job]) {
+      if (--assets[i].pending == 0) {
+        assets[i].pin.reset();
+        unused = true;
+      }
+    }
+    if (unused)
+      evicted += ModelCache::instance().evict_unused() +
+                 TextureCache::instance().evict_unused();
+  };
+
+  std::vector<Result> results(jobs.size());
+  Clock::time_point render_start = Clock::now();
+  pool.parallel_for(0, (int)jobs.size(), 1, [&](int lo, int hi) {
+    for (int i = lo; i < hi; i++) {
+      render_job(jobs[i], results[i]);
+      release(i);
+    }
+  });
+  double render_ms = ms_since(render_start);
+
+  int failed = 0;
+  report << "# asset     load(ms)  jobs  path\n" << std::fixed;
+  for (const Asset &asset : assets) {
+    report << "  " << std::left << std::setw(8) << kind_names[asset.kind]
+           << std::right << std::setprecision(2) << std::setw(10)
+           << asset.load_ms << std::setw(6) << asset.users << "  "
+           << asset.path << (asset.ok ? "" : " (failed)") << "\n";
+  }
+  report << "# job  line  mode       size        render(ms)   save(ms)  "
+            "status  output\n";
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const Job &job = jobs[i];
+    const Result &res = results[i];
+    std::string size = std::to_string(job.options.width) + "x" +
+                       std::to_string(job.options.height);
+    report << std::setw(5) << i << std::setw(6) << job.line << "  "
+           << std::left << std::setw(11) << job.mode << std::setw(10) << size
+           << std::right << std::setw(12) << res.render_ms << std::setw(11)
+           << res.save_ms << "  " << res.status << "  " << job.output << "\n";
+    if (res.status != std::string("ok"))
+      failed++;
+  }
+  double total_ms = ms_since(start);
+  report << "# batch: " << jobs.size() << " jobs, " << failed << " failed, "
+         << assets.size() << " assets loaded in " << load_ms
+         << " ms, rendered in " << render_ms << " ms, total " << total_ms
+         << " ms (" << std::setprecision(1)
+         << (total_ms > 0 ? jobs.size() * 1000.0 / total_ms : 0.0)
+         << " jobs/s)\n";
+  report << "# cache: " << cached_models << " models, " << cached_textures
+         << " textures, " << resident_bytes / 1048576.0 << " MB resident, "
+         << mapped_bytes / 1048576.0 << " MB mapped, " << evicted
+         << " evicted as their last job finished\n";
+  report.unsetf(std::ios::floatfield);
+  return failed;
+}
+
+} // namespace batch
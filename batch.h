@@ -0,0 +1,41 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "rasterizer.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Batch rendering: a manifest lists render jobs, one per line, and the whole
+// list runs in one process. Every model and texture used by the jobs is
+// loaded once through ModelCache and TextureCache, then the jobs spread over
+// the job system, each rendering into its own rasterizer.
+//
+// Manifest lines are whitespace separated key=value items, '#' starts a
+// comment:
+//   obj=obj/diablo3_pose.obj mode=shading width=512 output=diablo.tga
+// Keys: obj, diffuse, normal, specular, output, mode, width, height, depth,
+// compress (0/1), parallel, camera, target (x,y,z), fov. Missing keys keep
+// the values given on the command line.
+
+namespace batch {
+
+struct Job {
+  std::string obj;
+  std::string diffuse;
+  std::string normal;
+  std::string specular;
+  std::string output;
+  std::string mode = "triangle"; // name for the report
+  RenderOptions options;
+  Camera camera;
+  int line = 0; // in the manifest
+};
+
+bool parse(const std::string &filename, const Job &defaults,
+           std::vector<Job> &jobs) noexcept;
+int run(std::vector<Job> &jobs, std::ostream &report) noexcept;
+
+} // namespace batch
+
+#endif // __BATCH_H__
@@ -0,0 +1,140 @@
+#include "bench.h"
+#include "perf.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+std::vector<Case> &registry() noexcept {
+  static std::vector<Case> cases;
+  return cases;
+}
+
+/**
+ * @brief Register a kernel, used through the BENCH() macro
+ *
+ * @param name unique kernel name
+ * @param fn kernel
+ * @param iterations kernel calls per sample
+ * @return true, so that registration can initialize a static
+ */
+bool add(const char *name, KernelFn fn, int iterations) noexcept {
+  registry().push_back(Case{name, fn, std::max(1, iterations)});
+  return true;
+}
+
+/**
+ * @brief Run a kernel: warmup samples first, then timed samples
+ *
+ * @param bcase kernel to run
+ * @param warmup untimed samples, also used to load lazily built inputs
+ * @param samples timed samples
+ * @param counters hardware counters to sample around the timed runs, may be
+ * nullptr
+ * @return Result per iteration statistics in nanoseconds
+ */
+Result run(const Case &bcase, int warmup, int samples,
+           perf::Counters *counters) {
+  typedef std::chrono::steady_clock clock;
+  for (int i = 0; i < warmup; i++)
+    bcase.fn(bcase.iterations);
+
+  samples = std::max(1, samples);
+  std::vector<double> times(samples);
+  if (counters)
+    counters->start();
+  for (int i = 0; i < samples; i++) {
+    clock::time_point start = clock::now();
+    bcase.fn(bcase.iterations);
+    std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+    times[i] = elapsed.count() / bcase.iterations;
+  }
+
+  Result res;
+  if (counters)
+    res.perf = counters->stop();
+  res.name = bcase.name;
+  res.iterations = bcase.iterations;
+  res.samples = samples;
+  std::sort(times.begin(), times.end());
+  res.min = times.front();
+  res.max = times.back();
+  res.median = samples % 2 ? times[samples / 2]
+                           : (times[samples / 2 - 1] + times[samples / 2]) / 2;
+  // nearest rank percentile
+  res.p99 = times[std::min(samples - 1, (int)std::ceil(0.99 * samples) - 1)];
+  for (double t : times)
+    res.mean += t / samples;
+  return res;
+}
+
+void write_csv(std::ostream &out, const std::vector<Result> &results) {
+  out << "name,iterations,samples,min_ns,median_ns,mean_ns,p99_ns,max_ns";
+  for (int e = 0; e < perf::EVENT_NUM; e++)
+    out << "," << perf::event_name((perf::Event)e);
+  out << "\n";
+  out << std::fixed << std::setprecision(1);
+  for (const Result &r : results) {
+    out << r.name << "," << r.iterations << "," << r.samples << "," << r.min
+        << "," << r.median << "," << r.mean << "," << r.p99 << "," << r.max;
+    for (int e = 0; e < perf::EVENT_NUM; e++) {
+      out << ",";
+      if (r.perf.valid[e])
+        out << r.perf.values[e];
+    }
+    out << "\n";
+  }
+}
+
+void write_json(std::ostream &out, const std::vector<Result> &results) {
+  out << "[\n" << std::fixed << std::setprecision(1);
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    out << "  {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+        << ", \"samples\": " << r.samples << ", \"min_ns\": " << r.min
+        << ", \"median_ns\": " << r.median << ", \"mean_ns\": " << r.mean
+        << ", \"p99_ns\": " << r.p99 << ", \"max_ns\": " << r.max
+        << ", \"perf\": ";
+    perf::print_json(out, r.perf);
+    out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "]\n";
+}
+
+/**
+ * @brief Read medians back from a csv report, to compare against a baseline
+ *
+ * @param filename csv written by write_csv()
+ * @param medians name -> median_ns
+ * @return true if the file could be read
+ */
+bool read_csv(const char *filename, std::map<std::string, double> &medians) {
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  std::string line;
+  std::getline(in, line); // header
+  while (std::getline(in, line)) {
+    std::istringstream iss(line);
+    std::string field;
+    std::vector<std::string> fields;
+    while (std::getline(iss, field, ','))
+      fields.push_back(field);
+    if (fields.size() >= 5)
+      medians[fields[0]] = std::stod(fields[4]);
+  }
+  return true;
+}
+
+} // namespace bench
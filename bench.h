@@ -0,0 +1,67 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "perf.h"
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Tiny benchmark harness. Kernels register themselves with BENCH(), every
+// run calls the kernel `iterations` times and is timed as one sample. The
+// runner does warmup runs, repeats the samples and reports median/p99 per
+// iteration, see bench_main.cpp for the command line.
+
+namespace bench {
+
+typedef void (*KernelFn)(int iterations);
+
+struct Case {
+  std::string name;
+  KernelFn fn;
+  int iterations; // kernel calls per sample
+};
+
+struct Result {
+  std::string name;
+  int iterations = 0;
+  int samples = 0;
+  // nanoseconds per iteration
+  double min = 0;
+  double median = 0;
+  double mean = 0;
+  double p99 = 0;
+  double max = 0;
+  perf::Sample perf; // over all the measured samples
+};
+
+std::vector<Case> &registry() noexcept;
+bool add(const char *name, KernelFn fn, int iterations) noexcept;
+
+Result run(const Case &bcase, int warmup, int samples,
+           perf::Counters *counters = nullptr);
+
+void write_csv(std::ostream &out, const std::vector<Result> &results);
+void write_json(std::ostream &out, const std::vector<Result> &results);
+bool read_csv(const char *filename, std::map<std::string, double> &medians);
+
+/**
+ * @brief Keep the compiler from optimizing a computed value away
+ *
+ * @tparam T value type
+ * @param value value considered used
+ */
+template <typename T> inline void do_not_optimize(const T &value) noexcept {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace bench
+
+#define BENCH(name, iters)                                                     \
+  static void bench_##name(int);                                               \
+  static const bool bench_registered_##name =                                  \
+      bench::add(#name, bench_##name, (iters));                                \
+  static void bench_##name(int iterations)
+
+#endif // __BENCH_H__
@@ -1,12 +1,17 @@
+#include "bench.h"
 #include "tgaimage.h"
 #include <cstdlib>
-#include <iostream>
 #include <utility>
 
-void save_image(TGAImage &image);
+// line drawing kernels, from the naive parametric version to Bresenham
+
+static TGAImage &canvas() {
+  static TGAImage image(800, 800, TGAImage::RGB, TGAImage::BOTTOM_LEFT);
+  return image;
+}
 
 // too slow!
-void draw_line1(int x0, int y0, int x1, int y1, TGAImage &image,
+static void draw_line1(int x0, int y0, int x1, int y1, TGAImage &image,
                 TGAColor color) {
   for (float t = 0.0f; t < 1.; t += 0.001f) {
     int x = x0 + (x1 - x0) * t;
@@ -16,7 +21,7 @@ void draw_line1(int x0, int y0, int x1, int y1, TGAImage &image,
 }
 
 // only for not sleep and not inverse
-void draw_line2(int x0, int y0, int x1, int y1, TGAImage &image,
+static void draw_line2(int x0, int y0, int x1, int y1, TGAImage &image,
                 TGAColor color) {
   for (int x = x0; x <= x1; x++) {
     float t = (x - x0) / (float)(x1 - x0);
@@ -26,7 +31,7 @@ void draw_line2(int x0, int y0, int x1, int y1, TGAImage &image,
 }
 
 // best fit
-void draw_line3(int x0, int y0, int x1, int y1, TGAImage &image,
+static void draw_line3(int x0, int y0, int x1, int y1, TGAImage &image,
                 TGAColor color) {
   bool steep = false;
   if (std::abs(x0 - x1) <
@@ -51,7 +56,7 @@ void draw_line3(int x0, int y0, int x1, int y1, TGAImage &image,
 }
 
 // optimized
-void draw_line4(int x0, int y0, int x1, int y1, TGAImage &image,
+static void draw_line4(int x0, int y0, int x1, int y1, TGAImage &image,
                 TGAColor color) {
   bool steep = false;
   if (std::abs(x0 - x1) <
@@ -84,7 +89,7 @@ void draw_line4(int x0, int y0, int x1, int y1, TGAImage &image,
 }
 
 // optimized optimized !
-void draw_line5(int x0, int y0, int x1, int y1, TGAImage &image,
+static void draw_line5(int x0, int y0, int x1, int y1, TGAImage &image,
                 TGAColor color) {
   bool steep = false;
   if (std::abs(x0 - x1) < std::abs(y0 - y1)) {
@@ -115,32 +120,27 @@ void draw_line5(int x0, int y0, int x1, int y1, TGAImage &image,
   }
 }
 
-int main() {
-  TGAImage image(800, 800, TGAImage::RGB);
-  TGAColor red(255, 0, 0, 255);
-  TGAColor green(0, 255, 0, 255);
-  TGAColor blue(0, 0, 255, 255);
+BENCH(draw_line1, 1000) {
+  for (int i = 0; i < iterations; i++)
+    draw_line1(100, 100, 500, 700, canvas(), red);
+}
 
-  for (int i = 0; i < 100000; i++) {
-    draw_line1(100, 100, 500, 700, image, red);
-    draw_line2(200, 200, 600, 300, image, blue);
-    draw_line3(0, 100, 100, 600, image, green);
-    draw_line4(500, 100, 100, 500, image, red);
-    draw_line5(500, 100, 100, 800, image, green);
-  }
-  image.flip_vertically();
+BENCH(draw_line2, 1000) {
+  for (int i = 0; i < iterations; i++)
+    draw_line2(200, 200, 600, 300, canvas(), blue);
+}
 
-  save_image(image);
-  return 0;
+BENCH(draw_line3, 1000) {
+  for (int i = 0; i < iterations; i++)
+    draw_line3(0, 100, 100, 600, canvas(), green);
 }
 
-void save_image(TGAImage &image) {
-  std::string filename;
-  std::cout << "Picture rendered succeessfully!\nWhere to save the result:\n";
-  std::cin >> filename;
-  if (filename.empty() || filename.length() <= 4 ||
-      filename.substr(filename.length() - 4, 4) != ".tga") {
-    filename.append(".tga");
-  }
-  image.write_tga_file(filename.c_str());
-}
\ No newline at end of file
+BENCH(draw_line4, 1000) {
+  for (int i = 0; i < iterations; i++)
+    draw_line4(500, 100, 100, 500, canvas(), red);
+}
+
+BENCH(draw_line5, 1000) {
+  for (int i = 0; i < iterations; i++)
+    draw_line5(500, 100, 100, 800, canvas(), green);
+}
@@ -0,0 +1,177 @@
+#include "bench.h"
+#include "jobs.h"
+#include "perf.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+  std::string filter;
+  int warmup = 2;
+  int samples = 15;
+  std::string csv;
+  std::string json;
+  std::string baseline;
+  double threshold = 10.0; // allowed median slowdown in percent
+  bool list = false;
+  bool perf = false;
+  int threads = 0; // job system workers, 0 for one per hardware thread
+};
+
+/**
+ * @brief print usage text on terminal
+ *
+ */
+void print_usage() {
+  std::cout
+      << "Usage: tinyrenderer_bench [Options]\n"
+      << "Options:\n"
+      << "  -f, --filter STR     Only run kernels whose name contains STR\n"
+      << "  -l, --list           List kernels and exit\n"
+      << "  -w, --warmup N       Untimed runs per kernel (默认: 2)\n"
+      << "  -r, --reps N         Timed samples per kernel (默认: 15)\n"
+      << "  --csv FILE           Write the report as csv\n"
+      << "  --json FILE          Write the report as json\n"
+      << "  --perf               Sample hardware counters per kernel\n"
+      << "  --threads N          Worker threads of the job system (默认: one "
+         "per cpu)\n"
+      << "  --baseline FILE      Compare medians against an earlier csv "
+         "report,\n"
+      << "                       exit 1 on regression or if it can't be read\n"
+      << "  --threshold PCT      Allowed median slowdown against the baseline "
+         "(默认: 10)\n"
+      << "  --help               Show help message\n"
+      << "Examples:\n"
+      << "  tinyrenderer_bench --filter draw_line --reps 30\n"
+      << "  tinyrenderer_bench --csv new.csv --baseline old.csv\n";
+}
+
+/**
+ * @brief Parse arguments for main
+ *
+ * @param argc As defined in main()
+ * @param argv As defined in main()
+ * @return BenchOptions harness configuration
+ */
+BenchOptions parse_args(int argc, char **argv) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--help") {
+      print_usage();
+      exit(0);
+    } else if ((arg == "-f" || arg == "--filter") && has_value) {
+      options.filter = argv[++i];
+    } else if (arg == "-l" || arg == "--list") {
+      options.list = true;
+    } else if ((arg == "-w" || arg == "--warmup") && has_value) {
+      options.warmup = std::stoi(argv[++i]);
+    } else if ((arg == "-r" || arg == "--reps") && has_value) {
+      options.samples = std::stoi(argv[++i]);
+    } else if (arg == "--csv" && has_value) {
+      options.csv = argv[++i];
+    } else if (arg == "--json" && has_value) {
+      options.json = argv[++i];
+    } else if (arg == "--perf") {
+      options.perf = true;
+    } else if (arg == "--threads" && has_value) {
+      options.threads = std::stoi(argv[++i]);
+    } else if (arg == "--baseline" && has_value) {
+      options.baseline = argv[++i];
+    } else if (arg == "--threshold" && has_value) {
+      options.threshold = std::stod(argv[++i]);
+    } else {
+      std::cerr << "Error: Invalid argument " << arg << std::endl;
+      print_usage();
+      exit(1);
+    }
+  }
+  return options;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options = parse_args(argc, argv);
+
+  std::vector<bench::Case> cases;
+  for (const bench::Case &bcase : bench::registry())
+    if (bcase.name.find(options.filter) != std::string::npos)
+      cases.push_back(bcase);
+  if (options.list) {
+    for (const bench::Case &bcase : cases)
+      std::cout << bcase.name << "\n";
+    return 0;
+  }
+
+  // read before running anything, a gate with a wrong path must fail
+  std::map<std::string, double> baseline;
+  if (!options.baseline.empty() &&
+      !bench::read_csv(options.baseline.c_str(), baseline)) {
+    std::cerr << "Error: Can't read baseline " << options.baseline
+              << std::endl;
+    return 1;
+  }
+
+  // opened before the workers start so that the workers count too
+  std::unique_ptr<perf::Counters> counters;
+  if (options.perf) {
+    counters = std::make_unique<perf::Counters>(true);
+    if (!counters->available()) {
+      std::cerr << "# perf: counters unavailable, " << counters->error()
+                << "\n";
+      counters.reset();
+    }
+  }
+  JobSystem::instance().configure(options.threads);
+
+  std::cout << std::left << std::setw(28) << "# kernel" << std::right
+            << std::setw(14) << "median(ns)" << std::setw(14) << "p99(ns)"
+            << std::setw(14) << "min(ns)" << "\n"
+            << std::fixed << std::setprecision(1);
+  std::vector<bench::Result> results;
+  for (const bench::Case &bcase : cases) {
+    bench::Result res =
+        bench::run(bcase, options.warmup, options.samples, counters.get());
+    std::cout << "  " << std::left << std::setw(26) << res.name << std::right
+              << std::setw(14) << res.median << std::setw(14) << res.p99
+              << std::setw(14) << res.min << std::endl;
+    if (counters)
+      perf::print(std::cout, res.name.c_str(), res.perf);
+    results.push_back(res);
+  }
+
+  if (!options.csv.empty()) {
+    std::ofstream out(options.csv);
+    bench::write_csv(out, results);
+  }
+  if (!options.json.empty()) {
+    std::ofstream out(options.json);
+    bench::write_json(out, results);
+  }
+
+  // regression check against an earlier report
+  int regressions = 0;
+  if (!options.baseline.empty()) {
+    for (const bench::Result &res : results) {
+      auto it = baseline.find(res.name);
+      if (it == baseline.end() || it->second <= 0)
+        continue;
+      double change = (res.median / it->second - 1.0) * 100.0;
+      if (change > options.threshold) {
+        std::cout << "# REGRESSION " << res.name << ": " << std::showpos
+                  << change << std::noshowpos << "% (" << it->second
+                  << " -> " << res.median << " ns)\n";
+        regressions++;
+      }
+    }
+    std::cout << "# " << regressions << " regression(s) above "
+              << options.threshold << "%\n";
+  }
+  return regressions ? 1 : 0;
+}
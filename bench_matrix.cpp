@@ -0,0 +1,136 @@
+#include "bench.h"
+#include "gmath.hpp"
+#include "model.h"
+#include "tgaimage.h"
+#include <cmath>
+#include <vector>
+
+// matrix kernels, the Mat4 operations used per vertex and per frame plus the
+// cube transform from the old matrix demo
+
+static const int width = 800;
+static const int height = 800;
+static const int depth = 255;
+
+static Mat4f sample_matrix() {
+  Mat4f m = Mat4f::identity();
+  float c = std::cos(0.3f), s = std::sin(0.3f);
+  m[0][0] = c;
+  m[0][2] = -s;
+  m[2][0] = s;
+  m[2][2] = c;
+  m[0][3] = 0.5f;
+  m[1][3] = -1.f;
+  m[2][3] = 2.f;
+  return m;
+}
+
+static Matrix<float, 4, 1> v2m(const Vec3f vec) noexcept {
+  Matrix<float, 4, 1> mat;
+  mat[0][0] = vec.x;
+  mat[1][0] = vec.y;
+  mat[2][0] = vec.z;
+  mat[3][0] = 1.f;
+  return mat;
+}
+
+static Vec3f m2v(const Matrix<float, 4, 1> mat) noexcept {
+  return Vec3f(mat[0][0] / mat[3][0], mat[1][0] / mat[3][0],
+               mat[2][0] / mat[3][0]);
+}
+
+static Mat4f viewport_trans(int x, int y, int w, int h) noexcept {
+  Mat4f m = Mat4f::identity();
+  m[0][3] = x + w / 2.0f;
+  m[1][3] = y + h / 2.0f;
+  m[2][3] = depth / 2.0f;
+  m[0][0] = w / 2.0f;
+  m[1][1] = h / 2.0f;
+  m[2][2] = depth / 2.0f;
+  return m;
+}
+
+static void line(Vec3i p0, Vec3i p1, TGAImage &image, TGAColor color) {
+  bool steep = false;
+  if (std::abs(p0.x - p1.x) < std::abs(p0.y - p1.y)) {
+    std::swap(p0.x, p0.y);
+    std::swap(p1.x, p1.y);
+    steep = true;
+  }
+  if (p0.x > p1.x) {
+    std::swap(p0, p1);
+  }
+
+  for (int x = p0.x; x <= p1.x; x++) {
+    float t = (x - p0.x) / (float)(p1.x - p0.x);
+    int y = p0.y * (1. - t) + p1.y * t + .5;
+    if (steep) {
+      image.set_pixel(y, x, color);
+    } else {
+      image.set_pixel(x, y, color);
+    }
+  }
+}
+
+BENCH(mat4_mul, 100000) {
+  Mat4f a = sample_matrix(), b = sample_matrix().transpose();
+  for (int i = 0; i < iterations; i++) {
+    bench::do_not_optimize(a);
+    Mat4f c = a * b;
+    bench::do_not_optimize(c);
+  }
+}
+
+BENCH(mat4_mul_vec, 100000) {
+  Mat4f a = sample_matrix();
+  Matrix<float, 4, 1> v = v2m(Vec3f(0.3f, -0.7f, 1.1f));
+  for (int i = 0; i < iterations; i++) {
+    bench::do_not_optimize(v);
+    Matrix<float, 4, 1> r = a * v;
+    bench::do_not_optimize(r);
+  }
+}
+
+BENCH(mat4_inverse, 100000) {
+  Mat4f a = sample_matrix();
+  for (int i = 0; i < iterations; i++) {
+    bench::do_not_optimize(a);
+    Mat4f r = a.inverse();
+    bench::do_not_optimize(r);
+  }
+}
+
+BENCH(mat4_transpose, 100000) {
+  Mat4f a = sample_matrix();
+  for (int i = 0; i < iterations; i++) {
+    bench::do_not_optimize(a);
+    Mat4f r = a.transpose();
+    bench::do_not_optimize(r);
+  }
+}
+
+BENCH(cube_transform, 100) {
+  static Model model("obj/cube.obj");
+  static TGAImage image(width, height, TGAImage::RGB, TGAImage::BOTTOM_LEFT);
+  Mat4f VP = viewport_trans(width / 4, width / 4, width / 2, height / 2);
+  Mat4f transform = Mat4f::identity();
+  transform[0][0] = transform[1][1] = transform[2][2] = 1.5f;
+
+  for (int i = 0; i < iterations; i++) {
+    for (int f = 0; f < model.f_num(); f++) {
+      std::vector<int> face = model.getf_vi(f);
+      for (int j = 0; j < (int)face.size(); j++) {
+        Vec3f wp0 = model.getv(face[j]);
+        Vec3f wp1 = model.getv(face[(j + 1) % face.size()]);
+
+        // the original model and the deformed one
+        Vec3f sp0 = m2v(VP * v2m(wp0));
+        Vec3f sp1 = m2v(VP * v2m(wp1));
+        line(Vec3i(sp0), Vec3i(sp1), image, white);
+        Vec3f dsp0 = m2v(VP * transform * v2m(wp0));
+        Vec3f dsp1 = m2v(VP * transform * v2m(wp1));
+        line(Vec3i(dsp0), Vec3i(dsp1), image, yellow);
+      }
+    }
+  }
+}
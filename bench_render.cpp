@@ -0,0 +1,58 @@
+#include "bench.h"
+#include "model.h"
+#include "rasterizer.h"
+#include <memory>
+#include <string>
+
+// full frame renders of the bundled head model, one case per rendering mode
+
+static const char *model_path = "obj/african_head.obj";
+static const std::string map_paths[3] = {"texture/african_head_diffuse.tga",
+                                         "texture/african_head_nm.tga",
+                                         "texture/african_head_spec.tga"};
+
+/**
+ * @brief Lazily build a rasterizer for one mode, with its model and textures
+ * bound, so setup cost stays out of the samples
+ *
+ * @param options rendering options, must outlive the rasterizer
+ * @return std::unique_ptr<Rasterizer> rasterizer ready to render
+ */
+static std::unique_ptr<Rasterizer> make_rasterizer(RenderOptions &options) {
+  auto rst = std::make_unique<Rasterizer>(options, new Model(model_path));
+  rst->bind_maps(load_maps(options, map_paths));
+  return rst;
+}
+
+static RenderOptions render_options(RenderingMode mode,
+                                    unsigned int shadingmode,
+                                    ParallelMode parallel) {
+  RenderOptions options;
+  options.mode = mode;
+  options.shadingmode = shadingmode;
+  options.parallel = parallel;
+  options.width = 512;
+  options.height = 512;
+  return options;
+}
+
+#define RENDER_BENCH(name, mode, shadingmode, parallel)                        \
+  BENCH(render_##name, 1) {                                                    \
+    static RenderOptions options =                                             \
+        render_options(mode, shadingmode, parallel);                           \
+    static std::unique_ptr<Rasterizer> rst = make_rasterizer(options);         \
+    for (int i = 0; i < iterations; i++)                                       \
+      rst->render();                                                           \
+  }
+
+RENDER_BENCH(wireframe, WIREFRAME, 0, TILES)
+RENDER_BENCH(zbuf, ZBUFGRAY, 0, TILES)
+RENDER_BENCH(triangle, TRIANGLE, 0, TILES)
+RENDER_BENCH(textured, TRIANGLE, DIFFUSE, TILES)
+RENDER_BENCH(shading, TRIANGLE, DIFFUSE | NORMAL | SPECULAR, TILES)
+RENDER_BENCH(overdraw, OVERDRAW, DIFFUSE | NORMAL | SPECULAR, TILES)
+
+// the same frames split by faces and depth merged, against the tiles above
+RENDER_BENCH(zbuf_sort_last, ZBUFGRAY, 0, SORT_LAST)
+RENDER_BENCH(shading_sort_last, TRIANGLE, DIFFUSE | NORMAL | SPECULAR,
+             SORT_LAST)
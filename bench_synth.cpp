@@ -0,0 +1,54 @@
+#include "bench.h"
+#include "rasterizer.h"
+#include "synth.h"
+#include <memory>
+
+// scaling sweeps over generated scenes: triangle count at constant overdraw,
+// triangle size at constant overdraw, and overdraw at constant size
+
+static const int frame_size = 512;
+
+/**
+ * @brief Build a rasterizer over a generated scene, outside of the samples
+ *
+ * @param options rendering options, must outlive the rasterizer
+ * @param spec scene spec as taken by synth::parse()
+ * @return std::unique_ptr<Rasterizer> rasterizer ready to render
+ */
+static std::unique_ptr<Rasterizer> make_rasterizer(RenderOptions &options,
+                                                   const char *spec) {
+  options.mode = TRIANGLE;
+  options.shadingmode = DIFFUSE;
+  options.width = frame_size;
+  options.height = frame_size;
+
+  synth::SceneParams params;
+  params.width = frame_size;
+  params.texture_size = 512;
+  synth::parse(spec, params);
+  synth::Scene scene = synth::generate(params);
+
+  auto rst = std::make_unique<Rasterizer>(options, scene.model.release());
+  rst->bind_texture(scene.diffuse, DIFFUSE);
+  return rst;
+}
+
+#define SYNTH_BENCH(name, spec)                                                \
+  BENCH(synth_##name, 1) {                                                     \
+    static RenderOptions options;                                              \
+    static std::unique_ptr<Rasterizer> rst = make_rasterizer(options, spec);   \
+    for (int i = 0; i < iterations; i++)                                       \
+      rst->render();                                                           \
+  }
+
+SYNTH_BENCH(tris_10k, "triangles=1e4,overdraw=2")
+SYNTH_BENCH(tris_100k, "triangles=1e5,overdraw=2")
+SYNTH_BENCH(tris_1m, "triangles=1e6,overdraw=2")
+
+SYNTH_BENCH(size_2px, "triangles=0,size=2,overdraw=2")
+SYNTH_BENCH(size_8px, "triangles=0,size=8,overdraw=2")
+SYNTH_BENCH(size_32px, "triangles=0,size=32,overdraw=2")
+
+SYNTH_BENCH(overdraw_1, "triangles=0,size=8,overdraw=1")
+SYNTH_BENCH(overdraw_4, "triangles=0,size=8,overdraw=4")
+SYNTH_BENCH(overdraw_16, "triangles=0,size=8,overdraw=16")
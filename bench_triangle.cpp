@@ -1,17 +1,21 @@
+#include "bench.h"
 #include "gmath.hpp"
 #include "tgaimage.h"
 #include <algorithm>
-#include <cstdio>
 #include <cstdlib>
-#include <iostream>
 #include <utility>
 
-const int width = 800;
-const int height = 800;
+// triangle drawing kernels, wireframe, line sweep, scanline and barycentric
 
-void save_image(TGAImage &image);
+static const int width = 800;
+static const int height = 800;
 
-void draw_line(Vec2i v0, Vec2i v1, TGAImage &image, TGAColor color) {
+static TGAImage &canvas() {
+  static TGAImage image(width, height, TGAImage::RGB, TGAImage::BOTTOM_LEFT);
+  return image;
+}
+
+static void draw_line(Vec2i v0, Vec2i v1, TGAImage &image, TGAColor color) {
   bool steep = false;
   if (std::abs(v0.x - v1.x) < std::abs(v0.y - v1.y)) {
     std::swap(v0.x, v0.y);
@@ -42,7 +46,7 @@ void draw_line(Vec2i v0, Vec2i v1, TGAImage &image, TGAColor color) {
 }
 
 // this method draw a triangle line frame
-void draw_triangle1(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
+static void draw_triangle1(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
                     TGAColor color) {
   draw_line(v0, v1, image, color);
   draw_line(v1, v2, image, color);
@@ -50,7 +54,7 @@ void draw_triangle1(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
 }
 
 // ummm, try to simply use scan line...?
-void draw_triangle2(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
+static void draw_triangle2(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
                     TGAColor color) {
   if (v0.y > v1.y)
     std::swap(v0, v1);
@@ -69,7 +73,7 @@ void draw_triangle2(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
 }
 
 // this method draw a perfect solid triangle
-void draw_triangle3(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
+static void draw_triangle3(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
                     TGAColor color) {
   // To keep it simple, the triangle won't use interpolate color:
   // 1. Sort vertices of the triangle by their y-coordinates;
@@ -103,7 +107,7 @@ void draw_triangle3(Vec2i v0, Vec2i v1, Vec2i v2, TGAImage &image,
   }
 }
 
-Vec3f barycentric2d(Vec2i *pts, Vec2i P) {
+static Vec3f barycentric2d(Vec2i *pts, Vec2i P) {
   Vec3f x_vec = Vec3f(pts[2].x - pts[0].x, pts[1].x - pts[0].x, pts[0].x - P.x);
   Vec3f y_vec = Vec3f(pts[2].y - pts[0].y, pts[1].y - pts[0].y, pts[0].y - P.y);
   Vec3f uv = x_vec ^ y_vec;
@@ -117,7 +121,7 @@ Vec3f barycentric2d(Vec2i *pts, Vec2i P) {
 }
 
 // function above is good , but not good enough for modern CPU
-void draw_triangle4(Vec2i *pts, TGAImage &image, TGAColor color) {
+static void draw_triangle4(Vec2i *pts, TGAImage &image, TGAColor color) {
   int xmax = -1, ymax = -1;
   int xmin = width + 1, ymin = height + 1;
   Vec2i pixelPos, cur;
@@ -146,34 +150,26 @@ void draw_triangle4(Vec2i *pts, TGAImage &image, TGAColor color) {
   }
 }
 
-int main() {
-  TGAImage image(width, height, TGAImage::RGB);
-
-  Vec2i t0[3] = {Vec2i(10, 70), Vec2i(50, 160), Vec2i(70, 80)};
-  Vec2i t1[3] = {Vec2i(180, 50), Vec2i(150, 1), Vec2i(70, 180)};
-  Vec2i t2[3] = {Vec2i(180, 150), Vec2i(120, 160), Vec2i(130, 180)};
-  Vec2i t3[3] = {Vec2i(200, 400), Vec2i(450, 180), Vec2i(300, 700)};
+BENCH(draw_triangle1, 100) {
+  Vec2i t[3] = {Vec2i(10, 70), Vec2i(50, 160), Vec2i(70, 80)};
+  for (int i = 0; i < iterations; i++)
+    draw_triangle1(t[0], t[1], t[2], canvas(), red);
+}
 
-  for (int i = 0; i < 1000; i++) {
-    draw_triangle1(t0[0], t0[1], t0[2], image, red);
-    draw_triangle2(t1[0], t1[1], t1[2], image, white);
-    draw_triangle3(t2[0], t2[1], t2[2], image, green);
-    draw_triangle4(t3, image, red);
-    std::cout << "Work on no." << i << " rendering...\n";
-  }
+BENCH(draw_triangle2, 100) {
+  Vec2i t[3] = {Vec2i(180, 50), Vec2i(150, 1), Vec2i(70, 180)};
+  for (int i = 0; i < iterations; i++)
+    draw_triangle2(t[0], t[1], t[2], canvas(), white);
+}
 
-  image.flip_vertically();
-  save_image(image);
-  return 0;
+BENCH(draw_triangle3, 100) {
+  Vec2i t[3] = {Vec2i(180, 150), Vec2i(120, 160), Vec2i(130, 180)};
+  for (int i = 0; i < iterations; i++)
+    draw_triangle3(t[0], t[1], t[2], canvas(), green);
 }
 
-void save_image(TGAImage &image) {
-  std::string filename;
-  std::cout << "Picture rendered succeessfully!\nWhere to save the result:\n";
-  std::cin >> filename;
-  if (filename.empty() || filename.length() <= 4 ||
-      filename.substr(filename.length() - 4, 4) != ".tga") {
-    filename.append(".tga");
-  }
-  image.write_tga_file(filename.c_str());
-}
\ No newline at end of file
+BENCH(draw_triangle4, 10) {
+  Vec2i t[3] = {Vec2i(200, 400), Vec2i(450, 180), Vec2i(300, 700)};
+  for (int i = 0; i < iterations; i++)
+    draw_triangle4(t, canvas(), red);
+}
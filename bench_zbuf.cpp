@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "gmath.hpp"
+#include "tgaimage.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <utility>
+
+// depth buffer kernels, the 1D ybuffer demo plus clearing and testing a
+// frame sized z buffer
+
+static const int width = 800;
+static const int frame_size = 1080 * 1080;
+
+static void rasterize(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color,
+                      int ybuffer[]) {
+  if (p0.x > p1.x) {
+    std::swap(p0, p1);
+  }
+  for (int x = p0.x; x <= p1.x; x++) {
+    float t = (x - p0.x) / (float)(p1.x - p0.x);
+    int y = p0.y * (1. - t) + p1.y * t;
+    if (ybuffer[x] < y) {
+      ybuffer[x] = y;
+      image.set_pixel(x, 0, color);
+    }
+  }
+}
+
+static float *zbuffer() {
+  static std::unique_ptr<float[]> buffer(new float[frame_size]);
+  return buffer.get();
+}
+
+BENCH(ybuffer_rasterize, 1000) {
+  static TGAImage render(width, 16, TGAImage::RGB, TGAImage::BOTTOM_LEFT);
+  int ybuffer[width];
+  for (int i = 0; i < iterations; i++) {
+    std::fill_n(ybuffer, width, std::numeric_limits<int>::min());
+    rasterize(Vec2i(20, 34), Vec2i(744, 400), render, red, ybuffer);
+    rasterize(Vec2i(120, 434), Vec2i(444, 400), render, green, ybuffer);
+    rasterize(Vec2i(330, 463), Vec2i(594, 200), render, blue, ybuffer);
+  }
+}
+
+BENCH(zbuffer_clear, 10) {
+  float *buffer = zbuffer();
+  for (int i = 0; i < iterations; i++) {
+    std::fill_n(buffer, frame_size, -std::numeric_limits<float>::max());
+    bench::do_not_optimize(buffer[i % frame_size]);
+  }
+}
+
+BENCH(zbuffer_test, 10) {
+  // every other row passes, so the write path and the branch both show up
+  float *buffer = zbuffer();
+  std::fill_n(buffer, frame_size, 0.f);
+  for (int i = 0; i < iterations; i++) {
+    float z = (i & 1) ? 1.f : -1.f;
+    for (int y = 0; y < 1080; y++) {
+      float *row = buffer + y * 1080;
+      float depth = (y & 1) ? z : -z;
+      for (int x = 0; x < 1080; x++) {
+        if (row[x] < depth)
+          row[x] = depth;
+      }
+    }
+    bench::do_not_optimize(buffer[i % frame_size]);
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef __BUFFER_HPP__
+#define __BUFFER_HPP__
+
+#include <cstdlib>
+#include <memory>
+#include <type_traits>
+
+// Cache line aligned array of trivial values for per frame buffers. Its
+// capacity only grows: resizing within it keeps the memory and leaves the
+// contents alone, so a render loop stops allocating after its first frame.
+template <typename T> class AlignedBuffer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "AlignedBuffer only holds plain values");
+
+public:
+  static const size_t alignment = 64;
+
+private:
+  struct Free {
+    void operator()(T *ptr) const noexcept { std::free(ptr); }
+  };
+
+  std::unique_ptr<T, Free> data_;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+
+public:
+  /**
+   * @brief Set the element count, contents are unspecified afterwards
+   *
+   * @param size elements
+   * @return true if new memory had to be allocated
+   */
+  bool resize(size_t size) noexcept {
+    size_ = size;
+    if (size <= capacity_)
+      return false;
+    // aligned_alloc wants a multiple of the alignment
+    size_t bytes = (size * sizeof(T) + alignment - 1) / alignment * alignment;
+    data_.reset(static_cast<T *>(std::aligned_alloc(alignment, bytes)));
+    capacity_ = data_ ? bytes / sizeof(T) : 0;
+    size_ = data_ ? size : 0;
+    return true;
+  }
+
+  T *get() const noexcept { return data_.get(); }
+  size_t size() const noexcept { return size_; }
+  size_t capacity() const noexcept { return capacity_; }
+  T &operator[](size_t i) const noexcept { return data_.get()[i]; }
+};
+
+#endif // __BUFFER_HPP__
@@ -0,0 +1,328 @@
+#include "protocol.h"
+#include "rasterizer.h"
+#include "shmframe.h"
+#include "tgaimage.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Stand-in client of the render server (tinyrenderer --serve): sends the
+// same request a number of times and reports the round trip latency, the
+// last frame can be saved to check what came back. With --watch it reads
+// the frames a renderer publishes in shared memory (tinyrenderer --shm).
+
+struct ClientOptions {
+  std::string socket;
+  std::string watch;
+  std::string output;
+  int requests = 100;
+  int warmup = 5;
+  bool shm = false;
+};
+
+void print_usage() {
+  std::cout
+      << "Usage: tinyrenderer_client --socket PATH [Options]\n"
+      << "       tinyrenderer_client --watch NAME [-n N] [-o FILE]\n"
+      << "Options:\n"
+      << "  --socket PATH  Socket of a running 'tinyrenderer --serve PATH'\n"
+      << "  --watch NAME   Read N frames published by 'tinyrenderer --shm "
+         "NAME'\n"
+      << "  -m, --mode     wireframe/zbuf/triangle/textured/shading/overdraw "
+         "(默认: triangle)\n"
+      << "  -w, --width    Frame width (默认: 800)\n"
+      << "  -h, --height   Frame height (默认: 800)\n"
+      << "  --parallel P   tiles/sort-last (默认: tiles)\n"
+      << "  --camera X,Y,Z Camera position (默认: 1,0,3)\n"
+      << "  --target X,Y,Z Point the camera looks at (默认: 0,0,0)\n"
+      << "  --fov DEG      Perspective field of view (默认: 0)\n"
+      << "  -n, --requests N  Timed requests (默认: 100)\n"
+      << "  --warmup N     Untimed requests sent first (默认: 5)\n"
+      << "  --shm          Get pixels through a shared memory segment "
+         "instead of the socket\n"
+      << "  -o, --output   Save the last frame as tga\n"
+      << "  --help         Show help message\n";
+}
+
+bool parse_vec3(const char *arg, float *v) {
+  return sscanf(arg, "%f,%f,%f", &v[0], &v[1], &v[2]) == 3;
+}
+
+bool read_full(int fd, void *data, size_t size) {
+  char *p = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool write_full(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Parse arguments into the request sent and the client options
+ *
+ * @return bool false on invalid arguments
+ */
+bool parse_args(int argc, char **argv, protocol::Request &req,
+                ClientOptions &client) {
+  RenderOptions options;
+  options.width = options.height = 800;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--help") {
+      print_usage();
+      exit(0);
+    } else if (arg == "--shm") {
+      client.shm = true;
+    } else if (!has_value) {
+      std::cerr << "Error: missing value for " << arg << std::endl;
+      return false;
+    } else if (arg == "--socket") {
+      client.socket = argv[++i];
+    } else if (arg == "--watch") {
+      client.watch = argv[++i];
+    } else if (arg == "-m" || arg == "--mode") {
+      if (!parse_mode(argv[++i], options)) {
+        std::cerr << "Error: Invalid rendering mode " << argv[i] << std::endl;
+        return false;
+      }
+    } else if (arg == "--parallel") {
+      if (!parse_parallel(argv[++i], options)) {
+        std::cerr << "Error: Invalid parallel mode " << argv[i] << std::endl;
+        return false;
+      }
+    } else if (arg == "-w" || arg == "--width") {
+      options.width = std::atoi(argv[++i]);
+    } else if (arg == "-h" || arg == "--height") {
+      options.height = std::atoi(argv[++i]);
+    } else if (arg == "--camera") {
+      if (!parse_vec3(argv[++i], req.position))
+        return false;
+    } else if (arg == "--target") {
+      if (!parse_vec3(argv[++i], req.target))
+        return false;
+    } else if (arg == "--fov") {
+      req.fov = std::atof(argv[++i]);
+    } else if (arg == "-n" || arg == "--requests") {
+      client.requests = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--warmup") {
+      client.warmup = std::max(std::atoi(argv[++i]), 0);
+    } else if (arg == "-o" || arg == "--output") {
+      client.output = argv[++i];
+    } else {
+      std::cerr << "Error: unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  if (client.socket.empty() && client.watch.empty()) {
+    print_usage();
+    return false;
+  }
+  req.width = options.width;
+  req.height = options.height;
+  req.mode = options.mode;
+  req.shadingmode = options.shadingmode;
+  req.parallel = options.parallel;
+  return true;
+}
+
+int connect_server(const std::string &path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return -1;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+  return sorted[i];
+}
+
+/**
+ * @brief Read frames of a shared frame region as they get published, and
+ * report how many were seen and skipped
+ *
+ * @param client options, requests is the frame count to read
+ * @return int exit code
+ */
+int watch_frames(const ClientOptions &client) {
+  SharedFrameReader reader;
+  if (!reader.open(client.watch)) {
+    std::cerr << "Error: no shared frame at " << client.watch << std::endl;
+    return 1;
+  }
+  TGAImage frame;
+  uint64_t last = 0, first = 0;
+  int seen = 0;
+  auto begin = std::chrono::steady_clock::now();
+  while (seen < client.requests) {
+    uint64_t number = reader.read(frame, last);
+    if (!number) {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      continue;
+    }
+    if (!first)
+      first = number;
+    last = number;
+    seen++;
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+  std::cout << "# " << seen << " frames read, up to frame " << last << ", "
+            << (last - first + 1 - seen) << " skipped, "
+            << frame.get_width() << "x" << frame.get_height() << "x"
+            << frame.get_bytespp() << ", " << seen / seconds << " fps\n";
+  if (!client.output.empty() && !frame.write_tga_file(client.output.c_str()))
+    return 1;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  protocol::Request req;
+  ClientOptions client;
+  if (!parse_args(argc, argv, req, client))
+    return 1;
+  if (!client.watch.empty())
+    return watch_frames(client);
+
+  int fd = connect_server(client.socket);
+  if (fd < 0) {
+    std::cerr << "Error: can't connect to " << client.socket << ": "
+              << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  // the largest frame has 4 bytes per pixel, the segment is sized for it
+  size_t capacity = (size_t)req.width * req.height * 4;
+  std::vector<unsigned char> pixels;
+  unsigned char *shm = nullptr;
+  if (client.shm) {
+    snprintf(req.shm_name, sizeof(req.shm_name), "/tinyrenderer-client-%d",
+             (int)getpid());
+    int shm_fd = shm_open(req.shm_name, O_CREAT | O_RDWR, 0600);
+    if (shm_fd < 0 || ftruncate(shm_fd, capacity) != 0) {
+      std::cerr << "Error: can't create shared memory " << req.shm_name
+                << std::endl;
+      return 1;
+    }
+    void *addr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      shm_fd, 0);
+    close(shm_fd);
+    if (addr == MAP_FAILED)
+      return 1;
+    shm = static_cast<unsigned char *>(addr);
+    req.flags |= protocol::REPLY_SHM;
+  } else {
+    pixels.resize(capacity);
+  }
+
+  std::vector<double> latency_us, render_us;
+  protocol::Reply reply;
+  int status = 0;
+  for (int i = 0; i < client.warmup + client.requests; i++) {
+    auto begin = std::chrono::steady_clock::now();
+    if (!write_full(fd, &req, sizeof(req)) ||
+        !read_full(fd, &reply, sizeof(reply)) ||
+        reply.magic != protocol::reply_magic) {
+      std::cerr << "Error: connection lost" << std::endl;
+      status = 1;
+      break;
+    }
+    if (reply.status != protocol::OK) {
+      std::cerr << "Error: request refused, status " << reply.status
+                << std::endl;
+      status = 1;
+      break;
+    }
+    if (!(reply.flags & protocol::REPLY_SHM) &&
+        (reply.bytes > pixels.size() ||
+         !read_full(fd, pixels.data(), reply.bytes))) {
+      std::cerr << "Error: bad frame from server" << std::endl;
+      status = 1;
+      break;
+    }
+    double us = std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - begin)
+                    .count();
+    if (i >= client.warmup) {
+      latency_us.push_back(us);
+      render_us.push_back(reply.render_us);
+    }
+  }
+  close(fd);
+
+  if (!latency_us.empty()) {
+    double mean = 0;
+    for (double us : latency_us)
+      mean += us;
+    mean /= latency_us.size();
+    std::sort(latency_us.begin(), latency_us.end());
+    std::sort(render_us.begin(), render_us.end());
+    std::cout << "# " << latency_us.size() << " requests " << req.width
+              << "x" << req.height << (client.shm ? " shm" : " inline")
+              << ", round trip (ms):\n"
+              << std::fixed << std::setprecision(3)
+              << "  min     " << latency_us.front() / 1000 << "\n"
+              << "  median  " << percentile(latency_us, 0.5) / 1000 << "\n"
+              << "  p90     " << percentile(latency_us, 0.9) / 1000 << "\n"
+              << "  p99     " << percentile(latency_us, 0.99) / 1000 << "\n"
+              << "  max     " << latency_us.back() / 1000 << "\n"
+              << "  mean    " << mean / 1000 << "\n"
+              << "  render  " << percentile(render_us, 0.5) / 1000
+              << " (server median)\n";
+  }
+
+  if (status == 0 && !client.output.empty()) {
+    TGAImage frame(reply.width, reply.height, reply.bytespp,
+                   (TGAImage::Origin)reply.origin);
+    memcpy(frame.buffer(), shm ? shm : pixels.data(), reply.bytes);
+    if (!frame.write_tga_file(client.output.c_str()))
+      status = 1;
+  }
+  if (shm) {
+    munmap(shm, capacity);
+    shm_unlink(req.shm_name);
+  }
+  return status;
+}
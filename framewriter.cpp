@@ -0,0 +1,142 @@
+#include "framewriter.h"
+#include "stats.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+/**
+ * @brief Start the I/O thread
+ *
+ * @param depth frames that can wait for the disk before submit() blocks
+ */
+FrameWriter::FrameWriter(int depth) noexcept : slots_(std::max(depth, 1)) {
+  thread_ = std::thread([this]() { run(); });
+}
+
+FrameWriter::~FrameWriter() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+  if (stream_ && !stream_->close())
+    failures_++;
+}
+
+/**
+ * @brief Send frames to a video stream rather than to tga files, to call
+ * before the first submit()
+ *
+ * @param path "-" for stdout, else a file or fifo
+ * @param format stream format
+ * @param fps frame rate of the stream
+ * @return true if the stream is open
+ */
+bool FrameWriter::open_stream(const std::string &path,
+                              VideoStream::Format format, int fps) noexcept {
+  flush();
+  auto stream = std::make_unique<VideoStream>();
+  if (!stream->open(path, format, fps))
+    return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream_ = std::move(stream);
+  return true;
+}
+
+/**
+ * @brief Queue a copy of a frame for writing, waiting for a free slot first.
+ * Slots keep their memory, copying a frame of the same size allocates
+ * nothing.
+ *
+ * @param frame frame to save, may be reused as soon as this returns
+ * @param filename tga file to write
+ */
+void FrameWriter::submit(const TGAImage &frame,
+                         const std::string &filename) noexcept {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return count_ < (int)slots_.size(); });
+  Slot &slot = slots_[head_];
+  // the slot is ours until count_ says otherwise, copy without the lock
+  lock.unlock();
+  {
+    TR_TRACE("copy", "io");
+    TGAImage &image = slot.image;
+    if (image.get_width() == frame.get_width() &&
+        image.get_height() == frame.get_height() &&
+        image.get_bytespp() == frame.get_bytespp() &&
+        image.get_origin() == frame.get_origin() && !image.is_mapped())
+      memcpy(image.buffer(), frame.buffer(),
+             size_t(frame.get_width()) * frame.get_height() *
+                 frame.get_bytespp());
+    else
+      image = frame;
+    slot.filename = filename;
+  }
+  lock.lock();
+  head_ = (head_ + 1) % (int)slots_.size();
+  count_++;
+  lock.unlock();
+  changed_.notify_all();
+}
+
+/**
+ * @brief Queue a copy of a frame for the video stream
+ *
+ * @param frame frame to append, may be reused as soon as this returns
+ */
+void FrameWriter::submit(const TGAImage &frame) noexcept {
+  submit(frame, std::string());
+}
+
+/**
+ * @brief Wait until every submitted frame is on disk, or written to the
+ * stream
+ *
+ */
+void FrameWriter::flush() noexcept {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return count_ == 0; });
+  // the I/O thread is idle, the stream is ours
+  if (stream_ && !stream_->flush())
+    failures_++;
+}
+
+/**
+ * @brief Frames that could not be written so far
+ *
+ * @return int failure count
+ */
+int FrameWriter::failures() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failures_;
+}
+
+void FrameWriter::run() noexcept {
+  if (trace::enabled())
+    trace::set_thread_name("writer");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this]() { return count_ > 0 || stop_; });
+    if (count_ == 0)
+      return; // stopping with nothing left
+    int tail = (head_ - count_ + (int)slots_.size()) % (int)slots_.size();
+    Slot &slot = slots_[tail];
+    lock.unlock();
+    bool ok;
+    {
+      TR_STAGE(SAVE);
+      TR_TRACE("save", "io");
+      ok = stream_ ? stream_->write(slot.image)
+                   : slot.image.write_tga_file(slot.filename.c_str());
+    }
+    if (!ok && !stream_)
+      std::cerr << "Error: Can't write " << slot.filename << std::endl;
+    lock.lock();
+    if (!ok)
+      failures_++;
+    count_--;
+    changed_.notify_all();
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef __FRAMEWRITER_H__
+#define __FRAMEWRITER_H__
+
+#include "tgaimage.h"
+#include "videostream.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Saves frames on a background I/O thread, so encoding and writing frame N
+// overlap the rendering of frame N + 1. Frames are copied into a small ring
+// of slots (two by default, double buffering): submit() returns as soon as
+// the copy is done and only blocks while every slot still waits for disk.
+// Once open_stream() is called frames are appended to a video stream instead
+// of each going to its own tga file, the conversion runs on the I/O thread.
+class FrameWriter {
+private:
+  struct Slot {
+    TGAImage image;
+    std::string filename;
+  };
+
+  std::vector<Slot> slots_;
+  int head_ = 0;  // next slot to fill
+  int count_ = 0; // filled slots waiting to be written
+  int failures_ = 0;
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::thread thread_;
+  std::unique_ptr<VideoStream> stream_;
+
+  void run() noexcept;
+
+public:
+  explicit FrameWriter(int depth = 2) noexcept;
+  FrameWriter(const FrameWriter &) = delete;
+  FrameWriter &operator=(const FrameWriter &) = delete;
+  ~FrameWriter() noexcept;
+
+  bool open_stream(const std::string &path, VideoStream::Format format,
+                   int fps) noexcept;
+  void submit(const TGAImage &frame, const std::string &filename) noexcept;
+  void submit(const TGAImage &frame) noexcept;
+  void flush() noexcept;
+  int failures() noexcept;
+};
+
+#endif // __FRAMEWRITER_H__
@@ -0,0 +1,534 @@
+#include "jobs.h"
+#include "model.h"
+#include "rasterizer.h"
+#include "tgaimage.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// Golden image regression suite: renders every mode of the bundled models,
+// compares the frames against the references in golden/ and checks the frame
+// times against golden/budgets.csv. Run with --update to record both anew.
+// The tga_rle case checks that RLE files read back as written.
+
+struct GoldenOptions {
+  std::string filter;
+  std::string dir = "golden";          // references and budgets
+  std::string out = "build/golden";    // frames and diffs of failing cases
+  int tolerance = 2;                   // max channel difference of a pixel
+  double max_bad = 0.1;                // percent of pixels over tolerance
+  double psnr = 40.0;                  // minimal PSNR in dB
+  double margin = 50.0;                // allowed overrun of a budget, percent
+  int reps = 5;                        // timed renders per case
+  bool budgets = true;
+  bool update = false;
+};
+
+struct GoldenCase {
+  const char *name;
+  const char *obj;
+  RenderingMode mode;
+  unsigned int shadingmode;
+  ParallelMode parallel = TILES;
+  int threads = 0; // of the job system, 0 for one per cpu
+  // reference of another case the frame must match, for ways of rendering
+  // that give the same pixels; --update only records their budget
+  const char *reference = nullptr;
+  float fov = 0; // perspective projection seen from perspective_eye
+  // rendered through set_window() in tiles of this size, written one at a
+  // time into a tga as --tiled does
+  int tile = 0;
+  // or in this many row bands as --shard I/N, one after the other, placed
+  // as tinyrenderer_merge places the parts
+  int shards = 0;
+
+  // variants chain onto the base fields, e.g. {...}.tiled(97).ref("head_zbuf")
+  GoldenCase sort_last(int layers) const {
+    GoldenCase variant = *this;
+    variant.parallel = SORT_LAST;
+    variant.threads = layers;
+    return variant;
+  }
+  GoldenCase ref(const char *case_name) const {
+    GoldenCase variant = *this;
+    variant.reference = case_name;
+    return variant;
+  }
+  GoldenCase perspective(float degrees) const {
+    GoldenCase variant = *this;
+    variant.fov = degrees;
+    return variant;
+  }
+  GoldenCase tiled(int size) const {
+    GoldenCase variant = *this;
+    variant.tile = size;
+    return variant;
+  }
+  GoldenCase sharded(int count) const {
+    GoldenCase variant = *this;
+    variant.shards = count;
+    return variant;
+  }
+};
+
+const unsigned int all_maps = DIFFUSE | NORMAL | SPECULAR;
+
+// the cube has no uvs nor normals and diablo only a normal map, so they only
+// go through the untextured modes
+const GoldenCase cases[] = {
+    {"head_wireframe", "obj/african_head.obj", WIREFRAME, 0},
+    {"head_zbuf", "obj/african_head.obj", ZBUFGRAY, 0},
+    {"head_triangle", "obj/african_head.obj", TRIANGLE, 0},
+    {"head_textured", "obj/african_head.obj", TRIANGLE, DIFFUSE},
+    {"head_shading", "obj/african_head.obj", TRIANGLE, all_maps},
+    {"head_overdraw", "obj/african_head.obj", OVERDRAW, all_maps},
+    GoldenCase{"head_sort_last", "obj/african_head.obj", TRIANGLE, all_maps}
+        .sort_last(4)
+        .ref("head_shading"),
+    GoldenCase{"head_tiled", "obj/african_head.obj", TRIANGLE, all_maps}
+        .tiled(97)
+        .ref("head_shading"),
+    GoldenCase{"head_zbuf_tiled", "obj/african_head.obj", ZBUFGRAY, 0}
+        .tiled(97)
+        .ref("head_zbuf"),
+    GoldenCase{"head_shards", "obj/african_head.obj", TRIANGLE, all_maps}
+        .sharded(5)
+        .ref("head_shading"),
+    GoldenCase{"head_perspective", "obj/african_head.obj", TRIANGLE, all_maps}
+        .perspective(40),
+    GoldenCase{"head_wireframe_fov", "obj/african_head.obj", WIREFRAME, 0}
+        .perspective(40),
+    {"diablo_wireframe", "obj/diablo3_pose.obj", WIREFRAME, 0},
+    {"diablo_zbuf", "obj/diablo3_pose.obj", ZBUFGRAY, 0},
+    {"diablo_triangle", "obj/diablo3_pose.obj", TRIANGLE, 0},
+    {"cube_wireframe", "obj/cube.obj", WIREFRAME, 0},
+    {"cube_zbuf", "obj/cube.obj", ZBUFGRAY, 0},
+};
+
+const int frame_size = 512;
+
+// maps of the head, the other models are only rendered untextured
+const std::string map_paths[3] = {"texture/african_head_diffuse.tga",
+                                  "texture/african_head_nm.tga",
+                                  "texture/african_head_spec.tga"};
+
+// off the default axis and above, so the view matrix is not a plain shift
+const Vec3f perspective_eye(1.5f, 0.8f, 3.5f);
+
+// absolute allowance on top of the margin, sub-millisecond frames jitter by
+// more than any sensible percentage
+const double budget_slack_ms = 0.5;
+
+// part of the frame a windowed case renders at once, bottom-left origin
+struct Window {
+  int x, y, w, h;
+};
+
+struct Comparison {
+  bool dims = true;  // sizes and formats match
+  double bad = 0;    // percent of pixels over tolerance
+  int max_diff = 0;  // largest channel difference
+  double psnr = 0;   // dB, infinity for identical frames
+};
+
+/**
+ * @brief print usage text on terminal
+ *
+ */
+void print_usage() {
+  std::cout
+      << "Usage: tinyrenderer_golden [Options]\n"
+      << "Options:\n"
+      << "  -f, --filter STR     Only run cases whose name contains STR\n"
+      << "  --dir DIR            References and budgets.csv (默认: golden)\n"
+      << "  --out DIR            Frames and diffs of failing cases (默认: "
+         "build/golden)\n"
+      << "  --tolerance N        Max channel difference of a pixel (默认: 2)\n"
+      << "  --max-bad PCT        Allowed pixels over tolerance (默认: 0.1)\n"
+      << "  --psnr DB            Minimal PSNR against the reference (默认: "
+         "40)\n"
+      << "  --margin PCT         Allowed frame time over budget (默认: 50)\n"
+      << "  -r, --reps N         Timed renders per case (默认: 5)\n"
+      << "  --no-budget          Only check images, e.g. in debug builds\n"
+      << "  --update             Record references and budgets anew\n"
+      << "  --help               Show help message\n";
+}
+
+/**
+ * @brief Parse arguments for main
+ *
+ * @param argc As defined in main()
+ * @param argv As defined in main()
+ * @return GoldenOptions suite configuration
+ */
+GoldenOptions parse_args(int argc, char **argv) {
+  GoldenOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--help") {
+      print_usage();
+      exit(0);
+    } else if ((arg == "-f" || arg == "--filter") && has_value) {
+      options.filter = argv[++i];
+    } else if (arg == "--dir" && has_value) {
+      options.dir = argv[++i];
+    } else if (arg == "--out" && has_value) {
+      options.out = argv[++i];
+    } else if (arg == "--tolerance" && has_value) {
+      options.tolerance = std::stoi(argv[++i]);
+    } else if (arg == "--max-bad" && has_value) {
+      options.max_bad = std::stod(argv[++i]);
+    } else if (arg == "--psnr" && has_value) {
+      options.psnr = std::stod(argv[++i]);
+    } else if (arg == "--margin" && has_value) {
+      options.margin = std::stod(argv[++i]);
+    } else if ((arg == "-r" || arg == "--reps") && has_value) {
+      options.reps = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--no-budget") {
+      options.budgets = false;
+    } else if (arg == "--update") {
+      options.update = true;
+    } else {
+      std::cerr << "Error: Invalid argument " << arg << std::endl;
+      print_usage();
+      exit(1);
+    }
+  }
+  return options;
+}
+
+/**
+ * @brief Compare a frame against its reference, both addressed from the
+ * bottom row so the storage order of either doesn't matter
+ *
+ * @param frame rendered frame
+ * @param ref reference image
+ * @param tolerance max channel difference of a good pixel
+ * @param diff filled with a grayscale map of the channel differences
+ * @return Comparison statistics
+ */
+Comparison compare(const TGAImage &frame, const TGAImage &ref, int tolerance,
+                   TGAImage &diff) {
+  Comparison cmp;
+  int w = frame.get_width(), h = frame.get_height();
+  int bpp = frame.get_bytespp();
+  if (w != ref.get_width() || h != ref.get_height() ||
+      bpp != ref.get_bytespp()) {
+    cmp.dims = false;
+    return cmp;
+  }
+  diff = TGAImage(w, h, TGAImage::GRAYSCALE, TGAImage::BOTTOM_LEFT);
+  uint64_t bad = 0;
+  double squared = 0;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      TGAColor a = frame.get_texel(x, y), b = ref.get_texel(x, y);
+      int pixel_diff = 0;
+      for (int c = 0; c < bpp; c++) {
+        int d = std::abs(int(a.raw[c]) - int(b.raw[c]));
+        pixel_diff = std::max(pixel_diff, d);
+        squared += double(d) * d;
+      }
+      if (pixel_diff > tolerance)
+        bad++;
+      cmp.max_diff = std::max(cmp.max_diff, pixel_diff);
+      diff.set_pixel(x, y, TGAColor(std::min(255, pixel_diff * 8), 1));
+    }
+  }
+  cmp.bad = 100.0 * bad / (double(w) * h);
+  double mse = squared / (double(w) * h * bpp);
+  cmp.psnr = mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+  return cmp;
+}
+
+/**
+ * @brief Read "name,frame_ms" lines
+ *
+ * @param filename csv file
+ * @param budgets filled with budgets in milliseconds
+ * @return true if the file could be read
+ */
+bool read_budgets(const std::string &filename,
+                  std::map<std::string, double> &budgets) {
+  std::ifstream in(filename);
+  if (!in)
+    return false;
+  std::string line;
+  std::getline(in, line); // header
+  while (std::getline(in, line)) {
+    size_t comma = line.find(',');
+    if (comma == std::string::npos)
+      continue;
+    budgets[line.substr(0, comma)] = std::atof(line.c_str() + comma + 1);
+  }
+  return true;
+}
+
+bool write_budgets(const std::string &filename,
+                   const std::map<std::string, double> &budgets) {
+  std::ofstream out(filename);
+  out << "name,frame_ms\n" << std::fixed << std::setprecision(3);
+  for (const auto &budget : budgets)
+    out << budget.first << "," << budget.second << "\n";
+  return bool(out);
+}
+
+/**
+ * @brief Write an image with RLE and read it back. Pixels go a, b b, c, d d,
+ * ...: single raw pixels between runs of two, the densest packets the encoder
+ * writes, a header byte for every pixel.
+ *
+ * @param bpp pixel format
+ * @param file scratch file
+ * @return true if the image read back is the one written
+ */
+bool rle_round_trip(int bpp, const std::string &file) {
+  const int width = 1024, height = 256;
+  TGAImage image(width, height, bpp, TGAImage::BOTTOM_LEFT);
+  unsigned char value = 0;
+  unsigned char *pixel = image.buffer();
+  for (int i = 0; i < width * height; i++, pixel += bpp) {
+    if (i % 3 != 2)
+      value += 37;
+    for (int c = 0; c < bpp; c++)
+      pixel[c] = value + c;
+  }
+  TGAImage back;
+  bool same = image.write_tga_file(file.c_str(), true) &&
+              back.read_tga_file(file.c_str()) &&
+              back.get_width() == width && back.get_height() == height &&
+              back.get_bytespp() == bpp;
+  for (int y = 0; same && y < height; y++)
+    for (int x = 0; same && x < width; x++)
+      same = memcmp(image.get_texel(x, y).raw, back.get_texel(x, y).raw,
+                    bpp) == 0;
+  std::remove(file.c_str());
+  return same;
+}
+
+/**
+ * @brief Cut the frame into the windows of a case, none for whole frames
+ *
+ * @param gcase case to render
+ * @return std::vector<Window> windows in rendering order
+ */
+std::vector<Window> case_windows(const GoldenCase &gcase) {
+  std::vector<Window> windows;
+  // same bands as tinyrenderer's resolve_region()
+  for (int i = 0; i < gcase.shards; i++) {
+    int y0 = frame_size * i / gcase.shards;
+    int y1 = frame_size * (i + 1) / gcase.shards;
+    windows.push_back(Window{0, y0, frame_size, y1 - y0});
+  }
+  for (int y = 0; gcase.tile > 0 && y < frame_size; y += gcase.tile)
+    for (int x = 0; x < frame_size; x += gcase.tile)
+      windows.push_back(Window{x, y, std::min(gcase.tile, frame_size - x),
+                               std::min(gcase.tile, frame_size - y)});
+  return windows;
+}
+
+/**
+ * @brief Render a frame window by window through set_window(), each one
+ * written at its place into an uncompressed tga as soon as it is done
+ *
+ * @param rst rasterizer with the model and textures bound
+ * @param windows parts of the frame
+ * @param filename tga the windows are written into
+ * @return true if the file could be written
+ */
+bool render_windows(Rasterizer &rst, const std::vector<Window> &windows,
+                    const std::string &filename) {
+  TGATileWriter file;
+  if (!file.open(filename.c_str(), frame_size, frame_size,
+                 rst.output_format()))
+    return false;
+  bool ok = true;
+  for (const Window &window : windows) {
+    rst.resize(window.w, window.h);
+    rst.set_window(window.x, window.y, frame_size, frame_size);
+    rst.render();
+    ok = file.write(rst.get_frame(), window.x, window.y) && ok;
+  }
+  return file.close() && ok;
+}
+
+/**
+ * @brief Render a case, the first render is untimed and warms the caches
+ *
+ * @param gcase case to render
+ * @param reps timed renders
+ * @param scratch file windowed cases are assembled in
+ * @param frame filled with the frame, empty if it couldn't be assembled
+ * @return double median frame time in milliseconds
+ */
+double render_case(const GoldenCase &gcase, int reps,
+                   const std::string &scratch, TGAImage &frame) {
+  RenderOptions options;
+  options.mode = gcase.mode;
+  options.shadingmode = gcase.shadingmode;
+  options.width = frame_size;
+  options.height = frame_size;
+  options.parallel = gcase.parallel;
+  // sort-last draws a layer per thread, cases ask for several whatever the
+  // cpu count so the merge is exercised
+  JobSystem &jobs = JobSystem::instance();
+  if (gcase.threads)
+    jobs.configure(gcase.threads);
+  Rasterizer rst(options, new Model(gcase.obj));
+  if (gcase.fov > 0) {
+    Camera camera;
+    camera.position = perspective_eye;
+    camera.fov = gcase.fov;
+    rst.set_camera(camera);
+  }
+  rst.bind_maps(load_maps(options, map_paths));
+
+  std::vector<Window> windows = case_windows(gcase);
+  auto render = [&]() {
+    if (!windows.empty())
+      return render_windows(rst, windows, scratch);
+    rst.render();
+    return true;
+  };
+  bool ok = render();
+  std::vector<double> times;
+  for (int i = 0; i < reps; i++) {
+    auto start = std::chrono::steady_clock::now();
+    ok = render() && ok;
+    times.push_back(std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count());
+  }
+  if (windows.empty()) {
+    frame = rst.get_frame();
+  } else {
+    if (!ok || !frame.read_tga_file(scratch.c_str()))
+      frame = TGAImage();
+    std::remove(scratch.c_str());
+  }
+  if (gcase.threads)
+    jobs.configure(0);
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+int main(int argc, char **argv) {
+  GoldenOptions options = parse_args(argc, argv);
+  mkdir(options.out.c_str(), 0755);
+  std::string budget_file = options.dir + "/budgets.csv";
+  std::map<std::string, double> budgets;
+  if (!read_budgets(budget_file, budgets) && options.budgets &&
+      !options.update)
+    std::cerr << "Warning: no budgets in " << budget_file << "\n";
+
+  std::cout << std::left << std::setw(20) << "# case" << std::right
+            << std::setw(10) << "bad(%)" << std::setw(10) << "psnr"
+            << std::setw(12) << "frame(ms)" << std::setw(12) << "budget"
+            << "  result\n";
+  int failures = 0;
+  if (std::string("tga_rle").find(options.filter) != std::string::npos &&
+      !options.update) {
+    const int formats[] = {TGAImage::GRAYSCALE, TGAImage::RGB,
+                           TGAImage::RGBA};
+    bool ok = true;
+    for (int bpp : formats)
+      ok = rle_round_trip(bpp, options.out + "/tga_rle.tga") && ok;
+    std::cout << "  " << std::left << std::setw(18) << "tga_rle" << std::right
+              << std::setw(44) << "-" << (ok ? "  ok\n" : "  FAIL\n");
+    failures += !ok;
+  }
+  for (const GoldenCase &gcase : cases) {
+    if (std::string(gcase.name).find(options.filter) == std::string::npos)
+      continue;
+    TGAImage frame;
+    double ms = render_case(gcase, options.reps,
+                            options.out + "/" + gcase.name + "_windows.tga",
+                            frame);
+    const char *ref_name = gcase.reference ? gcase.reference : gcase.name;
+    std::string ref_file = options.dir + "/" + ref_name + ".tga";
+
+    if (options.update) {
+      if (!gcase.reference)
+        frame.write_tga_file(ref_file.c_str());
+      budgets[gcase.name] = ms;
+      std::cout << "  " << std::left << std::setw(18) << gcase.name
+                << std::right << std::fixed << std::setprecision(2)
+                << std::setw(42) << ms << "  updated\n";
+      continue;
+    }
+
+    std::vector<std::string> problems;
+    TGAImage ref, diff;
+    Comparison cmp;
+    if (!ref.read_tga_file(ref_file.c_str())) {
+      problems.push_back("no reference");
+    } else {
+      cmp = compare(frame, ref, options.tolerance, diff);
+      if (!cmp.dims)
+        problems.push_back("size/format differ");
+      else if (cmp.bad > options.max_bad)
+        problems.push_back("pixels over tolerance");
+      else if (cmp.psnr < options.psnr)
+        problems.push_back("psnr too low");
+    }
+
+    auto budget = budgets.find(gcase.name);
+    bool has_budget = options.budgets && budget != budgets.end();
+    if (has_budget && ms > budget->second * (1.0 + options.margin / 100.0) +
+                              budget_slack_ms) {
+      std::ostringstream msg;
+      msg << std::fixed << std::setprecision(0) << "over budget by "
+          << (ms / budget->second - 1.0) * 100.0 << "%";
+      problems.push_back(msg.str());
+    }
+
+    std::cout << "  " << std::left << std::setw(18) << gcase.name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(10)
+              << cmp.bad << std::setw(10) << cmp.psnr << std::setw(12) << ms;
+    if (has_budget)
+      std::cout << std::setw(12) << budget->second;
+    else
+      std::cout << std::setw(12) << "-";
+    if (problems.empty()) {
+      std::cout << "  ok\n";
+      continue;
+    }
+    failures++;
+    std::cout << "  FAIL";
+    for (const std::string &problem : problems)
+      std::cout << " (" << problem << ")";
+    std::cout << "\n";
+
+    // keep what was rendered for inspection
+    std::string stem = options.out + "/" + gcase.name;
+    frame.write_tga_file((stem + ".tga").c_str());
+    if (cmp.dims && diff.get_width())
+      diff.write_tga_file((stem + "_diff.tga").c_str());
+  }
+
+  if (options.update) {
+    if (!write_budgets(budget_file, budgets)) {
+      std::cerr << "Error: can't write " << budget_file << "\n";
+      return 1;
+    }
+    std::cout << "# references and budgets written into " << options.dir
+              << "\n";
+    return 0;
+  }
+  std::cout << "# " << failures << " case(s) failed\n";
+  return failures ? 1 : 0;
+}
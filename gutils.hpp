@@ -49,6 +49,31 @@ constexpr static Matrix<T, 4, 1> v2m(const Vec4<T> v) noexcept {
   return m;
 }
 
+/**
+ * @brief Transform a point with homogeneous divide, same arithmetic as
+ * m2v3(m * v2m(v)) but on a plain copy of the matrix, so hot loops don't
+ * build temporary matrices
+ *
+ * @tparam T type
+ * @param m row major 4*4 matrix
+ * @param v point to transform
+ * @return Vec3<T> transformed point
+ */
+template <typename T>
+static inline Vec3<T> transform_point(const T (&m)[4][4],
+                                      const Vec3<T> v) noexcept {
+  T res[4];
+  for (int i = 0; i < 4; i++) {
+    T sum = 0;
+    sum += m[i][0] * v.x;
+    sum += m[i][1] * v.y;
+    sum += m[i][2] * v.z;
+    sum += m[i][3] * T(1.0f);
+    res[i] = sum;
+  }
+  return Vec3<T>(res[0] / res[3], res[1] / res[3], res[2] / res[3]);
+}
+
 /**
  * @brief Get a matrix for transformation from NDC to Screen/Viewport
  *
@@ -123,14 +148,16 @@ static Mat4f model_trans() noexcept {
  *
  * @param eye_fov fov value
  * @param aspect_ratio width:height(16:9 always)
- * @param n near plate
- * @param f far plate
+ * @param n near plate, negative z
+ * @param f far plate, negative z
  * @return Mat4f Projection of MVP
  */
 static Mat4f projection_trans(float eye_fov, float aspect_ratio, float n,
                               float f) noexcept {
 
-  float t = tan(eye_fov / 2.0f * MY_PI / 180.0f) * n;
+  // planes are on the -z side, the extent must stay positive or the image
+  // comes out upside down
+  float t = tan(eye_fov / 2.0f * MY_PI / 180.0f) * std::abs(n);
   float b = -t;
   float r = t * aspect_ratio;
   float l = -r;
@@ -0,0 +1,279 @@
+#include "jobs.h"
+#include "trace.h"
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+thread_local int current_worker = 0; // threads outside the pool act as 0
+
+/**
+ * @brief Pin the calling thread to the nth cpu it is allowed to run on
+ *
+ * @param nth worker index, wraps around the available cpus
+ */
+void pin_thread(int nth) noexcept {
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return;
+  int count = CPU_COUNT(&allowed);
+  if (count <= 0)
+    return;
+  int target = nth % count;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed) || target-- > 0)
+      continue;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    return;
+  }
+#else
+  (void)nth;
+#endif
+}
+
+// job records all have the same size, freed ones are kept for the next jobs
+// so the steady job traffic of a render loop doesn't go through the heap
+struct BlockPool {
+  static const size_t max_blocks = 4096;
+  std::mutex mutex;
+  std::vector<void *> blocks;
+  size_t size = 0;
+
+  void *get(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (bytes == size && !blocks.empty()) {
+        void *block = blocks.back();
+        blocks.pop_back();
+        return block;
+      }
+    }
+    return ::operator new(bytes);
+  }
+
+  void put(void *block, size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (size == 0)
+        size = bytes;
+      if (bytes == size && blocks.size() < max_blocks) {
+        blocks.push_back(block);
+        return;
+      }
+    }
+    ::operator delete(block);
+  }
+};
+
+BlockPool &job_blocks() {
+  static BlockPool *pool = new BlockPool(); // never destroyed, like jobs may
+  return *pool;
+}
+
+template <typename T> struct JobAllocator {
+  typedef T value_type;
+
+  JobAllocator() = default;
+  template <typename U> JobAllocator(const JobAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(job_blocks().get(n * sizeof(T)));
+  }
+  void deallocate(T *ptr, size_t n) { job_blocks().put(ptr, n * sizeof(T)); }
+
+  template <typename U> bool operator==(const JobAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const JobAllocator<U> &) const {
+    return false;
+  }
+};
+
+} // namespace
+
+/**
+ * @brief Queue a job at the back, doubling the ring when it is full
+ *
+ * @param job job to queue
+ */
+void JobSystem::JobRing::push_back(JobHandle job) noexcept {
+  if (size_ == slots_.size()) {
+    std::vector<JobHandle> grown(std::max<size_t>(64, 2 * slots_.size()));
+    for (size_t i = 0; i < size_; i++)
+      grown[i] = std::move(slot(i));
+    slots_.swap(grown);
+    head_ = 0;
+  }
+  slot(size_++) = std::move(job);
+}
+
+JobSystem::JobHandle JobSystem::JobRing::pop_back() noexcept {
+  return std::move(slot(--size_));
+}
+
+JobSystem::JobHandle JobSystem::JobRing::pop_front() noexcept {
+  JobHandle job = std::move(slot(0));
+  head_ = (head_ + 1) & (slots_.size() - 1);
+  size_--;
+  return job;
+}
+
+JobSystem::JobSystem() noexcept { start(0); }
+
+JobSystem::~JobSystem() noexcept { shutdown(); }
+
+JobSystem &JobSystem::instance() noexcept {
+  static JobSystem jobs;
+  return jobs;
+}
+
+int JobSystem::worker_index() noexcept { return current_worker; }
+
+/**
+ * @brief Restart the pool with another thread count, only call it while no
+ * job is queued or running
+ *
+ * @param threads worker count including the calling thread, 0 for one per
+ * hardware thread
+ * @param affinity pin every worker (and the caller) to its own cpu
+ */
+void JobSystem::configure(int threads, bool affinity) noexcept {
+  shutdown();
+  affinity_ = affinity;
+  start(threads);
+}
+
+void JobSystem::start(int threads) noexcept {
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  stop_ = false;
+  for (int i = 0; i < threads; i++)
+    workers_.push_back(std::make_unique<Worker>());
+  if (affinity_)
+    pin_thread(0);
+  for (int i = 1; i < threads; i++)
+    threads_.emplace_back([this, i]() { worker_loop(i); });
+}
+
+void JobSystem::shutdown() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread &thread : threads_)
+    thread.join();
+  threads_.clear();
+  workers_.clear();
+  queued_ = 0;
+}
+
+void JobSystem::worker_loop(int index) noexcept {
+  current_worker = index;
+  if (affinity_)
+    pin_thread(index);
+  std::string name = "worker " + std::to_string(index);
+  if (trace::enabled())
+    trace::set_thread_name(name.c_str());
+
+  while (!stop_.load(std::memory_order_acquire)) {
+    if (JobHandle job = pop(index)) {
+      execute(job);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this]() {
+      return queued_.load(std::memory_order_acquire) > 0 ||
+             stop_.load(std::memory_order_acquire);
+    });
+  }
+}
+
+/**
+ * @brief Take a job, newest of our own queue first, then the oldest of
+ * another worker's
+ *
+ * @param index worker looking for work
+ * @return JobHandle job, or nullptr if every queue is empty
+ */
+JobSystem::JobHandle JobSystem::pop(int index) noexcept {
+  int count = (int)workers_.size();
+  for (int i = 0; i < count; i++) {
+    Worker &worker = *workers_[(index + i) % count];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.jobs.empty())
+      continue;
+    JobHandle job = i == 0 ? worker.jobs.pop_back() : worker.jobs.pop_front();
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    return job;
+  }
+  return nullptr;
+}
+
+void JobSystem::execute(const JobHandle &job) noexcept {
+  if (job->fn)
+    job->fn();
+  finish(job);
+}
+
+void JobSystem::finish(const JobHandle &job) noexcept {
+  if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+      job->parent)
+    finish(job->parent);
+}
+
+/**
+ * @brief Create a job, not queued until run()
+ *
+ * @param fn work to do, may be empty for pure grouping jobs
+ * @param parent job that must not complete before this one
+ * @return JobHandle the job
+ */
+JobSystem::JobHandle JobSystem::create(std::function<void()> fn,
+                                       const JobHandle &parent) noexcept {
+  JobHandle job = std::allocate_shared<Job>(JobAllocator<Job>());
+  job->fn = std::move(fn);
+  job->parent = parent;
+  if (parent)
+    parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+  return job;
+}
+
+void JobSystem::run(const JobHandle &job) noexcept {
+  int index = current_worker < (int)workers_.size() ? current_worker : 0;
+  {
+    Worker &worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.jobs.push_back(job);
+  }
+  queued_.fetch_add(1, std::memory_order_release);
+  if (threads_.empty())
+    return;
+  // taking the lock orders us against a worker about to sleep
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  wake_.notify_one();
+}
+
+/**
+ * @brief Wait for a job and its children, running queued jobs meanwhile
+ *
+ * @param job job to wait for
+ */
+void JobSystem::wait(const JobHandle &job) noexcept {
+  int index = current_worker < (int)workers_.size() ? current_worker : 0;
+  while (job->unfinished.load(std::memory_order_acquire) > 0) {
+    if (JobHandle other = pop(index))
+      execute(other);
+    else
+      std::this_thread::yield();
+  }
+}
@@ -0,0 +1,126 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process wide work-stealing job system. Every worker owns a queue: it pushes
+// and pops its own jobs at the back and steals from the front of the others
+// when it runs dry. Jobs may have a parent, which only completes once all
+// its children did, and wait() keeps the waiting thread busy with other jobs
+// meanwhile. The thread calling configure() (the main thread) is worker 0 and
+// only runs jobs while waiting, with one thread everything runs inline.
+class JobSystem {
+public:
+  struct Job;
+  typedef std::shared_ptr<Job> JobHandle;
+
+  struct Job {
+    std::function<void()> fn;
+    JobHandle parent;
+    std::atomic<int> unfinished{1}; // itself plus running children
+  };
+
+private:
+  // double ended queue on a ring whose capacity only grows, so once the jobs
+  // of a frame fit the render loop queues them without touching the heap
+  class JobRing {
+    std::vector<JobHandle> slots_; // power of two sized
+    size_t head_ = 0;              // oldest job
+    size_t size_ = 0;
+
+    JobHandle &slot(size_t i) noexcept {
+      return slots_[(head_ + i) & (slots_.size() - 1)];
+    }
+
+  public:
+    bool empty() const noexcept { return size_ == 0; }
+    void push_back(JobHandle job) noexcept;
+    JobHandle pop_back() noexcept;
+    JobHandle pop_front() noexcept;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    JobRing jobs;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<int> queued_{0}; // jobs sitting in any queue
+  std::atomic<bool> stop_{false};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool affinity_ = false;
+
+  JobSystem() noexcept;
+
+  void worker_loop(int index) noexcept;
+  JobHandle pop(int index) noexcept;
+  void execute(const JobHandle &job) noexcept;
+  void finish(const JobHandle &job) noexcept;
+  void start(int threads) noexcept;
+  void shutdown() noexcept;
+
+public:
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+  ~JobSystem() noexcept;
+
+  static JobSystem &instance() noexcept;
+
+  void configure(int threads, bool affinity = false) noexcept;
+  int thread_count() const noexcept { return (int)workers_.size(); }
+  static int worker_index() noexcept;
+
+  JobHandle create(std::function<void()> fn,
+                   const JobHandle &parent = nullptr) noexcept;
+  void run(const JobHandle &job) noexcept;
+  void wait(const JobHandle &job) noexcept;
+
+  /**
+   * @brief Split [begin, end) into chunks of about grain items and run
+   * fn(chunk_begin, chunk_end) on the pool, returning once all are done.
+   * Chunk boundaries only depend on the range and grain, never on the
+   * thread count.
+   *
+   * @param begin first index
+   * @param end one past the last index
+   * @param grain items per chunk
+   * @param fn callable taking (int begin, int end)
+   */
+  template <typename F>
+  void parallel_for(int begin, int end, int grain, F &&fn) noexcept {
+    grain = std::max(grain, 1);
+    if (end - begin <= grain || thread_count() <= 1) {
+      for (int lo = begin; lo < end; lo += grain)
+        fn(lo, std::min(lo + grain, end));
+      return;
+    }
+    JobHandle root = create(nullptr);
+    for (int lo = begin; lo < end; lo += grain) {
+      int hi = std::min(lo + grain, end);
+      run(create([&fn, lo, hi]() { fn(lo, hi); }, root));
+    }
+    run(root);
+    wait(root);
+  }
+
+  /**
+   * @brief Number of chunks parallel_for() uses for a range
+   *
+   * @return int chunk count
+   */
+  static int chunk_count(int begin, int end, int grain) noexcept {
+    grain = std::max(grain, 1);
+    return end > begin ? (end - begin + grain - 1) / grain : 0;
+  }
+};
+
+#endif // __JOBS_H__
@@ -1,10 +1,29 @@
 #include "model.h"
+#include "batch.h"
+#include "framewriter.h"
+#include "jobs.h"
+#include "modelcache.h"
+#include "overdraw.h"
+#include "perf.h"
 #include "rasterizer.h"
+#include "server.h"
+#include "shmframe.h"
+#include "stats.h"
+#include "synth.h"
+#include "texcache.h"
 #include "tgaimage.h"
+#include "trace.h"
+#include "videostream.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <sys/resource.h>
+#include <vector>
 
 struct FilePath {
   std::string obj = "obj/african_head.obj";
@@ -12,8 +31,37 @@ struct FilePath {
   std::string normal = "texture/african_head_nm.tga";
   std::string specular = "texture/african_head_spec.tga";
   std::string output = "output.tga";
+  std::string stats;
+  std::string trace;
+  std::string synth; // scene spec, see synth::parse()
+  std::string synth_obj;
+  std::string batch;  // job manifest, see batch.h
+  std::string socket; // render server, see server.h
+  std::string shm;    // shared frame instead of files, see shmframe.h
+  std::string stream; // video stream instead of files, see videostream.h
 } path;
 
+Camera camera;
+std::string mode_name = "triangle";
+int turntable = 0; // frames of a camera orbit, 0 renders a single frame
+const float turntable_fov = 30.0f; // when --fov isn't given
+VideoStream::Format stream_format = VideoStream::Y4M;
+int fps = 30;
+int tiled = 0; // tile side of out-of-core renders, 0 renders in memory
+
+// part of the image rendered, bottom-left pixel and size, the whole image
+// while w is 0; --shard I/N sets it to the band I of N
+struct Region {
+  int x = 0, y = 0, w = 0, h = 0;
+} region;
+int shard_index = 0;
+int shard_count = 0;
+
+bool print_stats = false;
+bool print_perf = false;
+int threads = 0; // job system workers, 0 for one per hardware thread
+bool affinity = false;
+
 /**
  * @brief print usage text on terminal
  *
@@ -23,16 +71,86 @@ void print_usage() {
       << "Usage: tinyrenderer [Options] <filepath>\n"
       << "Options:\n"
       << "  -m, --mode     RenderMode "
-         "(wireframe/zbuf/triangle/textured/shading, "
+         "(wireframe/zbuf/triangle/textured/shading/overdraw, "
          "默认: line)\n"
       << "  -w, --width    Width for output image (默认: 800)\n"
       << "  -h, --height   Height for output image (默认: 800)\n"
       << "  -d, --depth    Max depth for rendering (默认: 255)\n"
       << "  -o, --output   Filename for output image (默认: output.tga)\n"
+      << "  -c, --compress Sample block compressed textures, cached as "
+         "<texture>.blk\n"
+      << "  --stats[=FILE] Print pipeline stats on stderr, or dump them as json "
+         "into FILE (needs 'make STATS=1')\n"
+      << "  --perf         Report hardware counters for the render, per stage "
+         "too with 'make STATS=1'\n"
+      << "  --trace=FILE   Write a Chrome trace_event timeline into FILE "
+         "(chrome://tracing)\n"
+      << "  --threads N    Worker threads of the job system, main thread "
+         "included (默认: one per cpu)\n"
+      << "  --affinity     Pin every worker thread to its own cpu\n"
+      << "  --parallel P   Split triangles over threads by screen tiles or by "
+         "faces\n"
+      << "                 merged on depth (tiles/sort-last, 默认: tiles)\n"
+      << "  --camera X,Y,Z Camera position (默认: 1,0,3)\n"
+      << "  --target X,Y,Z Point the camera looks at (默认: 0,0,0)\n"
+      << "  --fov DEG      Perspective field of view, 0 for the original "
+         "projection (默认: 0)\n"
+      << "  --turntable N  Render N frames orbiting the camera around the "
+         "target,\n"
+      << "                 saved as <output>_0000.tga... while rendering "
+         "goes on\n"
+      << "  --batch FILE   Render every job of a manifest, one per line like\n"
+      << "                 obj=a.obj mode=shading width=512 output=a.tga,\n"
+      << "                 assets load once, options above are the defaults\n"
+      << "  --serve SOCKET Keep the assets loaded and render the requests of\n"
+      << "                 tinyrenderer_client over a Unix socket\n"
+      << "  --shm NAME     Publish frames into a shared frame region instead "
+         "of files,\n"
+      << "                 /NAME for POSIX shared memory, else a file path "
+         "to map\n"
+      << "  --stream FILE  Append frames to a raw video stream instead of "
+         "files,\n"
+      << "                 '-' for stdout, e.g. '--stream - | ffmpeg -i - "
+         "out.mp4'\n"
+      << "  --stream-format F  y4m/ppm (默认: y4m)\n"
+      << "  --fps N        Frame rate of the y4m stream (默认: 30)\n"
+      << "  --tiled N      Render N x N pixels at a time straight into an "
+         "uncompressed\n"
+      << "                 tga, for posters larger than memory (up to "
+         "65535 x 65535)\n"
+      << "  --region X,Y,W,H  Render only W x H pixels of the image from "
+         "X,Y (bottom-left),\n"
+      << "                 framed as in the full -w x -h render\n"
+      << "  --shard I/N    Render band I of N equal row bands of the image, "
+         "shards of\n"
+      << "                 separate processes join with tinyrenderer_merge\n"
+      << "  --synth SPEC   Render a generated scene instead of a model, SPEC "
+         "like\n"
+      << "                 triangles=1e6,size=4,spread=0.5,overdraw=2,"
+         "texture=1024,seed=1\n"
+      << "  --synth-obj F  Also save the generated scene as .obj into F\n"
       << "  --help         Show help message\n"
       << "Examples:\n"
       << "  tinyrenderer -m triangle obj/african_head.obj\n"
-      << "  tinyrenderer --mode line --width 1024 --height 1024 model.obj\n";
+      << "  tinyrenderer --mode line --width 1024 --height 1024 model.obj\n"
+      << "  tinyrenderer -m shading --synth triangles=2e6,overdraw=4\n"
+      << "  tinyrenderer -m textured --batch jobs.txt\n";
+}
+
+/**
+ * @brief Parse a "x,y,z" vector argument, exits on malformed input
+ *
+ * @param arg argument text
+ * @return Vec3f parsed vector
+ */
+Vec3f parse_vec3(const std::string &arg) {
+  Vec3f v;
+  if (sscanf(arg.c_str(), "%f,%f,%f", &v.x, &v.y, &v.z) != 3) {
+    std::cerr << "Error: Invalid vector " << arg << ", expected x,y,z"
+              << std::endl;
+    exit(1);
+  }
+  return v;
 }
 
 /**
@@ -53,23 +171,11 @@ const RenderOptions parse_args(int argc, char **argv) {
     } else if (arg == "-m" || arg == "--mode") {
       if (i + 1 < argc) {
         std::string mode = argv[++i];
-        if (mode == "wireframe") {
-          options.mode = RenderingMode::WIREFRAME;
-        } else if (mode == "zbuf") {
-          options.mode = RenderingMode::ZBUFGRAY;
-        } else if (mode == "triangle") {
-          options.mode = RenderingMode::TRIANGLE;
-        } else if (mode == "textured") {
-          options.mode = RenderingMode::TRIANGLE;
-          options.shadingmode = ShadingType::DIFFUSE;
-        } else if (mode == "shading") {
-          options.mode = RenderingMode::TRIANGLE;
-          options.shadingmode = ShadingType::DIFFUSE | ShadingType::NORMAL |
-                                ShadingType::SPECULAR;
-        } else {
+        if (!parse_mode(mode, options)) {
           std::cerr << "Error: Invalid rendering mode " << mode << std::endl;
           exit(1);
         }
+        mode_name = mode;
       }
     } else if (arg == "-w" || arg == "--width") {
       if (i + 1 < argc) {
@@ -83,10 +189,104 @@ const RenderOptions parse_args(int argc, char **argv) {
       if (i + 1 < argc) {
         options.depth = std::stoi(argv[++i]);
       }
+    } else if (arg == "-c" || arg == "--compress") {
+      options.compress_textures = true;
     } else if (arg == "-o" || arg == "--output") {
       if (i + 1 < argc) {
         path.output = argv[++i];
       }
+    } else if (arg == "--perf") {
+      print_perf = true;
+    } else if (arg == "--stats") {
+      print_stats = true;
+    } else if (arg.rfind("--stats=", 0) == 0) {
+      path.stats = arg.substr(8);
+    } else if (arg == "--synth") {
+      if (i + 1 < argc) {
+        path.synth = argv[++i];
+      }
+    } else if (arg == "--synth-obj") {
+      if (i + 1 < argc) {
+        path.synth_obj = argv[++i];
+      }
+    } else if (arg == "--threads") {
+      if (i + 1 < argc) {
+        threads = std::stoi(argv[++i]);
+      }
+    } else if (arg == "--parallel") {
+      if (i + 1 < argc) {
+        std::string parallel = argv[++i];
+        if (!parse_parallel(parallel, options)) {
+          std::cerr << "Error: Invalid parallel mode " << parallel
+                    << std::endl;
+          exit(1);
+        }
+      }
+    } else if (arg == "--camera") {
+      if (i + 1 < argc) {
+        camera.position = parse_vec3(argv[++i]);
+      }
+    } else if (arg == "--target") {
+      if (i + 1 < argc) {
+        camera.target = parse_vec3(argv[++i]);
+      }
+    } else if (arg == "--fov") {
+      if (i + 1 < argc) {
+        camera.fov = std::stof(argv[++i]);
+      }
+    } else if (arg == "--turntable") {
+      if (i + 1 < argc) {
+        turntable = std::stoi(argv[++i]);
+      }
+    } else if (arg == "--batch") {
+      if (i + 1 < argc) {
+        path.batch = argv[++i];
+      }
+    } else if (arg == "--serve") {
+      if (i + 1 < argc) {
+        path.socket = argv[++i];
+      }
+    } else if (arg == "--shm") {
+      if (i + 1 < argc) {
+        path.shm = argv[++i];
+      }
+    } else if (arg == "--stream") {
+      if (i + 1 < argc) {
+        path.stream = argv[++i];
+      }
+    } else if (arg == "--stream-format") {
+      if (i + 1 < argc &&
+          !VideoStream::parse_format(argv[++i], stream_format)) {
+        std::cerr << "Error: Invalid stream format " << argv[i] << std::endl;
+        exit(1);
+      }
+    } else if (arg == "--fps") {
+      if (i + 1 < argc) {
+        fps = std::stoi(argv[++i]);
+      }
+    } else if (arg == "--tiled") {
+      if (i + 1 < argc) {
+        tiled = std::stoi(argv[++i]);
+      }
+    } else if (arg == "--region") {
+      if (i + 1 < argc &&
+          sscanf(argv[++i], "%d,%d,%d,%d", &region.x, &region.y, &region.w,
+                 &region.h) != 4) {
+        std::cerr << "Error: Invalid region " << argv[i]
+                  << ", expected x,y,w,h" << std::endl;
+        exit(1);
+      }
+    } else if (arg == "--shard") {
+      if (i + 1 < argc &&
+          sscanf(argv[++i], "%d/%d", &shard_index, &shard_count) != 2) {
+        std::cerr << "Error: Invalid shard " << argv[i] << ", expected i/n"
+                  << std::endl;
+        exit(1);
+      }
+    } else if (arg == "--affinity") {
+      affinity = true;
+    } else if (arg.rfind("--trace=", 0) == 0) {
+      path.trace = arg.substr(8);
     } else if (arg[0] != '-') {
       path.obj = arg;
     }
@@ -94,38 +294,435 @@ const RenderOptions parse_args(int argc, char **argv) {
   return options;
 }
 
+/**
+ * @brief Output filename without its .tga suffix
+ *
+ * @return std::string stem
+ */
+std::string output_stem() {
+  std::string stem = path.output;
+  if (stem.size() > 4 && stem.substr(stem.size() - 4) == ".tga")
+    stem.resize(stem.size() - 4);
+  return stem;
+}
+
+/**
+ * @brief Render a frame in place into the free slot of a shared frame, then
+ * publish it
+ *
+ * @param rst rasterizer with model and textures bound
+ * @param shared shared frame sized for the options
+ * @param options options rst renders with
+ * @return bool false if the frame couldn't be published
+ */
+bool render_shared(Rasterizer &rst, SharedFrame &shared,
+                   const RenderOptions &options) {
+  rst.set_target(
+      shared.target(options.width, options.height, rst.output_format()));
+  rst.render();
+  return shared.publish(rst.get_frame());
+}
+
+/**
+ * @brief Render a full orbit of the camera around its target, about the up
+ * axis, with the loaded assets. Frames go to a background writer so saving
+ * one overlaps rendering the next, as files or one video stream, or are
+ * published in the shared frame.
+ *
+ * @param rst rasterizer with model and textures bound
+ * @param frames frame count of the orbit
+ * @param options options rst renders with
+ * @param shared shared frame to publish into, nullptr to save files
+ * @return int failed frame writes
+ */
+int render_turntable(Rasterizer &rst, int frames, const RenderOptions &options,
+                     SharedFrame *shared) {
+  // the original projection divides by the camera z, which crosses 0 on
+  // the way round
+  if (rst.get_camera().fov <= 0) {
+    const Camera &camera = rst.get_camera();
+    rst.set_perspective(turntable_fov, camera.near, camera.far);
+  }
+  const Camera start = rst.get_camera();
+  Vec3f offset = start.position - start.target;
+  std::string stem = output_stem();
+  FrameWriter writer;
+  if (!shared && !path.stream.empty() &&
+      !writer.open_stream(path.stream, stream_format, fps))
+    return frames;
+  int failures = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    float angle = 2.0f * 3.14159265f * i / frames;
+    float c = std::cos(angle), s = std::sin(angle);
+    Vec3f position(offset.x * c + offset.z * s, offset.y,
+                   offset.z * c - offset.x * s);
+    rst.look_at(start.target + position, start.target, start.up);
+    if (shared) {
+      failures += !render_shared(rst, *shared, options);
+      continue;
+    }
+    rst.render();
+    if (!path.stream.empty()) {
+      writer.submit(rst.get_frame());
+      continue;
+    }
+
+    char index[16];
+    snprintf(index, sizeof(index), "_%04d.tga", i);
+    writer.submit(rst.get_frame(), stem + index);
+  }
+  writer.flush();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+  std::cerr << "# turntable: " << frames << " frames in " << seconds
+            << " s, " << frames / seconds << " fps\n";
+  return failures + writer.failures();
+}
+
+/**
+ * @brief Pick the part of the image to render: the band of --shard, the
+ * --region, or the whole image. Bands only depend on the image height and
+ * the shard count, so processes agree on them without talking.
+ *
+ * @param width height full image size
+ * @return bool false if the part isn't inside the image
+ */
+bool resolve_region(int width, int height) {
+  if (shard_count > 0) {
+    if (shard_index < 0 || shard_index >= shard_count ||
+        shard_count > height) {
+      std::cerr << "Error: Invalid shard " << shard_index << "/"
+                << shard_count << " of " << height << " rows" << std::endl;
+      return false;
+    }
+    int y0 = int(int64_t(height) * shard_index / shard_count);
+    int y1 = int(int64_t(height) * (shard_index + 1) / shard_count);
+    region = Region{0, y0, width, y1 - y0};
+  } else if (region.w == 0) {
+    region = Region{0, 0, width, height};
+  }
+  if (region.x < 0 || region.y < 0 || region.w <= 0 || region.h <= 0 ||
+      region.x + region.w > width || region.y + region.h > height) {
+    std::cerr << "Error: Region " << region.x << "," << region.y << ","
+              << region.w << "," << region.h << " not inside the " << width
+              << "x" << height << " image" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Render the region one window at a time, each written into the
+ * output file as soon as it is done. Buffers are sized for one tile and the
+ * geometry is binned again for each, so memory doesn't grow with the image.
+ *
+ * @param rst rasterizer with model and textures bound, sized for a tile
+ * @param width height full image size
+ * @return bool false if the file couldn't be written
+ */
+bool render_tiled(Rasterizer &rst, int width, int height) {
+  TGATileWriter file;
+  if (!file.open(path.output.c_str(), region.w, region.h,
+                 rst.output_format()))
+    return false;
+  auto begin = std::chrono::steady_clock::now();
+  bool ok = true;
+  int tiles = 0;
+  for (int y = 0; y < region.h && ok; y += tiled) {
+    for (int x = 0; x < region.w && ok; x += tiled) {
+      rst.resize(std::min(tiled, region.w - x),
+                 std::min(tiled, region.h - y));
+      rst.set_window(region.x + x, region.y + y, width, height);
+      rst.render();
+      ok = file.write(rst.get_frame(), x, y);
+      tiles++;
+    }
+  }
+  ok = file.close() && ok;
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cerr << "# tiled: " << region.w << "x" << region.h << " in " << tiles
+            << " tiles of " << tiled << " px, " << seconds << " s, peak rss "
+            << usage.ru_maxrss / 1024 << " MB\n";
+  if (!ok)
+    std::cerr << "Error: Can't write " << path.output << std::endl;
+  return ok;
+}
+
+// what the rasterizers draw, loaded once and bound to each of them
+struct Assets {
+  ModelHandle model;
+  TextureMaps maps;
+};
+
+/**
+ * @brief Bind the model and the texture maps that could be loaded
+ *
+ * @param rst rasterizer to bind them to
+ * @param assets loaded assets
+ */
+void bind_assets(Rasterizer &rst, const Assets &assets) {
+  rst.bind_model(assets.model);
+  rst.bind_maps(assets.maps);
+}
+
+/**
+ * @brief Load the model and the texture maps as concurrent jobs through the
+ * shared caches, so startup takes as long as the slowest asset rather than
+ * all of them. Maps the mode doesn't sample are skipped, a server loads
+ * every map since requests pick their mode.
+ *
+ * @param options render options
+ * @param assets handles of the loaded assets
+ * @return bool false if the model couldn't be loaded
+ */
+bool load_assets(const RenderOptions &options, Assets &assets) {
+  const ShadingType types[3] = {DIFFUSE, NORMAL, SPECULAR};
+  const std::string *maps[3] = {&path.diffuse, &path.normal, &path.specular};
+  unsigned int used = path.socket.empty()
+                          ? used_maps(options)
+                          : DIFFUSE | NORMAL | SPECULAR;
+  auto begin = std::chrono::steady_clock::now();
+  double load_ms[4] = {};
+  auto ms_since = [](std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  };
+
+  JobSystem &pool = JobSystem::instance();
+  JobSystem::JobHandle root = pool.create(nullptr);
+  pool.run(pool.create(
+      [&]() {
+        TR_TRACE("model", "load");
+        auto start = std::chrono::steady_clock::now();
+        assets.model = ModelCache::instance().load(path.obj);
+        load_ms[0] = ms_since(start);
+      },
+      root));
+  for (int i = 0; i < 3; i++) {
+    if (!(used & types[i]))
+      continue;
+    pool.run(pool.create(
+        [&, i]() {
+          TR_TRACE_ARG("texture", "load", i);
+          auto start = std::chrono::steady_clock::now();
+          TextureCache &textures = TextureCache::instance();
+          if (options.compress_textures)
+            assets.maps.blocks[i] = textures.load_blocks(*maps[i]);
+          else
+            assets.maps.textures[i] = textures.load(*maps[i]);
+          load_ms[i + 1] = ms_since(start);
+        },
+        root));
+  }
+  pool.run(root);
+  pool.wait(root);
+
+  std::cerr << "# assets: loaded in " << ms_since(begin)
+            << " ms, loads summing to "
+            << load_ms[0] + load_ms[1] + load_ms[2] + load_ms[3] << " ms\n";
+  return assets.model != nullptr;
+}
+
+/**
+ * @brief Run the jobs of the batch manifest, the command line gives the
+ * values the manifest lines leave out
+ *
+ * @param options render options from the command line
+ * @return int exit code, 1 if a job failed
+ */
+int render_batch(const RenderOptions &options) {
+  batch::Job defaults;
+  defaults.obj = path.obj;
+  defaults.diffuse = path.diffuse;
+  defaults.normal = path.normal;
+  defaults.specular = path.specular;
+  defaults.mode = mode_name;
+  defaults.options = options;
+  defaults.camera = camera;
+  std::vector<batch::Job> jobs;
+  if (!batch::parse(path.batch, defaults, jobs))
+    return 1;
+  return batch::run(jobs, std::cerr) ? 1 : 0;
+}
+
+/**
+ * @brief Write the passed and shaded heatmaps next to the output, the frame
+ * itself already holds the rasterized one, and print the summary
+ *
+ * @param overdraw counters of the last render
+ */
+void save_overdraw(const Overdraw &overdraw) {
+  std::string stem = output_stem();
+  for (Overdraw::Kind kind : {Overdraw::PASSED, Overdraw::SHADED}) {
+    std::string filename = stem + "_" + Overdraw::kind_name(kind) + ".tga";
+    overdraw.heatmap(kind).write_tga_file(filename.c_str());
+  }
+  overdraw.print(std::cerr);
+}
+
+/**
+ * @brief Common tail of every mode: write the trace, print the stats and
+ * save them into --stats=FILE
+ *
+ * @param status exit status of the mode
+ * @return int status, unchanged
+ */
+int finish(int status) {
+  trace::dump();
+  if (print_stats)
+    stats::print(std::cerr);
+  if (!path.stats.empty()) {
+    if (!stats::enabled())
+      std::cerr << "Warning: stats not compiled in, rebuild with 'make "
+                   "STATS=1'\n";
+    stats::write_json(path.stats.c_str());
+  }
+  return status;
+}
+
 int main(int argc, char **argv) {
   // initialize the renderer
   RenderOptions options = parse_args(argc, argv);
-  TGAImage image(options.width, options.height, TGAImage::RGB);
+  if (!path.trace.empty()) {
+    trace::start(path.trace.c_str());
+    trace::set_thread_name("main");
+  }
+  // hardware counters for the whole frame, per stage ones go with the stats.
+  // Opened before the workers start so that the workers count too
+  std::unique_ptr<perf::Counters> counters;
+  if (print_perf) {
+    counters = std::make_unique<perf::Counters>(true);
+    if (!counters->available())
+      std::cerr << "# perf: counters unavailable, " << counters->error()
+                << "\n";
+    else if (stats::enabled())
+      stats::enable_perf();
+  }
+  // workers start after tracing so their timelines get named
+  JobSystem::instance().configure(threads, affinity);
+  if (!path.batch.empty()) {
+    return finish(render_batch(options));
+  }
+  // the frame is the region, out-of-core renders only ever allocate a tile
+  int image_width = options.width, image_height = options.height;
+  if (!resolve_region(image_width, image_height))
+    return 1;
+  bool windowed = region.w != image_width || region.h != image_height;
+  options.width = region.w;
+  options.height = region.h;
+  if (tiled > 0) {
+    if (turntable > 0 || !path.socket.empty() || !path.shm.empty() ||
+        !path.stream.empty()) {
+      std::cerr << "Error: --tiled renders a single frame into a file"
+                << std::endl;
+      return 1;
+    }
+    options.width = std::min(tiled, region.w);
+    options.height = std::min(tiled, region.h);
+  }
   Rasterizer rst(options);
+  rst.set_camera(camera);
+  if (windowed)
+    rst.set_window(region.x, region.y, image_width, image_height);
 
-  // load model from files , owner scope of model will be set to renderer after
-  // passing to constructor of renderer or calling set_model() function
-  Model *model = new Model(path.obj);
-  if (model == nullptr) {
-    std::cerr << "Error: Can't load model from " << path.obj << std::endl;
+  Assets assets;
+  if (!path.synth.empty()) {
+    // procedural scene, textures are bound straight away without the cache
+    synth::SceneParams params;
+    params.width = image_width;
+    if (!synth::parse(path.synth, params))
+      return 1;
+    synth::Scene scene = synth::generate(params);
+    synth::print(std::cerr, scene);
+    if (!path.synth_obj.empty() &&
+        !synth::write_obj(*scene.model, path.synth_obj.c_str()))
+      return 1;
+    assets.model = std::move(scene.model);
+    assets.maps.textures[0] = scene.diffuse;
+    assets.maps.textures[1] = scene.normal;
+    assets.maps.textures[2] = scene.specular;
+  } else if (!load_assets(options, assets)) {
+    // model and texture maps go through the shared caches, rasterizers only
+    // keep handles so every asset lives in memory once
     return 1;
   }
-  rst.bind_model(model);
+  bind_assets(rst, assets);
 
-  // load texture maps from files
-  TGAImage diffusemap, normalmap, specularmap;
-  if (diffusemap.read_tga_file(path.diffuse.c_str()))
-    rst.bind_texture(diffusemap, DIFFUSE);
-  if (normalmap.read_tga_file(path.normal.c_str()))
-    rst.bind_texture(normalmap, NORMAL);
-  if (specularmap.read_tga_file(path.specular.c_str()))
-    rst.bind_texture(specularmap, SPECULAR);
+  if (!path.socket.empty()) {
+    RenderServer server(options, [&assets](Rasterizer &conn_rst) {
+      bind_assets(conn_rst, assets);
+    });
+    if (!server.listen(path.socket))
+      return 1;
+    return finish(server.run());
+  }
+
+  // frames published in shared memory rather than saved
+  std::unique_ptr<SharedFrame> shared;
+  if (!path.shm.empty()) {
+    shared = std::make_unique<SharedFrame>();
+    if (!shared->create(path.shm, options.width, options.height))
+      return 1;
+  }
 
   // create and load shaders(here we just use "hard shader")
 
+  if (counters)
+    counters->start();
+
+  if (tiled > 0) {
+    bool saved = render_tiled(rst, image_width, image_height);
+    if (counters && counters->available())
+      perf::print(std::cerr, "tiled", counters->stop());
+    rst.bind_model(nullptr);
+    return finish(saved ? 0 : 1);
+  }
+
+  if (turntable > 0) {
+    int failures = render_turntable(rst, turntable, options, shared.get());
+    if (counters && counters->available())
+      perf::print(std::cerr, "turntable", counters->stop());
+    rst.bind_model(nullptr);
+    return finish(failures ? 1 : 0);
+  }
+
+  if (shared) {
+    bool published = render_shared(rst, *shared, options);
+    if (counters && counters->available())
+      perf::print(std::cerr, "render", counters->stop());
+    rst.bind_model(nullptr);
+    return finish(published ? 0 : 1);
+  }
+
   // now we really need to start rendering
   rst.render();
+  if (counters && counters->available())
+    perf::print(std::cerr, "render", counters->stop());
 
   // save image and release model, it won't be used anymore
-  rst.save_frame(path.output);
+  if (counters)
+    counters->start();
+  bool saved;
+  if (!path.stream.empty()) {
+    VideoStream stream;
+    saved = stream.open(path.stream, stream_format, fps) &&
+            stream.write(rst.get_frame()) && stream.close();
+  } else {
+    saved = rst.save_frame(path.output);
+  }
+  if (counters && counters->available())
+    perf::print(std::cerr, "save", counters->stop());
+  if (const Overdraw *overdraw = rst.get_overdraw())
+    save_overdraw(*overdraw);
   rst.bind_model(nullptr);
 
-  return 0;
+  // render() already dumped the trace, write it again to include the save
+  return finish(saved ? 0 : 1);
 }
\ No newline at end of file
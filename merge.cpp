@@ -0,0 +1,219 @@
+#include "tgaimage.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Assembles the parts of an image rendered by separate processes (tinyrenderer
+// --shard I/N or --region) into one tga. Parts are tga files or binary ppms
+// (--stream-format ppm), loaded one at a time and written at their place, so
+// memory holds a single part whatever the size of the image.
+
+struct Part {
+  std::string file;
+  int x = -1; // -1 until placed: parts without @X,Y are stacked as bands
+  int y = -1;
+  int width = 0;
+  int height = 0;
+  int bytespp = 0;
+};
+
+struct MergeOptions {
+  std::string output;
+  int width = 0; // 0 for the extent of the parts
+  int height = 0;
+  std::vector<Part> parts;
+};
+
+void print_usage() {
+  std::cout
+      << "Usage: tinyrenderer_merge -o FILE [Options] PART...\n"
+      << "  PART is a tga or ppm file, FILE@X,Y places it with its bottom-left "
+         "pixel at X,Y,\n"
+      << "  parts without a place are the bands of '--shard I/N' in order I = "
+         "0..N-1\n"
+      << "Options:\n"
+      << "  -o, --output   Merged tga, uncompressed\n"
+      << "  -w, --width    Image width (默认: extent of the parts)\n"
+      << "  -h, --height   Image height (默认: extent of the parts)\n"
+      << "  --help         Show help message\n"
+      << "Example:\n"
+      << "  for i in 0 1 2 3; do\n"
+      << "    tinyrenderer -m shading -w 4096 -h 4096 --shard $i/4 -o "
+         "part$i.tga &\n"
+      << "  done; wait\n"
+      << "  tinyrenderer_merge -o full.tga part0.tga part1.tga part2.tga "
+         "part3.tga\n";
+}
+
+bool is_ppm(const std::string &file) {
+  return file.size() > 4 && file.substr(file.size() - 4) == ".ppm";
+}
+
+/**
+ * @brief Read a binary ppm header, leaving the stream on the first pixel
+ *
+ * @return bool false if it isn't a P5/P6 file of 8 bit samples
+ */
+bool read_ppm_header(std::ifstream &in, int &width, int &height, int &bpp) {
+  std::string magic;
+  int maxval = 0;
+  in >> magic;
+  // comments may follow any field
+  auto field = [&in](int &value) {
+    in >> std::ws;
+    while (in.peek() == '#') {
+      std::string comment;
+      std::getline(in, comment);
+      in >> std::ws;
+    }
+    return bool(in >> value);
+  };
+  if ((magic != "P5" && magic != "P6") || !field(width) || !field(height) ||
+      !field(maxval) || maxval != 255 || width <= 0 || height <= 0)
+    return false;
+  in.get(); // the single whitespace before the pixels
+  bpp = magic == "P5" ? TGAImage::GRAYSCALE : TGAImage::RGB;
+  return true;
+}
+
+/**
+ * @brief Size and format of a part, from its header only
+ *
+ * @return bool false if the file isn't a readable tga or ppm
+ */
+bool probe(Part &part) {
+  std::ifstream in(part.file, std::ios::binary);
+  if (!in)
+    return false;
+  if (is_ppm(part.file))
+    return read_ppm_header(in, part.width, part.height, part.bytespp);
+  TGA_Header header;
+  if (!in.read((char *)&header, sizeof(header)))
+    return false;
+  part.width = header.width;
+  part.height = header.height;
+  part.bytespp = header.bitsperpixel >> 3;
+  return part.width > 0 && part.height > 0;
+}
+
+/**
+ * @brief Load the pixels of a part, ppm samples are turned into the bgr
+ * order of tga
+ *
+ * @return bool false if the file can't be read
+ */
+bool load(const Part &part, TGAImage &image) {
+  if (!is_ppm(part.file))
+    return image.read_tga_file(part.file.c_str());
+  std::ifstream in(part.file, std::ios::binary);
+  int width, height, bpp;
+  if (!in || !read_ppm_header(in, width, height, bpp))
+    return false;
+  image = TGAImage(width, height, bpp, TGAImage::TOP_LEFT);
+  size_t bytes = size_t(width) * height * bpp;
+  if (!in.read((char *)image.buffer(), bytes))
+    return false;
+  if (bpp == TGAImage::RGB) {
+    for (unsigned char *p = image.buffer(); p < image.buffer() + bytes; p += 3)
+      std::swap(p[0], p[2]);
+  }
+  return true;
+}
+
+/**
+ * @brief Parse arguments
+ *
+ * @return bool false on invalid arguments
+ */
+bool parse_args(int argc, char **argv, MergeOptions &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--help") {
+      print_usage();
+      exit(0);
+    } else if (arg[0] != '-') {
+      Part part;
+      size_t at = arg.rfind('@');
+      if (at != std::string::npos &&
+          sscanf(arg.c_str() + at + 1, "%d,%d", &part.x, &part.y) == 2) {
+        part.file = arg.substr(0, at);
+      } else {
+        part.file = arg;
+        part.x = part.y = -1;
+      }
+      options.parts.push_back(part);
+    } else if (!has_value) {
+      std::cerr << "Error: missing value for " << arg << std::endl;
+      return false;
+    } else if (arg == "-o" || arg == "--output") {
+      options.output = argv[++i];
+    } else if (arg == "-w" || arg == "--width") {
+      options.width = std::atoi(argv[++i]);
+    } else if (arg == "-h" || arg == "--height") {
+      options.height = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "Error: unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  if (options.output.empty() || options.parts.empty()) {
+    print_usage();
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  MergeOptions options;
+  if (!parse_args(argc, argv, options))
+    return 1;
+
+  // place the bands on top of each other, then size the image
+  int band_y = 0, width = 0, height = 0, bytespp = 0;
+  for (Part &part : options.parts) {
+    if (!probe(part)) {
+      std::cerr << "Error: Can't read " << part.file << std::endl;
+      return 1;
+    }
+    if (part.x < 0 || part.y < 0) {
+      part.x = 0;
+      part.y = band_y;
+      band_y += part.height;
+    }
+    if (bytespp && part.bytespp != bytespp) {
+      std::cerr << "Error: " << part.file << " has " << part.bytespp
+                << " bytes per pixel, not " << bytespp << std::endl;
+      return 1;
+    }
+    bytespp = part.bytespp;
+    width = std::max(width, part.x + part.width);
+    height = std::max(height, part.y + part.height);
+  }
+  width = options.width > 0 ? options.width : width;
+  height = options.height > 0 ? options.height : height;
+
+  TGATileWriter file;
+  if (!file.open(options.output.c_str(), width, height, bytespp))
+    return 1;
+  TGAImage image;
+  for (const Part &part : options.parts) {
+    if (!load(part, image) || !file.write(image, part.x, part.y)) {
+      std::cerr << "Error: Can't place " << part.file << " at " << part.x
+                << "," << part.y << " in " << width << "x" << height
+                << std::endl;
+      return 1;
+    }
+  }
+  if (!file.close())
+    return 1;
+  std::cerr << "# merge: " << options.parts.size() << " parts into "
+            << options.output << ", " << width << "x" << height << "x"
+            << bytespp << std::endl;
+  return 0;
+}
@@ -1,23 +1,40 @@
 #include "model.h"
 #include "gmath.hpp"
+#include "jobs.h"
+#include "trace.h"
+#include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
-Model::Model(std::string filename)
-    : v_(), vt_(), vn_(), f_vi_(), f_vti_(), f_vni_() {
-  std::ifstream in;
-  in.open(filename, std::ifstream::in);
-  if (in.fail())
-    return;
+Model::Model()
+    : v_(), vt_(), vn_(), f_vi_(), f_vti_(), f_vni_(), f_start_(1) {}
+
+namespace {
 
+// .obj lines are parsed in chunks of about this many bytes on the job system
+const size_t parse_chunk = 1 << 20;
+
+// what one chunk of lines holds, indices are still absolute in the file
+struct ObjChunk {
+  std::vector<Vec3f> v;
+  std::vector<Vec2f> vt;
+  std::vector<Vec3f> vn;
+  std::vector<int> f_vi, f_vti, f_vni;
+  std::vector<int> f_size; // vertices of each face
+};
+
+void parse_lines(const char *begin, const char *end, ObjChunk &chunk) {
   std::string line;
-  while (!in.eof()) {
+  while (begin < end) {
     // read line by line
-    std::getline(in, line);
-    std::istringstream iss(line.c_str());
+    const char *eol = std::find(begin, end, '\n');
+    line.assign(begin, eol);
+    begin = eol + 1;
+    std::istringstream iss(line);
     char trash;
 
     // parse this line with string stream
@@ -26,47 +43,81 @@ Model::Model(std::string filename)
       iss >> trash; // skip "v "
       for (int i = 0; i < 3; i++)
         iss >> v.raw[i];
-      v_.push_back(v);
+      chunk.v.push_back(v);
     } else if (!line.compare(0, 4, "vt  ")) {
       Vec3f vt;
       iss >> trash >> trash; // skip "vt  "
       for (int i = 0; i < 3; i++)
         iss >> vt.raw[i];
-      vt_.push_back(vt.toVec2());
+      chunk.vt.push_back(vt.toVec2());
     } else if (!line.compare(0, 4, "vn  ")) {
       Vec3f vn;
       iss >> trash >> trash; // skip "vn  "
       for (int i = 0; i < 3; i++)
         iss >> vn.raw[i];
-      vn_.push_back(vn);
+      chunk.vn.push_back(vn);
     } else if (!line.compare(0, 2, "f ")) {
-      std::vector<int> vert_indices, tex_indices, norm_indices;
-      int vert_idx, tex_idx, norm_idx;
+      int vert_idx, tex_idx, norm_idx, n = 0;
 
       iss >> trash; // skip "f "
       while (iss >> vert_idx >> trash >> tex_idx >> trash >> norm_idx) {
         // read in format of "f xxx/xxx/xxx xxx/xxx/xxx xxx/xxx/xxx"
         // idx start from 1 , but c++ array start from 0
-        vert_idx--;
-        tex_idx--;
-        norm_idx--;
-
-        vert_indices.push_back(vert_idx);
-        tex_indices.push_back(tex_idx);
-        norm_indices.push_back(norm_idx);
+        chunk.f_vi.push_back(vert_idx - 1);
+        chunk.f_vti.push_back(tex_idx - 1);
+        chunk.f_vni.push_back(norm_idx - 1);
+        n++;
       }
-
-      f_vi_.push_back(vert_indices);
-      f_vti_.push_back(tex_indices);
-      f_vni_.push_back(norm_indices);
+      chunk.f_size.push_back(n);
     }
   }
+}
+
+} // namespace
+
+Model::Model(std::string filename)
+    : v_(), vt_(), vn_(), f_vi_(), f_vti_(), f_vni_(), f_start_(1) {
+  std::ifstream in;
+  in.open(filename, std::ifstream::in | std::ifstream::binary);
+  if (in.fail())
+    return;
+  std::string text((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+
+  // cut the file at line ends, chunks are parsed in parallel and appended in
+  // file order so the model is the same as a serial parse
+  std::vector<const char *> cuts{text.data()};
+  const char *text_end = text.data() + text.size();
+  while (size_t(text_end - cuts.back()) > parse_chunk) {
+    const char *eol = std::find(cuts.back() + parse_chunk, text_end, '\n');
+    cuts.push_back(std::min(eol + 1, text_end));
+  }
+  cuts.push_back(text_end);
+
+  std::vector<ObjChunk> chunks(cuts.size() - 1);
+  JobSystem::instance().parallel_for(0, (int)chunks.size(), 1,
+                                     [&](int i, int) {
+                                       TR_TRACE_ARG("parse", "load", i);
+                                       parse_lines(cuts[i], cuts[i + 1],
+                                                   chunks[i]);
+                                     });
+
+  for (ObjChunk &chunk : chunks) {
+    v_.insert(v_.end(), chunk.v.begin(), chunk.v.end());
+    vt_.insert(vt_.end(), chunk.vt.begin(), chunk.vt.end());
+    vn_.insert(vn_.end(), chunk.vn.begin(), chunk.vn.end());
+    f_vi_.insert(f_vi_.end(), chunk.f_vi.begin(), chunk.f_vi.end());
+    f_vti_.insert(f_vti_.end(), chunk.f_vti.begin(), chunk.f_vti.end());
+    f_vni_.insert(f_vni_.end(), chunk.f_vni.begin(), chunk.f_vni.end());
+    for (int n : chunk.f_size)
+      f_start_.push_back(f_start_.back() + n);
+  }
   std::cerr << "# verts sum as: " << v_.size() << "\n"
             << "# texture verts sum as: " << vt_.size() << "\n"
             << "# normal verts sum as: " << vn_.size() << "\n"
-            << "# verts indices (faces) sum as: " << f_vi_.size() << "\n"
-            << "# texture verts indices sum as: " << f_vti_.size() << "\n"
-            << "# normal verts indices sum as: " << f_vni_.size() << "\n";
+            << "# verts indices (faces) sum as: " << f_num() << "\n"
+            << "# texture verts indices sum as: " << f_vti_num() << "\n"
+            << "# normal verts indices sum as: " << f_vni_num() << "\n";
 }
 Model::~Model() {
   v_.clear();
@@ -76,6 +127,7 @@ Model::~Model() {
   f_vi_.clear();
   f_vti_.clear();
   f_vni_.clear();
+  f_start_.clear();
 #ifdef DEBUG
   std::cerr << "Model destroyed" << std::endl;
 #endif
@@ -85,10 +137,11 @@ int Model::v_num() const { return (int)v_.size(); }
 int Model::vt_num() const { return (int)vt_.size(); }
 int Model::vn_num() const { return (int)vn_.size(); }
 
-int Model::f_num() const { return (int)f_vi_.size(); }
-int Model::f_vi_num() const { return (int)f_vi_.size(); }
-int Model::f_vti_num() const { return (int)f_vti_.size(); }
-int Model::f_vni_num() const { return (int)f_vni_.size(); }
+// every face gets all three index lists, so they all count the faces
+int Model::f_num() const { return (int)f_start_.size() - 1; }
+int Model::f_vi_num() const { return f_num(); }
+int Model::f_vti_num() const { return f_num(); }
+int Model::f_vni_num() const { return f_num(); }
 
 Vec3f Model::getv(int ind) const { return v_[ind]; }
 Vec2f Model::getvt(int ind) const { return vt_[ind]; }
@@ -96,25 +149,78 @@ Vec3f Model::getvn(int ind) const { return vn_[ind]; }
 
 std::vector<std::vector<int>> Model::getf(int ind) const {
   std::vector<std::vector<int>> f;
-  std::vector<int> v_indices = f_vi_[ind];
-  std::vector<int> vt_indices = f_vti_[ind];
-  std::vector<int> vn_indices = f_vni_[ind];
+  int start = f_start_[ind];
   for (int i = 0; i < 3; i++)
-    f.push_back(std::vector<int>{v_indices[i], vt_indices[i], vn_indices[i]});
+    f.push_back(std::vector<int>{f_vi_[start + i], f_vti_[start + i],
+                                 f_vni_[start + i]});
   return f;
 }
 
-std::vector<int> Model::getf_vi(int ind) const { return f_vi_[ind]; }
-std::vector<int> Model::getf_vti(int ind) const { return f_vti_[ind]; }
-std::vector<int> Model::getf_vni(int ind) const { return f_vni_[ind]; }
+std::vector<int> Model::getf_vi(int ind) const {
+  return std::vector<int>(f_vi_.begin() + f_start_[ind],
+                          f_vi_.begin() + f_start_[ind + 1]);
+}
+std::vector<int> Model::getf_vti(int ind) const {
+  return std::vector<int>(f_vti_.begin() + f_start_[ind],
+                          f_vti_.begin() + f_start_[ind + 1]);
+}
+std::vector<int> Model::getf_vni(int ind) const {
+  return std::vector<int>(f_vni_.begin() + f_start_[ind],
+                          f_vni_.begin() + f_start_[ind + 1]);
+}
+
+int Model::getf_vi(int iface, int nth_vert) const {
+  return f_vi_[f_start_[iface] + nth_vert];
+}
+int Model::getf_vti(int iface, int nth_vert) const {
+  return f_vti_[f_start_[iface] + nth_vert];
+}
+int Model::getf_vni(int iface, int nth_vert) const {
+  return f_vni_[f_start_[iface] + nth_vert];
+}
 
 Vec3f Model::getv(int iface, int nth_vert) const {
-  return v_[f_vi_[iface][nth_vert]];
+  return v_[f_vi_[f_start_[iface] + nth_vert]];
 }
 Vec2f Model::getvt(int iface, int nth_vert) const {
-  return vt_[f_vti_[iface][nth_vert]];
+  return vt_[f_vti_[f_start_[iface] + nth_vert]];
 }
 Vec3f Model::getvn(int iface, int nth_vert) const {
-  Vec3f vn_cpy = vn_[f_vni_[iface][nth_vert]];
+  Vec3f vn_cpy = vn_[f_vni_[f_start_[iface] + nth_vert]];
   return vn_cpy.normalize();
 }
+
+void Model::reserve(int verts, int faces) {
+  v_.reserve(verts);
+  vt_.reserve(verts);
+  f_vi_.reserve(size_t(faces) * 3);
+  f_vti_.reserve(size_t(faces) * 3);
+  f_vni_.reserve(size_t(faces) * 3);
+  f_start_.reserve(size_t(faces) + 1);
+}
+
+int Model::add_vertex(Vec3f v) {
+  v_.push_back(v);
+  return (int)v_.size() - 1;
+}
+int Model::add_uv(Vec2f vt) {
+  vt_.push_back(vt);
+  return (int)vt_.size() - 1;
+}
+int Model::add_normal(Vec3f vn) {
+  vn_.push_back(vn);
+  return (int)vn_.size() - 1;
+}
+
+/**
+ * @brief Append a face, indices are 0 based like the getters return them
+ *
+ * @param vi vti vni vertex, texture vertex and normal indices, n of each
+ * @param n vertices of the face
+ */
+void Model::add_face(const int *vi, const int *vti, const int *vni, int n) {
+  f_vi_.insert(f_vi_.end(), vi, vi + n);
+  f_vti_.insert(f_vti_.end(), vti, vti + n);
+  f_vni_.insert(f_vni_.end(), vni, vni + n);
+  f_start_.push_back((int)f_vi_.size());
+}
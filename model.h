@@ -16,16 +16,26 @@ private:
   std::vector<Vec2f> vt_; // texture vertex
   std::vector<Vec3f> vn_; // normal vertex
 
-  // face properties
-  std::vector<std::vector<int>> f_vi_;  // vertex indices
-  std::vector<std::vector<int>> f_vti_; // texture vertex indices
-  std::vector<std::vector<int>> f_vni_; // normal vertex indices
+  // face properties, indices of all faces back to back, face i owning
+  // [f_start_[i], f_start_[i + 1]) so big meshes don't pay a vector per face
+  std::vector<int> f_vi_;  // vertex indices
+  std::vector<int> f_vti_; // texture vertex indices
+  std::vector<int> f_vni_; // normal vertex indices
+  std::vector<int> f_start_;
 
 public:
   // constructors
+  Model();
   explicit Model(std::string filename);
   ~Model();
 
+  // building meshes in memory, see synth.h
+  void reserve(int verts, int faces);
+  int add_vertex(Vec3f v);
+  int add_uv(Vec2f vt);
+  int add_normal(Vec3f vn);
+  void add_face(const int *vi, const int *vti, const int *vni, int n);
+
   // get sizes
   int v_num() const;
   int vt_num() const;
@@ -47,6 +57,11 @@ public:
   std::vector<int> getf_vti(int ind) const;
   std::vector<int> getf_vni(int ind) const;
 
+  // indices of the nth vertex of a face into the arrays above
+  int getf_vi(int iface, int nth_vert) const;
+  int getf_vti(int iface, int nth_vert) const;
+  int getf_vni(int iface, int nth_vert) const;
+
   Vec3f getv(int iface, int nth_vert) const;
   Vec2f getvt(int iface, int nth_vert) const;
   Vec3f getvn(int iface, int nth_vert) const;
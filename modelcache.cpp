@@ -0,0 +1,75 @@
+#include "modelcache.h"
+#include "model.h"
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief Get the cache shared by the whole process
+ *
+ * @return ModelCache& the cache
+ */
+ModelCache &ModelCache::instance() noexcept {
+  static ModelCache cache;
+  return cache;
+}
+
+/**
+ * @brief Get the model stored at path, parsing it on first use
+ *
+ * @param path obj file path, used as the cache key
+ * @return ModelHandle shared model, nullptr if it can't be loaded
+ */
+ModelHandle ModelCache::load(const std::string &path) {
+  if (ModelHandle cached = find(path))
+    return cached;
+
+  // parse outside of the lock so that different assets load concurrently
+  std::shared_ptr<Model> model = std::make_shared<Model>(path);
+  if (model->v_num() == 0) {
+    std::cerr << "Error: Can't load model from " << path << std::endl;
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // somebody may have loaded the same file meanwhile, keep the first one
+  auto res = entries_.emplace(path, std::move(model));
+  return res.first->second;
+}
+
+/**
+ * @brief Look up a model without loading it
+ *
+ * @param path obj file path
+ * @return ModelHandle shared model, nullptr if not cached
+ */
+ModelHandle ModelCache::find(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(path);
+  return it == entries_.end() ? nullptr : it->second;
+}
+
+size_t ModelCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+/**
+ * @brief Drop the models nobody but the cache holds anymore
+ *
+ * @return size_t number of evicted models
+ */
+size_t ModelCache::evict_unused() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t evicted = 0;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.use_count() == 1) {
+      it = entries_.erase(it);
+      evicted++;
+    } else {
+      ++it;
+    }
+  }
+  return evicted;
+}
@@ -0,0 +1,37 @@
+#ifndef __MODELCACHE_H__
+#define __MODELCACHE_H__
+
+#include "model.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// shared, immutable model, alive as long as somebody holds a handle
+typedef std::shared_ptr<const Model> ModelHandle;
+
+// Process wide model cache keyed by file path, the model counterpart of
+// TextureCache: every .obj is parsed once and the same copy is bound to all
+// the rasterizers drawing it.
+class ModelCache {
+private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, ModelHandle> entries_;
+
+  ModelCache() = default;
+
+public:
+  ModelCache(const ModelCache &) = delete;
+  ModelCache &operator=(const ModelCache &) = delete;
+
+  static ModelCache &instance() noexcept;
+
+  ModelHandle load(const std::string &path);
+  ModelHandle find(const std::string &path);
+
+  size_t size();
+  size_t evict_unused();
+};
+
+#endif // __MODELCACHE_H__
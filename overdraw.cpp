@@ -0,0 +1,131 @@
+#include "overdraw.h"
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+
+const char *kind_names[Overdraw::KIND_NUM] = {"rasterized", "passed",
+                                              "shaded"};
+
+// heatmap palette, one stop per fragment count, saturating at the last one
+const unsigned char palette[][3] = {
+    {0, 0, 0},       // 0, background
+    {0, 0, 160},     // 1, no overdraw
+    {0, 120, 255},   // 2
+    {0, 200, 120},   // 3
+    {120, 230, 0},   // 4
+    {255, 230, 0},   // 5
+    {255, 140, 0},   // 6
+    {230, 30, 0},    // 7
+    {255, 255, 255}, // 8 and more
+};
+const int palette_num = sizeof(palette) / sizeof(palette[0]);
+
+} // namespace
+
+Overdraw::Overdraw(int width, int height) noexcept
+    : width_(width), height_(height) {
+  for (int k = 0; k < KIND_NUM; k++)
+    counts_[k].assign(size_t(width) * height, 0);
+}
+
+void Overdraw::clear() noexcept {
+  for (int k = 0; k < KIND_NUM; k++)
+    std::fill(counts_[k].begin(), counts_[k].end(), 0);
+}
+
+/**
+ * @brief Fixed palette colour of a fragment count, so heatmaps of different
+ * assets compare directly
+ *
+ * @param count fragments on the pixel
+ * @return TGAColor rgb colour
+ */
+TGAColor Overdraw::false_color(uint32_t count) noexcept {
+  const unsigned char *c = palette[std::min<uint32_t>(count, palette_num - 1)];
+  return TGAColor(c[0], c[1], c[2], 255);
+}
+
+const char *Overdraw::kind_name(Kind kind) noexcept {
+  return kind_names[kind];
+}
+
+/**
+ * @brief Render one of the counters as a false colour image
+ *
+ * @param kind counter to show
+ * @return TGAImage rgb image, bottom-left origin like the frame
+ */
+TGAImage Overdraw::heatmap(Kind kind) const noexcept {
+  TGAImage image(width_, height_, TGAImage::RGB, TGAImage::BOTTOM_LEFT);
+  heatmap(kind, image);
+  return image;
+}
+
+/**
+ * @brief Render one of the counters into an existing image of the same size,
+ * so frame loops reuse it
+ *
+ * @param kind counter to show
+ * @param image rgb or rgba image to overwrite
+ */
+void Overdraw::heatmap(Kind kind, TGAImage &image) const noexcept {
+  const uint32_t *counts = counts_[kind].data();
+  for (int y = 0; y < height_; y++)
+    for (int x = 0; x < width_; x++)
+      image.set_pixel(x, y, false_color(counts[x + y * width_]));
+}
+
+Overdraw::Summary Overdraw::summary() const noexcept {
+  Summary sum;
+  sum.width = width_;
+  sum.height = height_;
+  size_t size = size_t(width_) * height_;
+  for (int k = 0; k < KIND_NUM; k++) {
+    for (size_t i = 0; i < size; i++) {
+      uint32_t n = counts_[k][i];
+      sum.total[k] += n;
+      sum.max[k] = std::max(sum.max[k], n);
+      if (k == RASTERIZED && n) {
+        sum.covered++;
+        sum.histogram[std::min<uint32_t>(n, bucket_num) - 1]++;
+      }
+    }
+  }
+  return sum;
+}
+
+/**
+ * @brief Print the summary as a small table, averages are per covered pixel
+ *
+ * @param out stream to write
+ */
+void Overdraw::print(std::ostream &out) const noexcept {
+  Summary sum = summary();
+  double covered = sum.covered ? double(sum.covered) : 1.0;
+  out << "# overdraw: " << sum.covered << " of "
+      << uint64_t(sum.width) * sum.height << " pixels covered\n";
+  out << std::fixed << std::setprecision(2);
+  out << "# counter            fragments   per pixel     max\n";
+  for (int k = 0; k < KIND_NUM; k++) {
+    out << "  " << std::left << std::setw(14) << kind_names[k] << std::right
+        << std::setw(15) << sum.total[k] << std::setw(12)
+        << sum.total[k] / covered << std::setw(8) << sum.max[k] << "\n";
+  }
+  uint64_t rasterized = sum.total[RASTERIZED];
+  if (rasterized) {
+    out << "# occluded fragments: "
+        << 100.0 * (rasterized - sum.total[PASSED]) / rasterized << "%\n";
+    if (sum.total[SHADED] > sum.total[PASSED])
+      out << "# shaded fragments failing depth: "
+          << 100.0 * (sum.total[SHADED] - sum.total[PASSED]) /
+                 sum.total[SHADED]
+          << "%\n";
+  }
+  out << "# depth complexity:";
+  for (int b = 0; b < bucket_num; b++)
+    out << " " << b + 1 << (b + 1 == bucket_num ? "+" : "") << ":"
+        << 100.0 * sum.histogram[b] / covered << "%";
+  out << "\n";
+  out.unsetf(std::ios::fixed);
+}
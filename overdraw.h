@@ -0,0 +1,63 @@
+#ifndef __OVERDRAW_H__
+#define __OVERDRAW_H__
+
+#include "tgaimage.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Per pixel fragment counters for the overdraw render mode: fragments
+// rasterized (depth complexity), fragments passing the depth test and
+// fragments shaded. A pixel belongs to exactly one tile and every tile is
+// drawn by a single thread, so the counters are plain increments.
+class Overdraw {
+public:
+  enum Kind {
+    RASTERIZED,
+    PASSED,
+    SHADED,
+    KIND_NUM,
+  };
+
+  // counts above the last bucket all land in it
+  static const int bucket_num = 9;
+
+  struct Summary {
+    int width = 0;
+    int height = 0;
+    uint64_t covered = 0; // pixels with at least one fragment
+    uint64_t total[KIND_NUM] = {};
+    uint32_t max[KIND_NUM] = {};
+    uint64_t histogram[bucket_num] = {}; // covered pixels by depth complexity
+  };
+
+private:
+  int width_;
+  int height_;
+  std::vector<uint32_t> counts_[KIND_NUM];
+
+public:
+  Overdraw(int width, int height) noexcept;
+
+  void clear() noexcept;
+
+  inline void count(Kind kind, size_t index) noexcept {
+    counts_[kind][index]++;
+  }
+  uint32_t get(Kind kind, int x, int y) const noexcept {
+    return counts_[kind][x + y * width_];
+  }
+  int get_width() const noexcept { return width_; }
+  int get_height() const noexcept { return height_; }
+
+  TGAImage heatmap(Kind kind) const noexcept;
+  void heatmap(Kind kind, TGAImage &image) const noexcept;
+  Summary summary() const noexcept;
+  void print(std::ostream &out) const noexcept;
+
+  static const char *kind_name(Kind kind) noexcept;
+  static TGAColor false_color(uint32_t count) noexcept;
+};
+
+#endif // __OVERDRAW_H__
@@ -0,0 +1,223 @@
+#include "perf.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <linux/perf_event.h>
+#include <ostream>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace perf {
+
+namespace {
+
+struct EventDesc {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+const EventDesc events[EVENT_NUM] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d_misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int open_event(const EventDesc &desc, bool inherit) noexcept {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = desc.type;
+  attr.config = desc.config;
+  attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+  attr.exclude_hv = 1;
+  // threads created afterwards add to the count, read() returns the total
+  attr.inherit = inherit;
+  // this thread, on any cpu
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Read a counter in user space through its mmap page, following the
+ * seqlock protocol documented in perf_event_open(2)
+ *
+ * @return false if the kernel doesn't allow rdpmc for this counter
+ */
+bool read_rdpmc(void *page, uint64_t &value) noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  volatile perf_event_mmap_page *pc = (volatile perf_event_mmap_page *)page;
+  uint32_t seq, idx;
+  uint64_t count;
+  do {
+    seq = pc->lock;
+    __asm__ __volatile__("" ::: "memory");
+    idx = pc->index;
+    count = pc->offset;
+    if (!pc->cap_user_rdpmc || idx == 0)
+      return false;
+    uint16_t width = pc->pmc_width;
+    uint64_t pmc = __rdpmc(idx - 1);
+    pmc <<= 64 - width;
+    count += (int64_t)pmc >> (64 - width);
+    __asm__ __volatile__("" ::: "memory");
+  } while (pc->lock != seq);
+  value = count;
+  return true;
+#else
+  (void)page;
+  (void)value;
+  return false;
+#endif
+}
+
+} // namespace
+
+/**
+ * @brief Open the counters for the calling thread, they start counting
+ * immediately. Events the machine doesn't support are left out.
+ *
+ * @param inherit also count the threads this thread creates from now on,
+ * threads that already run are never counted
+ */
+Counters::Counters(bool inherit) noexcept : inherit_(inherit) {
+  long pagesize = sysconf(_SC_PAGESIZE);
+  for (int i = 0; i < EVENT_NUM; i++) {
+    pages_[i] = nullptr;
+    fds_[i] = open_event(events[i], inherit);
+    if (fds_[i] < 0) {
+      if (!error_)
+        error_ = errno;
+      continue;
+    }
+    // rdpmc only sees the calling thread, inherited totals need read()
+    if (inherit)
+      continue;
+    void *page = mmap(nullptr, pagesize, PROT_READ, MAP_SHARED, fds_[i], 0);
+    if (page != MAP_FAILED)
+      pages_[i] = page;
+  }
+}
+
+Counters::~Counters() noexcept {
+  long pagesize = sysconf(_SC_PAGESIZE);
+  for (int i = 0; i < EVENT_NUM; i++) {
+    if (pages_[i])
+      munmap(pages_[i], pagesize);
+    if (fds_[i] >= 0)
+      close(fds_[i]);
+  }
+}
+
+bool Counters::available() const noexcept {
+  for (int i = 0; i < EVENT_NUM; i++)
+    if (fds_[i] >= 0)
+      return true;
+  return false;
+}
+
+/**
+ * @brief Explain why some counters are missing
+ *
+ * @return std::string reason, empty if every counter is there
+ */
+std::string Counters::error() const {
+  if (!error_)
+    return "";
+  std::string reason = strerror(error_);
+  if (error_ == EACCES || error_ == EPERM)
+    reason += " (check /proc/sys/kernel/perf_event_paranoid)";
+  else if (error_ == ENOENT || error_ == EOPNOTSUPP)
+    reason += " (no hardware counters, e.g. inside a VM or container)";
+  return reason;
+}
+
+/**
+ * @brief Read current raw counts, missing events read as 0
+ *
+ * @param values EVENT_NUM slots
+ */
+void Counters::read(uint64_t *values) const noexcept {
+  for (int i = 0; i < EVENT_NUM; i++) {
+    values[i] = 0;
+    if (fds_[i] < 0)
+      continue;
+    if (pages_[i] && read_rdpmc(pages_[i], values[i]))
+      continue;
+    if (::read(fds_[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+      values[i] = 0;
+  }
+}
+
+void Counters::start() noexcept { read(start_.values); }
+
+Sample Counters::stop() const noexcept {
+  Sample res;
+  read(res.values);
+  res.all_threads = inherit_;
+  for (int i = 0; i < EVENT_NUM; i++) {
+    res.valid[i] = fds_[i] >= 0;
+    res.values[i] -= start_.values[i];
+  }
+  return res;
+}
+
+const char *event_name(Event event) noexcept {
+  return event < EVENT_NUM ? events[event].name : "none";
+}
+
+/**
+ * @brief Print a one line summary of a sample
+ *
+ * @param out stream to print on
+ * @param label what was measured
+ * @param sample counter deltas
+ */
+void print(std::ostream &out, const char *label, const Sample &sample) {
+  out << "# perf " << label
+      << (sample.all_threads ? " (all threads):" : " (calling thread):");
+  for (int i = 0; i < EVENT_NUM; i++) {
+    out << " " << events[i].name << "=";
+    if (sample.valid[i])
+      out << sample.values[i];
+    else
+      out << "n/a";
+  }
+  if (sample.valid[CYCLES] && sample.valid[INSTRUCTIONS] &&
+      sample.values[CYCLES])
+    out << " ipc=" << std::fixed << std::setprecision(2)
+        << (double)sample.values[INSTRUCTIONS] / sample.values[CYCLES];
+  out << "\n";
+  out.unsetf(std::ios::floatfield);
+}
+
+/**
+ * @brief Print a sample as a json object, unavailable events are null
+ *
+ * @param out stream to print on
+ * @param sample counter deltas
+ */
+void print_json(std::ostream &out, const Sample &sample) {
+  out << "{";
+  for (int i = 0; i < EVENT_NUM; i++) {
+    out << (i ? ", " : "") << "\"" << events[i].name << "\": ";
+    if (sample.valid[i])
+      out << sample.values[i];
+    else
+      out << "null";
+  }
+  out << "}";
+}
+
+} // namespace perf
@@ -0,0 +1,64 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Hardware performance counters of the calling thread through Linux
+// perf_event_open(), optionally inherited by the threads it starts later.
+// Counters are read in user space with rdpmc when the kernel allows it, with
+// read() as the fallback. When counters can't be
+// opened (no PMU, perf_event_paranoid, containers...) everything still works
+// and reports the events as unavailable.
+
+namespace perf {
+
+enum Event {
+  CYCLES,
+  INSTRUCTIONS,
+  L1D_MISSES,
+  LLC_MISSES,
+  BRANCH_MISSES,
+  EVENT_NUM,
+};
+
+struct Sample {
+  uint64_t values[EVENT_NUM] = {};
+  bool valid[EVENT_NUM] = {};
+  bool all_threads = false; // summed over threads, not the calling one only
+};
+
+class Counters {
+private:
+  int fds_[EVENT_NUM];
+  void *pages_[EVENT_NUM]; // perf_event_mmap_page for rdpmc reads
+  int error_ = 0;          // errno of the first failed open
+  bool inherit_;
+  Sample start_;
+
+public:
+  explicit Counters(bool inherit = false) noexcept;
+  ~Counters() noexcept;
+  Counters(const Counters &) = delete;
+  Counters &operator=(const Counters &) = delete;
+
+  bool available() const noexcept;
+  bool has(Event event) const noexcept { return fds_[event] >= 0; }
+  bool inherited() const noexcept { return inherit_; }
+  std::string error() const;
+
+  void read(uint64_t *values) const noexcept;
+
+  // measure a region: start() then stop() returns the deltas
+  void start() noexcept;
+  Sample stop() const noexcept;
+};
+
+const char *event_name(Event event) noexcept;
+void print(std::ostream &out, const char *label, const Sample &sample);
+void print_json(std::ostream &out, const Sample &sample);
+
+} // namespace perf
+
+#endif // __PERF_H__
@@ -2,9 +2,21 @@
 #define __PRIMITIVE_H__
 
 #include "gmath.hpp"
+#include "overdraw.h"
+#include "stats.h"
+#include "texture.h"
 #include "tgaimage.h"
 #include <algorithm>
 #include <cmath>
+#include <limits>
+
+// pixel rectangle [x0, x1) x [y0, y1)
+struct Rect {
+  int x0 = std::numeric_limits<int>::min();
+  int y0 = std::numeric_limits<int>::min();
+  int x1 = std::numeric_limits<int>::max();
+  int y1 = std::numeric_limits<int>::max();
+};
 
 class Primitive {
 public:
@@ -77,6 +89,16 @@ private:
   Vec3f light_dir = Vec3f(0, 0, 1);
   unsigned int shading_mode_;
 
+  // fragment counters of the overdraw mode, null when not counting
+  Overdraw *overdraw_ = nullptr;
+
+  // only pixels inside are drawn, the tile owned by the drawing thread
+  Rect clip_;
+
+  // pixel of the full image the frame starts at when it is a window of it,
+  // vertices stay in full image coordinates until rounded
+  Vec2i origin_ = Vec2i(0, 0);
+
 public:
   explicit Triangle(unsigned int mode) noexcept : shading_mode_(mode) {}
 
@@ -97,6 +119,9 @@ public:
       normals_[i] = normals[i];
   }
   void set_shading_mode(unsigned int mode) { shading_mode_ = mode; }
+  void set_overdraw(Overdraw *overdraw) { overdraw_ = overdraw; }
+  void set_clip(const Rect &clip) { clip_ = clip; }
+  void set_origin(Vec2i origin) { origin_ = origin; }
 
   /**
    * @brief Find 2d coord's barycentric.
@@ -125,6 +150,50 @@ public:
                    uv.x / uv.z); // return normalized uv result.
   }
 
+  /**
+   * @brief Integer bounding box of screen space vertices, not clipped yet.
+   * Vertices are rounded in full image coordinates then moved to the frame,
+   * so a window of the image gets the same pixels as the whole image.
+   *
+   * @param rverts screen space vertices
+   * @param pts filled with the vertices rounded like draw() does
+   * @param origin pixel of the full image the frame starts at
+   * @return Rect bounding box, the max edges are excluded as in draw()
+   */
+  static Rect bounds(const Vec3f *rverts, Vec2i *pts,
+                     Vec2i origin = Vec2i(0, 0)) noexcept {
+    Rect box;
+    box.x0 = box.y0 = std::numeric_limits<int>::max();
+    box.x1 = box.y1 = std::numeric_limits<int>::min();
+    for (int i = 0; i < 3; i++) {
+      pts[i] = Vec2i(rverts[i]);
+      pts[i].x -= origin.x;
+      pts[i].y -= origin.y;
+      box.x0 = std::min(box.x0, pts[i].x);
+      box.x1 = std::max(box.x1, pts[i].x);
+      box.y0 = std::min(box.y0, pts[i].y);
+      box.y1 = std::max(box.y1, pts[i].y);
+    }
+    return box;
+  }
+
+  /**
+   * @brief Check whether the triangle can't produce any fragment: empty
+   * bounding box, or degenerate so that calc_barycentric() rejects every pixel
+   *
+   * @param pts triangle set
+   * @param xmin xmax ymin ymax bounding box
+   * @return true if nothing would be drawn
+   */
+  static bool is_culled(const Vec2i *pts, int xmin, int xmax, int ymin,
+                        int ymax) noexcept {
+    if (xmin >= xmax || ymin >= ymax)
+      return true;
+    float area = float(pts[2].x - pts[0].x) * float(pts[1].y - pts[0].y) -
+                 float(pts[1].x - pts[0].x) * float(pts[2].y - pts[0].y);
+    return std::abs(area) < 1;
+  }
+
   /**
    * @brief Triangle drawing function from
    * trianglebench_main.cpp:draw_triangle4()
@@ -133,23 +202,18 @@ public:
    * @param zbuf zbuf for depth testing
    */
   void draw(TGAImage &image, float *zbuf) noexcept override {
-    int xmax = -1, ymax = -1;
-    int xmin = 8000,
-        ymin = 8000; // i dont think somebody would use 8k screen...
     Vec2i rverts_int[3];
-
-    for (int i = 0; i < 3; i++) {
-      Vec2i cur = Vec2i(rverts_[i]);
-      rverts_int[i] = cur;
-
-      if (cur.x < xmin)
-        xmin = cur.x;
-      if (cur.x > xmax)
-        xmax = cur.x;
-      if (cur.y < ymin)
-        ymin = cur.y;
-      if (cur.y > ymax)
-        ymax = cur.y;
+    Rect box = bounds(rverts_, rverts_int, origin_);
+    int xmin = box.x0, xmax = box.x1, ymin = box.y0, ymax = box.y1;
+    // clip the box to the frame, the depth buffer has no guard band, and to
+    // the tile being drawn
+    xmin = std::max({xmin, 0, clip_.x0});
+    ymin = std::max({ymin, 0, clip_.y0});
+    xmax = std::min({xmax, image.get_width(), clip_.x1});
+    ymax = std::min({ymax, image.get_height(), clip_.y1});
+    if (is_culled(rverts_int, xmin, xmax, ymin, ymax)) {
+      TR_COUNT(TRIANGLES_CULLED, 1);
+      return;
     }
 
     Vec3f pixelPos, bc;
@@ -165,12 +229,19 @@ public:
         // although it's inside bounding box
         if (bc.x < 0 || bc.y < 0 || bc.z < 0)
           continue;
+        size_t index = i + size_t(j) * image.get_width();
+        if (overdraw_)
+          overdraw_->count(Overdraw::RASTERIZED, index);
         // depth buffer testing here.
+        TR_STAGE(DEPTH);
+        TR_COUNT(FRAGMENTS_TESTED, 1);
         pixelPos.z =
             rverts_[0].z * bc.x + rverts_[1].z * bc.y + rverts_[2].z * bc.z;
-        if (zbuf[int(pixelPos.x + pixelPos.y * image.get_width())] <
-            pixelPos.z) {
-          zbuf[int(pixelPos.x + pixelPos.y * image.get_width())] = pixelPos.z;
+        if (zbuf[index] < pixelPos.z) {
+          TR_COUNT(FRAGMENTS_PASSED, 1);
+          if (overdraw_)
+            overdraw_->count(Overdraw::PASSED, index);
+          zbuf[index] = pixelPos.z;
           // if only we update buffer , the "frame buffer" would be
           // update (actually we consider the image reference as our frame
           // buffer XD )
@@ -187,26 +258,21 @@ public:
    * @param zbuf zbuffer reference for depth testing
    * @param intensity light intensity, so simple :-(
    */
-  void draw(TGAImage &image, float *zbuf, TGAImage &diffusemap,
-            TGAImage &normalmap, TGAImage &specmap) noexcept {
-    int xmax = -1, ymax = -1;
-    int xmin = 8000,
-        ymin = 8000; // i dont think somebody would use 8k screen...
+  void draw(TGAImage &image, float *zbuf, const Texture &diffusemap,
+            const Texture &normalmap, const Texture &specmap) noexcept {
     Vec2i vertices_2i[3];
     TGAColor color = white;
-
-    for (int i = 0; i < 3; i++) {
-      Vec2i cur_vertex = Vec2i(rverts_[i]);
-      vertices_2i[i] = cur_vertex;
-
-      if (cur_vertex.x < xmin)
-        xmin = cur_vertex.x;
-      if (cur_vertex.x > xmax)
-        xmax = cur_vertex.x;
-      if (cur_vertex.y < ymin)
-        ymin = cur_vertex.y;
-      if (cur_vertex.y > ymax)
-        ymax = cur_vertex.y;
+    Rect box = bounds(rverts_, vertices_2i, origin_);
+    int xmin = box.x0, xmax = box.x1, ymin = box.y0, ymax = box.y1;
+    // clip the box to the frame, the depth buffer has no guard band, and to
+    // the tile being drawn
+    xmin = std::max({xmin, 0, clip_.x0});
+    ymin = std::max({ymin, 0, clip_.y0});
+    xmax = std::min({xmax, image.get_width(), clip_.x1});
+    ymax = std::min({ymax, image.get_height(), clip_.y1});
+    if (is_culled(vertices_2i, xmin, xmax, ymin, ymax)) {
+      TR_COUNT(TRIANGLES_CULLED, 1);
+      return;
     }
 
     Vec3f pixelPos, bc;
@@ -223,68 +289,84 @@ public:
         // although it's inside bounding box
         if (bc.x < 0 || bc.y < 0 || bc.z < 0)
           continue;
-
-        // barycentric interpolate texturing and lighting sampler
-        Vec2f tex_pos(0, 0);
-        for (int k = 0; k < 3; k++) {
-          tex_pos.x += uvs_[k].u * bc[k];
-          tex_pos.y += uvs_[k].v * bc[k];
+        size_t index = i + size_t(j) * image.get_width();
+        if (overdraw_) {
+          overdraw_->count(Overdraw::RASTERIZED, index);
+          // without shading bits fragments are flat white, nothing is shaded
+          if (shading_mode_)
+            overdraw_->count(Overdraw::SHADED, index);
         }
 
-        if ((shading_mode_ & 0x1) != 0) {
-          // &0x1 for diffuse bit
-          int sample_x = tex_pos.u * diffusemap.get_width();
-          int sample_y = tex_pos.v * diffusemap.get_height();
-
-          // overwrite the color
-          color = diffusemap.get_pixel(sample_x, sample_y);
-        }
-        if ((shading_mode_ & 0x10) != 0) {
-          // &0x10 for normal bit
-          int sample_x = tex_pos.u * normalmap.get_width();
-          int sample_y = tex_pos.v * normalmap.get_height();
-
-          TGAColor sample = normalmap.get_pixel(sample_x, sample_y);
-          Vec3f sample_val;
-          for (int i = 0; i < 3; i++)
-            sample_val.raw[2 - i] = (float)sample[i] / 255.0f * 2.0f - 1.0f;
-
-          float intensity =
-              std::max(0.0f, sample_val.normalize() * light_dir.normalize());
-          color = color * intensity;
-        }
-        if (0 && (shading_mode_ & 0x100) != 0) {
-          int sample1_x = tex_pos.u * normalmap.get_width();
-          int sample1_y = tex_pos.v * normalmap.get_height();
-
-          TGAColor sample1 = normalmap.get_pixel(sample1_x, sample1_y);
-          Vec3f sample_val;
-          for (int i = 0; i < 3; i++)
-            sample_val.raw[2 - i] = (float)sample1[i] / 255.0f * 2.0f - 1.0f;
-
-          int sample2_x = tex_pos.u * specmap.get_width();
-          int sample2_y = tex_pos.v * specmap.get_height();
-
-          TGAColor sample2 = specmap.get_pixel(sample2_x, sample2_y);
-          Vec3f sample2_val(sample2.r, sample2.g, sample2.b);
-
-          Vec3f n = sample2_val.normalize();
-          Vec3f l = light_dir.normalize();
-          Vec3f rfl = (n * (n * l * 2.0f) - l).normalize(); // reflected light
-          float spec = pow(std::max(0.0f, rfl.z), sample2_val.z / 1.0f);
-          float diff = std::max(0.0f, n * l);
-
-          for (int i = 0; i < 3; i++)
-            color[i] =
-                std::min<float>(5 + color[i] * (diff + 0.6f * spec), 255);
+        {
+          TR_STAGE(SHADING);
+          // barycentric interpolate texturing and lighting sampler
+          Vec2f tex_pos(0, 0);
+          for (int k = 0; k < 3; k++) {
+            tex_pos.x += uvs_[k].u * bc[k];
+            tex_pos.y += uvs_[k].v * bc[k];
+          }
+
+          if ((shading_mode_ & 0x1) != 0) {
+            // &0x1 for diffuse bit
+            int sample_x = tex_pos.u * diffusemap.get_width();
+            int sample_y = tex_pos.v * diffusemap.get_height();
+
+            // overwrite the color
+            color = diffusemap.get_texel(sample_x, sample_y);
+            TR_COUNT(TEXELS_FETCHED, 1);
+          }
+          if ((shading_mode_ & 0x10) != 0) {
+            // &0x10 for normal bit
+            int sample_x = tex_pos.u * normalmap.get_width();
+            int sample_y = tex_pos.v * normalmap.get_height();
+
+            TGAColor sample = normalmap.get_texel(sample_x, sample_y);
+            TR_COUNT(TEXELS_FETCHED, 1);
+            Vec3f sample_val;
+            for (int i = 0; i < 3; i++)
+              sample_val.raw[2 - i] = (float)sample[i] / 255.0f * 2.0f - 1.0f;
+
+            float intensity =
+                std::max(0.0f, sample_val.normalize() * light_dir.normalize());
+            color = color * intensity;
+          }
+          if (0 && (shading_mode_ & 0x100) != 0) {
+            int sample1_x = tex_pos.u * normalmap.get_width();
+            int sample1_y = tex_pos.v * normalmap.get_height();
+
+            TGAColor sample1 = normalmap.get_texel(sample1_x, sample1_y);
+            Vec3f sample_val;
+            for (int i = 0; i < 3; i++)
+              sample_val.raw[2 - i] = (float)sample1[i] / 255.0f * 2.0f - 1.0f;
+
+            int sample2_x = tex_pos.u * specmap.get_width();
+            int sample2_y = tex_pos.v * specmap.get_height();
+
+            TGAColor sample2 = specmap.get_texel(sample2_x, sample2_y);
+            Vec3f sample2_val(sample2.r, sample2.g, sample2.b);
+
+            Vec3f n = sample2_val.normalize();
+            Vec3f l = light_dir.normalize();
+            Vec3f rfl = (n * (n * l * 2.0f) - l).normalize(); // reflected light
+            float spec = pow(std::max(0.0f, rfl.z), sample2_val.z / 1.0f);
+            float diff = std::max(0.0f, n * l);
+
+            for (int i = 0; i < 3; i++)
+              color[i] =
+                  std::min<float>(5 + color[i] * (diff + 0.6f * spec), 255);
+          }
         }
 
         // depth buffer testing here.
+        TR_STAGE(DEPTH);
+        TR_COUNT(FRAGMENTS_TESTED, 1);
         for (int k = 0; k < 3; k++)
           pixelPos.z += rverts_[k].z * bc[k];
-        if (zbuf[int(pixelPos.x + pixelPos.y * image.get_width())] <
-            pixelPos.z) {
-          zbuf[int(pixelPos.x + pixelPos.y * image.get_width())] = pixelPos.z;
+        if (zbuf[index] < pixelPos.z) {
+          TR_COUNT(FRAGMENTS_PASSED, 1);
+          if (overdraw_)
+            overdraw_->count(Overdraw::PASSED, index);
+          zbuf[index] = pixelPos.z;
           // if only we update buffer , the "frame buffer" would be
           // update (actually we consider the image reference as our frame
           // buffer XD )
@@ -0,0 +1,64 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <cstdint>
+
+// Wire format of the render server (see server.h), spoken over a local Unix
+// socket so both ends share endianness and struct layout. A client writes a
+// Request and reads back a Reply, followed by reply.bytes of pixels unless
+// they went into the client's shared memory segment. Pixels are the raw
+// TGAImage storage: bytespp channels in BGR(A) order, rows as in origin.
+
+namespace protocol {
+
+const uint32_t request_magic = 0x51525254; // "TRRQ"
+const uint32_t reply_magic = 0x50525254;   // "TRRP"
+const uint32_t version = 1;
+
+enum Flags : uint32_t {
+  // write the pixels into the segment named by shm_name, created and sized
+  // by the client (shm_open), instead of after the reply
+  REPLY_SHM = 0x1,
+};
+
+enum Status : int32_t {
+  OK = 0,
+  BAD_REQUEST = 1, // wrong magic, version or out of range values
+  BAD_SHM = 2,     // segment missing or too small for the frame
+};
+
+struct Request {
+  uint32_t magic = request_magic;
+  uint32_t version = protocol::version;
+  int32_t width = 0;
+  int32_t height = 0;
+  int32_t mode = 0;         // RenderingMode
+  uint32_t shadingmode = 0; // ShadingType bits
+  int32_t parallel = 0;     // ParallelMode
+  uint32_t flags = 0;
+  float position[3] = {1, 0, 3}; // Camera, fov 0 for the original projection
+  float target[3] = {0, 0, 0};
+  float up[3] = {0, 1, 0};
+  float fov = 0;
+  float near = 0.1f;
+  float far = 100.0f;
+  char shm_name[64] = {}; // NUL terminated, with REPLY_SHM
+};
+
+struct Reply {
+  uint32_t magic = reply_magic;
+  int32_t status = OK;
+  int32_t width = 0;
+  int32_t height = 0;
+  int32_t bytespp = 0;
+  int32_t origin = 0; // TGAImage::Origin
+  uint32_t flags = 0; // REPLY_SHM when the pixels are in the segment
+  uint32_t frame = 0; // frames rendered by the server so far
+  uint64_t bytes = 0; // pixel bytes, width * height * bytespp
+  float render_us = 0; // time spent in Rasterizer::render()
+  uint32_t reserved = 0;
+};
+
+} // namespace protocol
+
+#endif // __PROTOCOL_H__
@@ -1,12 +1,157 @@
 #include "rasterizer.h"
 #include "gmath.hpp"
 #include "gutils.hpp"
+#include "jobs.h"
 #include "primitive.hpp"
+#include "stats.h"
 #include "tgaimage.h"
+#include "trace.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <memory>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// faces per batch event when tracing, keeps traces of big models readable
+static const int trace_batch = 256;
+
+// screen tiles rasterized as one job, vertex chunking of the vertex stage
+// and face chunking of the binning
+static const int tile_size = 64;
+static const int vertex_grain = 4096;
+static const int bin_grain = 4096;
+static const int max_bin_chunks = 64;
+
+// spare images kept for size or mode changes
+static const int image_pool_max = 8;
+
+/**
+ * @brief Set the rendering and shading modes from their command line name
+ *
+ * @param name wireframe/zbuf/triangle/textured/shading/overdraw
+ * @param options options to update
+ * @return true if the name is known
+ */
+bool parse_mode(const std::string &name, RenderOptions &options) noexcept {
+  const unsigned int all_maps = ShadingType::DIFFUSE | ShadingType::NORMAL |
+                                ShadingType::SPECULAR;
+  if (name == "wireframe") {
+    options.mode = RenderingMode::WIREFRAME;
+  } else if (name == "zbuf") {
+    options.mode = RenderingMode::ZBUFGRAY;
+  } else if (name == "triangle") {
+    options.mode = RenderingMode::TRIANGLE;
+  } else if (name == "textured") {
+    options.mode = RenderingMode::TRIANGLE;
+    options.shadingmode = ShadingType::DIFFUSE;
+  } else if (name == "shading") {
+    options.mode = RenderingMode::TRIANGLE;
+    options.shadingmode = all_maps;
+  } else if (name == "overdraw") {
+    options.mode = RenderingMode::OVERDRAW;
+    options.shadingmode = all_maps;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Texture maps sampled by the mode, the others need no loading
+ *
+ * @param options render options
+ * @return unsigned int ShadingType bits, 0 for wireframe and zbuf
+ */
+unsigned int used_maps(const RenderOptions &options) noexcept {
+  if (options.mode != RenderingMode::TRIANGLE &&
+      options.mode != RenderingMode::OVERDRAW)
+    return 0;
+  return options.shadingmode;
+}
+
+/**
+ * @brief Load the texture maps a render samples, block compressed copies when
+ * the options ask for them
+ *
+ * @param options render options
+ * @param paths tga files of the diffuse, normal and specular maps
+ * @return TextureMaps handles, empty for unused or unreadable maps
+ */
+TextureMaps load_maps(const RenderOptions &options,
+                      const std::string (&paths)[3]) noexcept {
+  const ShadingType types[3] = {DIFFUSE, NORMAL, SPECULAR};
+  unsigned int used = used_maps(options);
+  TextureCache &textures = TextureCache::instance();
+  TextureMaps maps;
+  for (int i = 0; i < 3; i++) {
+    if (!(used & types[i]))
+      continue;
+    if (options.compress_textures)
+      maps.blocks[i] = textures.load_blocks(paths[i]);
+    else
+      maps.textures[i] = textures.load(paths[i]);
+  }
+  return maps;
+}
+
+/**
+ * @brief Set the parallel mode from its command line name
+ *
+ * @param name tiles/sort-last
+ * @param options options to update
+ * @return true if the name is known
+ */
+bool parse_parallel(const std::string &name, RenderOptions &options) noexcept {
+  if (name == "tiles")
+    options.parallel = ParallelMode::TILES;
+  else if (name == "sort-last")
+    options.parallel = ParallelMode::SORT_LAST;
+  else
+    return false;
+  return true;
+}
+
+/**
+ * @brief Depth composite a run of pixels: where the source depth is strictly
+ * greater it replaces the destination depth and color
+ *
+ * @param depth color destination buffers
+ * @param src_depth src_color source buffers
+ * @param n pixels
+ * @param bpp bytes per color
+ */
+static void merge_depth(float *depth, unsigned char *color,
+                        const float *src_depth, const unsigned char *src_color,
+                        int n, int bpp) noexcept {
+  int i = 0;
+#ifdef __SSE2__
+  for (; i + 4 <= n; i += 4) {
+    __m128 dst = _mm_loadu_ps(depth + i);
+    __m128 src = _mm_loadu_ps(src_depth + i);
+    __m128 nearer = _mm_cmpgt_ps(src, dst);
+    int mask = _mm_movemask_ps(nearer);
+    if (!mask)
+      continue;
+    _mm_storeu_ps(depth + i, _mm_or_ps(_mm_and_ps(nearer, src),
+                                       _mm_andnot_ps(nearer, dst)));
+    for (int k = 0; k < 4; k++)
+      if (mask & (1 << k))
+        memcpy(color + (i + k) * bpp, src_color + (i + k) * bpp, bpp);
+  }
+#endif
+  for (; i < n; i++) {
+    if (src_depth[i] > depth[i]) {
+      depth[i] = src_depth[i];
+      memcpy(color + i * bpp, src_color + i * bpp, bpp);
+    }
+  }
+}
+
 /**
  * @brief Construct a new Renderer:: Renderer object,zbuffer will be
  * automatically initialized
@@ -17,14 +162,8 @@
  * renderer after passing
  */
 Rasterizer::Rasterizer(RenderOptions &options, Model *model) noexcept
-    : options_(options),
-      zbuffer_(std::make_unique<float[]>(options.width * options.height)),
-      frame_(std::make_unique<TGAImage>(options.width, options.height,
-                                        TGAImage::RGB)),
-      model_(model) {
-  std::fill_n(zbuffer_.get(), options.width * options.height,
-              -std::numeric_limits<float>::max());
-  is_mvp_calc = false;
+    : options_(options), model_(model), model_matrix_(model_trans()) {
+  reshape();
 }
 
 Rasterizer::~Rasterizer() noexcept {
@@ -32,27 +171,75 @@ Rasterizer::~Rasterizer() noexcept {
   frame_.get()->clear();
   frame_.reset();
 
-  // clear textures
-  diffusemap_.clear();
-  normalmap_.clear();
-  specularmap_.clear();
+  // release textures
+  diffusemap_ = Texture();
+  normalmap_ = Texture();
+  specularmap_ = Texture();
+
+  // release buffers
+  resolved_.reset();
+  layers_.clear();
+  image_pool_.clear();
+
+  // release model
+  model_.reset();
+}
+
+/**
+ * @brief Get the complete MVP matrix, composed again only if the camera, the
+ * model matrix or the frame size changed since the last call
+ *
+ * @return const Mat4f& viewport * projection * view * model
+ */
+const Mat4f &Rasterizer::get_mvp() noexcept {
+  update_mvp();
+  return mvp_;
+}
+
+void Rasterizer::set_camera(const Camera &camera) noexcept {
+  camera_ = camera;
+  view_dirty_ = true;
+  proj_dirty_ = true;
+}
 
-  // release buffer
-  zbuffer_.reset();
+/**
+ * @brief Move the camera, the projection is kept
+ *
+ * @param position camera position
+ * @param target point looked at
+ * @param up up direction
+ */
+void Rasterizer::look_at(Vec3f position, Vec3f target, Vec3f up) noexcept {
+  camera_.position = position;
+  camera_.target = target;
+  camera_.up = up;
+  view_dirty_ = true;
+  // the original projection depends on the camera z
+  if (camera_.fov <= 0)
+    proj_dirty_ = true;
+}
 
-  // clear model
-  delete model_;
-  model_ = nullptr;
+/**
+ * @brief Use a perspective projection, through projection_trans()
+ *
+ * @param fov vertical field of view in degrees, 0 for the original projection
+ * @param near far clip distances in front of the camera
+ */
+void Rasterizer::set_perspective(float fov, float near, float far) noexcept {
+  camera_.fov = fov;
+  camera_.near = near;
+  camera_.far = far;
+  proj_dirty_ = true;
 }
 
 /**
- * @brief Get the complete MVP matrix
+ * @brief Place the bound model in the world, model_trans() by default
  *
- * @return Mat4f
+ * @param matrix model to world transform
  */
-Mat4f Rasterizer::get_mvp() const noexcept {
-  return is_mvp_calc ? viewport * p_trans * v_trans * m_trans
-                     : Mat4f::identity();
+void Rasterizer::set_model_matrix(const Mat4f &matrix) noexcept {
+  model_matrix_ = matrix;
+  mvp_dirty_ = true;
 }
 
 /**
@@ -61,142 +248,727 @@ Mat4f Rasterizer::get_mvp() const noexcept {
  * @param model new model to be set
  */
 void Rasterizer::bind_model(Model *model) noexcept {
-  // here clear model_ ptr
-  delete model_;
-  model_ = model;
+  model_.reset(model);
 }
+
 /**
- * @brief set texture map for specific shading type
+ * @brief set a model shared with the model cache or other rasterizers, it is
+ * kept alive as long as it's bound
  *
- * @param texture TGAImage type image for texture
+ * @param model shared model handle, nullptr to unbind
+ */
+void Rasterizer::bind_model(ModelHandle model) noexcept {
+  model_ = std::move(model);
+}
+/**
+ * @brief set texture map for specific shading type, the texture is shared and
+ * sampled according to its own origin, so nothing is copied. With
+ * compress_textures set, a block compressed copy is built and sampled instead.
+ *
+ * @param texture shared texture handle, nullptr to unbind
+ * @param type shading type the texture will be used for
+ */
+void Rasterizer::bind_texture(TextureHandle texture,
+                              ShadingType type) noexcept {
+  Texture *slot = texture_slot(type);
+  if (!slot)
+    return;
+  if (texture && options_.compress_textures)
+    *slot = Texture{nullptr, BlockImage::compress(*texture)};
+  else
+    *slot = Texture{std::move(texture), nullptr};
+}
+
+/**
+ * @brief set an already block compressed texture map for specific shading type
+ *
+ * @param texture shared compressed texture handle, nullptr to unbind
  * @param type shading type the texture will be used for
  */
-void Rasterizer::bind_texture(TGAImage &texture, ShadingType type) noexcept {
-  texture.flip_vertically();
+void Rasterizer::bind_texture(BlockHandle texture, ShadingType type) noexcept {
+  if (Texture *slot = texture_slot(type))
+    *slot = Texture{nullptr, std::move(texture)};
+}
+
+/**
+ * @brief Bind the maps that are set, leaving the slots of the others as they
+ * are
+ *
+ * @param maps diffuse, normal and specular maps
+ */
+void Rasterizer::bind_maps(const TextureMaps &maps) noexcept {
+  const ShadingType types[3] = {DIFFUSE, NORMAL, SPECULAR};
+  for (int i = 0; i < 3; i++) {
+    if (maps.blocks[i])
+      bind_texture(maps.blocks[i], types[i]);
+    else if (maps.textures[i])
+      bind_texture(maps.textures[i], types[i]);
+  }
+}
 
-  if (type == ShadingType::DIFFUSE) {
-    diffusemap_.clear();
-    diffusemap_ = texture;
-  } else if (type == ShadingType::NORMAL) {
-    normalmap_.clear();
-    normalmap_ = texture;
-  } else if (type == ShadingType::SPECULAR) {
-    specularmap_.clear();
-    specularmap_ = texture;
+Texture *Rasterizer::texture_slot(ShadingType type) noexcept {
+  switch (type) {
+  case ShadingType::DIFFUSE:
+    return &diffusemap_;
+  case ShadingType::NORMAL:
+    return &normalmap_;
+  case ShadingType::SPECULAR:
+    return &specularmap_;
   }
+  return nullptr;
 }
+
 void Rasterizer::bind_options(RenderOptions &options) noexcept {
   options_ = options;
+  // the viewport follows size and depth, buffers are resized by begin_frame()
+  proj_dirty_ = true;
 }
 
-void Rasterizer::calc_mvp() noexcept {
-  m_trans = model_trans();
-  v_trans = view_trans(camera, obj_center - camera, Vec3f(0, 1, 0));
-  p_trans = Mat4f::identity();
-  p_trans[3][2] = -1.0f / camera.z;
-  viewport = viewport_trans(options_.width * 1 / 8, options_.height * 1 / 8,
-                            options_.width * 3 / 4, options_.height * 3 / 4,
-                            options_.depth);
-  is_mvp_calc = true;
+/**
+ * @brief Change the frame size, buffers are taken from the pool or grown
+ * only when nothing fits
+ *
+ * @param width height new frame size
+ */
+void Rasterizer::resize(int width, int height) noexcept {
+  options_.width = width;
+  options_.height = height;
+  reshape();
 }
 
 /**
- * @brief Render in wireframe mode with cached line
+ * @brief Fit the buffers to the size of the options. Frames of another size
+ * go back to the pool, the depth buffers keep their memory when it is large
+ * enough, and every tile is marked dirty as nothing is cleared here.
  *
  */
-void Rasterizer::render_wireframe() noexcept {
-  Line cached_line(white);
-  for (int i = 0; i < model_->f_vi_num(); i++) {
-    std::vector<int> face = model_->getf_vi(i);
-    for (int j = 0; j < 3; j++) {
-      Vec3f v0 = model_->getv(face[j]);
-      Vec3f v1 = model_->getv(face[(j + 1) % 3]);
-      int x0 = (v0.x + 1.) * options_.width / 2.;
-      int y0 = (v0.y + 1.) * options_.height / 2.;
-      int x1 = (v1.x + 1.) * options_.width / 2.;
-      int y1 = (v1.y + 1.) * options_.height / 2.;
-      cached_line.set_point(Vec2i(x0, y0), Vec2i(x1, y1));
+void Rasterizer::reshape() noexcept {
+  width_ = options_.width;
+  height_ = options_.height;
+  proj_dirty_ = true;
+
+  if (frame_)
+    recycle_image(std::move(frame_));
+  frame_ = acquire_image(TGAImage::RGB);
+  zbuffer_.resize(size_t(width_) * height_);
+  output_ = frame_.get();
+  color_ = frame_.get();
+  recycle_image(std::move(resolved_));
+  for (Layer &layer : layers_)
+    recycle_image(std::move(layer.frame));
+  layers_.clear();
+
+  tiles_x_ = (width_ + tile_size - 1) / tile_size;
+  tiles_y_ = (height_ + tile_size - 1) / tile_size;
+  tile_dirty_.assign(size_t(tiles_x_) * tiles_y_, 1);
+  tile_cleared_.assign(size_t(tiles_x_) * tiles_y_, 0);
+}
+
+/**
+ * @brief Take an image of the current size and format from the pool, or
+ * allocate one. Contents are left as they were.
+ *
+ * @param bpp bytes per pixel
+ * @return std::unique_ptr<TGAImage> image, bottom-left like the frame
+ */
+std::unique_ptr<TGAImage> Rasterizer::acquire_image(int bpp) noexcept {
+  for (auto it = image_pool_.begin(); it != image_pool_.end(); ++it) {
+    TGAImage &image = **it;
+    if (image.get_width() == width_ && image.get_height() == height_ &&
+        image.get_bytespp() == bpp) {
+      std::unique_ptr<TGAImage> found = std::move(*it);
+      image_pool_.erase(it);
+      return found;
     }
-    cached_line.draw(*(frame_.get()), zbuffer_.get());
   }
+  return std::make_unique<TGAImage>(width_, height_, bpp,
+                                    TGAImage::BOTTOM_LEFT);
+}
+
+void Rasterizer::recycle_image(std::unique_ptr<TGAImage> image) noexcept {
+  if (!image)
+    return;
+  image_pool_.push_back(std::move(image));
+  // the oldest go first, a few sizes are enough to alternate between
+  if ((int)image_pool_.size() > image_pool_max)
+    image_pool_.erase(image_pool_.begin());
 }
 
 /**
- * @brief Render in gray image zbuffer mode
+ * @brief Pixels of a screen tile, the last row and column of tiles may be
+ * cut by the frame edge
  *
+ * @param tile tile index, row major
+ * @return Rect tile pixels
  */
-void Rasterizer::render_zbufgray() noexcept {
-  Triangle cached_triangle(options_.shadingmode);
-  TGAImage zbufimage(options_.width, options_.height, TGAImage::GRAYSCALE);
+Rect Rasterizer::tile_rect(int tile) const noexcept {
+  Rect rect;
+  rect.x0 = (tile % tiles_x_) * tile_size;
+  rect.y0 = (tile / tiles_x_) * tile_size;
+  rect.x1 = std::min(rect.x0 + tile_size, width_);
+  rect.y1 = std::min(rect.y0 + tile_size, height_);
+  return rect;
+}
+
+/**
+ * @brief Reset color and depth of a tile, if an older frame drew in it, and
+ * mark it cleared for this frame
+ *
+ * @param tile tile index
+ */
+void Rasterizer::clear_tile(int tile) noexcept {
+  if (tile_cleared_[tile])
+    return;
+  tile_cleared_[tile] = 1;
+  if (!tile_dirty_[tile])
+    return;
+  tile_dirty_[tile] = 0;
+  Rect rect = tile_rect(tile);
+  int bpp = color_->get_bytespp();
+  for (int y = rect.y0; y < rect.y1; y++) {
+    size_t row = size_t(y) * width_;
+    memset(color_->buffer() + (row + rect.x0) * bpp, 0,
+           size_t(rect.x1 - rect.x0) * bpp);
+    std::fill(zbuffer_.get() + row + rect.x0, zbuffer_.get() + row + rect.x1,
+              -std::numeric_limits<float>::max());
+  }
+}
+
+/**
+ * @brief Clear every tile not cleared yet this frame, before passes drawing
+ * anywhere on the frame
+ *
+ */
+void Rasterizer::clear_tiles() noexcept {
+  TR_TRACE("clear", "stage");
+  JobSystem::instance().parallel_for(0, tiles_x_ * tiles_y_, 1,
+                                     [&](int tile, int) { clear_tile(tile); });
+}
+
+void Rasterizer::mark_tiles_dirty() noexcept {
+  std::fill(tile_dirty_.begin(), tile_dirty_.end(), 1);
+}
+
+bool Rasterizer::target_fits(int bpp) const noexcept {
+  return target_ && target_->buffer() && target_->get_width() == width_ &&
+         target_->get_height() == height_ && target_->get_bytespp() == bpp;
+}
+
+/**
+ * @brief Format of the images get_frame() returns in the current mode
+ *
+ * @return int bytes per pixel, TGAImage::GRAYSCALE in zbuf mode else RGB
+ */
+int Rasterizer::output_format() const noexcept {
+  return options_.mode == ZBUFGRAY ? TGAImage::GRAYSCALE : TGAImage::RGB;
+}
+
+/**
+ * @brief Produce the next frames in an image of the caller, a shared memory
+ * slot for instance, instead of an own one: color modes draw on it directly
+ * and zbuf/overdraw modes resolve into it. It is only used while it has the
+ * frame size and output_format(), else frames stay in own images as usual.
+ * Drawing in a different image than the last frame makes every tile get
+ * cleared.
+ *
+ * @param target bottom-left image outliving its use, nullptr to stop
+ */
+void Rasterizer::set_target(TGAImage *target) noexcept { target_ = target; }
 
-  Vec3f screen_coords[3]; // coord of 3 verts trace on screen plate
+/**
+ * @brief Render the frame as a window of a larger image: the camera frames
+ * the full image and the frame gets the pixels at (x, y) of it, the very
+ * pixels a render of the full image has there. Posters too large for memory
+ * are rendered window by window, and split over processes.
+ *
+ * @param x y bottom-left pixel of the window in the full image
+ * @param full_width full_height full image size, 0 to render whole frames
+ */
+void Rasterizer::set_window(int x, int y, int full_width,
+                            int full_height) noexcept {
+  bool whole = full_width <= 0 || full_height <= 0;
+  window_x_ = whole ? 0 : x;
+  window_y_ = whole ? 0 : y;
+  full_width_ = whole ? 0 : full_width;
+  full_height_ = whole ? 0 : full_height;
+  proj_dirty_ = true;
+}
 
-  // render each piece/triangles
-  for (int i = 0; i < model_->f_vi_num(); i++) {
-    for (int j = 0; j < 3; j++) {
-      screen_coords[j] = m2v3(get_mvp() * v2m(model_->getv(i, j)));
+void Rasterizer::update_mvp() noexcept {
+  if (options_.depth != depth_) {
+    depth_ = options_.depth;
+    proj_dirty_ = true;
+  }
+  if (view_dirty_) {
+    v_trans = view_trans(camera_.position, camera_.target - camera_.position,
+                         camera_.up);
+    view_dirty_ = false;
+    mvp_dirty_ = true;
+  }
+  if (proj_dirty_) {
+    // the viewport maps onto the full image, vertices stay in its
+    // coordinates and are only moved to the window when rounded
+    int width = full_width_ > 0 ? full_width_ : width_;
+    int height = full_height_ > 0 ? full_height_ : height_;
+    if (camera_.fov > 0) {
+      // projection_trans() looks down -z, so the planes are negative
+      p_trans = projection_trans(camera_.fov, float(width) / height,
+                                 -camera_.near, -camera_.far);
+    } else {
+      p_trans = Mat4f::identity();
+      p_trans[3][2] = -1.0f / camera_.position.z;
     }
-    cached_triangle.set_rverts(screen_coords);
+    viewport = viewport_trans(width * 1 / 8, height * 1 / 8, width * 3 / 4,
+                              height * 3 / 4, depth_);
+    proj_dirty_ = false;
+    mvp_dirty_ = true;
+  }
+  if (!mvp_dirty_)
+    return;
+  mvp_ = viewport * p_trans * v_trans * model_matrix_;
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++)
+      mvp_raw_[i][j] = mvp_[i][j];
+  mvp_dirty_ = false;
+}
 
-    // render on image, triangle as piece
-    cached_triangle.draw(*(frame_.get()), zbuffer_.get());
+/**
+ * @brief Clip a segment to a rectangle (Liang-Barsky), in screen space
+ *
+ * @param a b segment ends, moved onto the rectangle when clipped
+ * @param x0 y0 x1 y1 rectangle
+ * @return false if nothing of the segment is left, or an end isn't finite
+ */
+static bool clip_segment(Vec3f &a, Vec3f &b, float x0, float y0, float x1,
+                         float y1) noexcept {
+  if (!std::isfinite(a.x) || !std::isfinite(a.y) || !std::isfinite(b.x) ||
+      !std::isfinite(b.y))
+    return false;
+  float dx = b.x - a.x, dy = b.y - a.y;
+  float p[4] = {-dx, dx, -dy, dy};
+  float q[4] = {a.x - x0, x1 - a.x, a.y - y0, y1 - a.y};
+  float t0 = 0, t1 = 1;
+  for (int i = 0; i < 4; i++) {
+    if (p[i] == 0) {
+      if (q[i] < 0)
+        return false;
+      continue;
+    }
+    float t = q[i] / p[i];
+    if (p[i] < 0)
+      t0 = std::max(t0, t);
+    else
+      t1 = std::min(t1, t);
   }
+  if (t0 > t1)
+    return false;
+  Vec3f start = a;
+  if (t1 < 1)
+    b = Vec3f(start.x + t1 * dx, start.y + t1 * dy, b.z);
+  if (t0 > 0)
+    a = Vec3f(start.x + t0 * dx, start.y + t0 * dy, a.z);
+  return true;
+}
 
-  // render finally z buffer preview image
-  for (int i = 0; i < options_.width; i++) {
-    for (int j = 0; j < options_.height; j++) {
-      zbufimage.set_pixel(i, j,
-                          TGAColor(zbuffer_.get()[i + j * options_.width], 1));
+/**
+ * @brief Render in wireframe mode with cached line: the edges of every face
+ * through the vertex stage, so the camera and projection apply as for
+ * triangles
+ *
+ */
+void Rasterizer::render_wireframe() noexcept {
+  TR_TRACE("wireframe", "pass");
+  clear_tiles();
+  process_vertices(false);
+  Line cached_line(white);
+  int face_num = model_->f_vi_num();
+  // edges are cut to a guard band of a frame around the full frame, which
+  // bounds their length without moving the ends of any edge on screen
+  float width = full_width_ > 0 ? full_width_ : options_.width;
+  float height = full_height_ > 0 ? full_height_ : options_.height;
+  for (int b = 0; b < face_num; b += trace_batch) {
+    TR_TRACE_ARG("faces", "batch", b / trace_batch);
+    for (int i = b; i < std::min(b + trace_batch, face_num); i++) {
+      TR_STAGE(ASSEMBLY);
+      TR_COUNT(TRIANGLES_SUBMITTED, 1);
+      Vec3f screen_coords[3];
+      for (int j = 0; j < 3; j++)
+        screen_coords[j] = verts_.screen(model_->getf_vi(i, j));
+      TR_STAGE(RASTER);
+      for (int j = 0; j < 3; j++) {
+        Vec3f v0 = screen_coords[j], v1 = screen_coords[(j + 1) % 3];
+        if (!clip_segment(v0, v1, -width, -height, 2 * width, 2 * height))
+          continue;
+        Vec2i p0(v0), p1(v1);
+        cached_line.set_point(Vec2i(p0.x - window_x_, p0.y - window_y_),
+                              Vec2i(p1.x - window_x_, p1.y - window_y_));
+        cached_line.draw(*color_, zbuffer_.get());
+      }
     }
   }
+  mark_tiles_dirty();
+}
 
-  // we don't need the triangle image, so let's replace it.
-  frame_.get()->clear();
-  frame_.reset();
-  frame_ = std::make_unique<TGAImage>(std::move(zbufimage));
+/**
+ * @brief Vertex stage: transform the model's vertices and normalize its
+ * normals in chunks on the job system, into the streams of verts_. Every
+ * vertex is processed once however many faces share it.
+ *
+ * @param attributes also fill uvs and normals, not needed for depth only
+ */
+void Rasterizer::process_vertices(bool attributes) noexcept {
+  TR_TRACE("vertices", "stage");
+  JobSystem &jobs = JobSystem::instance();
+  update_mvp();
+
+  int v_num = model_->v_num();
+  verts_.x.resize(v_num);
+  verts_.y.resize(v_num);
+  verts_.z.resize(v_num);
+  jobs.parallel_for(0, v_num, vertex_grain, [&](int begin, int end) {
+    TR_TRACE_ARG("positions", "chunk", begin / vertex_grain);
+    TR_STAGE(TRANSFORM);
+    TR_COUNT(VERTICES_TRANSFORMED, end - begin);
+    for (int i = begin; i < end; i++) {
+      Vec3f screen = transform_point(mvp_raw_, model_->getv(i));
+      verts_.x[i] = screen.x;
+      verts_.y[i] = screen.y;
+      verts_.z[i] = screen.z;
+    }
+  });
+  if (!attributes)
+    return;
+
+  int vt_num = model_->vt_num();
+  verts_.u.resize(vt_num);
+  verts_.v.resize(vt_num);
+  int vn_num = model_->vn_num();
+  verts_.nx.resize(vn_num);
+  verts_.ny.resize(vn_num);
+  verts_.nz.resize(vn_num);
+  // uvs and normals share the chunks, the longer array sets the range
+  jobs.parallel_for(0, std::max(vt_num, vn_num), vertex_grain,
+                    [&](int begin, int end) {
+                      TR_TRACE_ARG("attributes", "chunk",
+                                   begin / vertex_grain);
+                      TR_STAGE(TRANSFORM);
+                      for (int i = begin; i < std::min(end, vt_num); i++) {
+                        Vec2f uv = model_->getvt(i);
+                        verts_.u[i] = uv.u;
+                        verts_.v[i] = uv.v;
+                      }
+                      for (int i = begin; i < std::min(end, vn_num); i++) {
+                        Vec3f normal = model_->getvn(i).normalize();
+                        verts_.nx[i] = normal.x;
+                        verts_.ny[i] = normal.y;
+                        verts_.nz[i] = normal.z;
+                      }
+                    });
 }
 
 /**
- * @brief Render in triangle piece mode with cached triangle
+ * @brief Rasterize the transformed faces with the parallel mode of the
+ * options
  *
+ * @param textured run the shading path, else only depth
  */
-void Rasterizer::render_triangle() noexcept {
-  Triangle cached_triangle(options_.shadingmode);
+void Rasterizer::rasterize(bool textured) noexcept {
+  if (options_.parallel == SORT_LAST && options_.mode != OVERDRAW &&
+      JobSystem::instance().thread_count() > 1) {
+    draw_layers(textured);
+  } else {
+    bin_faces();
+    draw_tiles(textured);
+  }
+}
 
+/**
+ * @brief Gather a face from the vertex stage output and draw it
+ *
+ * @param triangle triangle set up for the pass, clip and counters included
+ * @param iface face index
+ * @param textured run the shading path, else only depth
+ * @param frame zbuf buffers to draw in
+ */
+void Rasterizer::draw_face(Triangle &triangle, int iface, bool textured,
+                           TGAImage &frame, float *zbuf) noexcept {
   Vec3f screen_coords[3]; // coord of 3 verts trace on viewport plateform
-  Vec3f world_coords[3];  // coord of 3 verts without any transform
   Vec2f tex_coords[3];    // coord of 3 verts for texturing
   Vec3f norm_coords[3];   // coord of 3 vertex for lighting
+  for (int j = 0; j < 3; j++)
+    screen_coords[j] = verts_.screen(model_->getf_vi(iface, j));
+  triangle.set_rverts(screen_coords);
+  if (!textured) {
+    triangle.draw(frame, zbuf);
+    return;
+  }
+  for (int j = 0; j < 3; j++) {
+    tex_coords[j] = verts_.uv(model_->getf_vti(iface, j));
+    norm_coords[j] = verts_.normal(model_->getf_vni(iface, j));
+  }
+  triangle.set_uvs(tex_coords);
+  triangle.set_normals(norm_coords);
+  // texturing will be done in draw_triangle()
+  triangle.draw(frame, zbuf, diffusemap_, normalmap_, specularmap_);
+}
+
+/**
+ * @brief Sort faces into the screen tiles their bounding box touches. Faces
+ * are split in chunks binned in parallel, each chunk keeps its own bins so
+ * walking the chunks in order gives every tile its faces in submission order.
+ *
+ */
+void Rasterizer::bin_faces() noexcept {
+  TR_TRACE("binning", "stage");
+  int tile_num = tiles_x_ * tiles_y_;
+  int face_num = model_->f_num();
+  // chunking only depends on the face count, so is the output
+  int grain = std::max(bin_grain, face_num / max_bin_chunks + 1);
+  bin_chunks_ = JobSystem::chunk_count(0, face_num, grain);
+  bins_.resize(size_t(bin_chunks_) * tile_num);
+  for (std::vector<int> &bin : bins_)
+    bin.clear();
 
-  // render each face/piece
-  for (int i = 0; i < model_->f_num(); i++) {
-    for (int j = 0; j < 3; j++) {
-      world_coords[j] = model_->getv(i, j);
-      screen_coords[j] = m2v3(get_mvp() * v2m(world_coords[j]));
-      tex_coords[j] = model_->getvt(i, j);
-      norm_coords[j] = model_->getvn(i, j);
+  JobSystem::instance().parallel_for(0, face_num, grain, [&](int begin,
+                                                             int end) {
+    TR_STAGE(ASSEMBLY);
+    std::vector<int> *bins = &bins_[size_t(begin / grain) * tile_num];
+    Vec3f screen[3];
+    Vec2i pts[3];
+    for (int i = begin; i < end; i++) {
+      TR_COUNT(TRIANGLES_SUBMITTED, 1);
+      for (int j = 0; j < 3; j++)
+        screen[j] = verts_.screen(model_->getf_vi(i, j));
+      Rect box =
+          Triangle::bounds(screen, pts, Vec2i(window_x_, window_y_));
+      box.x0 = std::max(box.x0, 0);
+      box.y0 = std::max(box.y0, 0);
+      box.x1 = std::min(box.x1, options_.width);
+      box.y1 = std::min(box.y1, options_.height);
+      if (Triangle::is_culled(pts, box.x0, box.x1, box.y0, box.y1)) {
+        TR_COUNT(TRIANGLES_CULLED, 1);
+        continue;
+      }
+      for (int ty = box.y0 / tile_size; ty <= (box.y1 - 1) / tile_size; ty++)
+        for (int tx = box.x0 / tile_size; tx <= (box.x1 - 1) / tile_size;
+             tx++)
+          bins[ty * tiles_x_ + tx].push_back(i);
     }
+  });
+}
 
-    cached_triangle.set_verts(world_coords);
-    cached_triangle.set_rverts(screen_coords);
-    cached_triangle.set_uvs(tex_coords);
-    cached_triangle.set_normals(norm_coords);
+/**
+ * @brief Rasterize the binned faces, one job per tile. A tile is only ever
+ * touched by the thread drawing it, so frame, depth buffer and overdraw
+ * counters need no synchronization.
+ *
+ * @param textured run the shading path, else only depth
+ */
+void Rasterizer::draw_tiles(bool textured) noexcept {
+  int tile_num = tiles_x_ * tiles_y_;
+  JobSystem::instance().parallel_for(0, tile_num, 1, [&](int tile, int) {
+    TR_TRACE_ARG("tile", "tile", tile);
+    clear_tile(tile);
+    TR_STAGE(RASTER);
+    Triangle cached_triangle(options_.shadingmode);
+    if (options_.mode == OVERDRAW)
+      cached_triangle.set_overdraw(overdraw_.get());
+    cached_triangle.set_clip(tile_rect(tile));
+    cached_triangle.set_origin(Vec2i(window_x_, window_y_));
+
+    for (int chunk = 0; chunk < bin_chunks_; chunk++) {
+      const std::vector<int> &bin = bins_[size_t(chunk) * tile_num + tile];
+      if (!bin.empty())
+        tile_dirty_[tile] = 1;
+      for (int i : bin)
+        draw_face(cached_triangle, i, textured, *color_, zbuffer_.get());
+    }
+  });
+}
 
-    // render on image, texturing will be done in draw_triangle()
-    cached_triangle.draw(*(frame_.get()), zbuffer_.get(), diffusemap_,
-                         normalmap_, specularmap_);
+/**
+ * @brief Sort-last rasterization: the faces are cut in one contiguous range
+ * per thread, each drawn with a full frame and depth buffer of its own, then
+ * merged. Balances faces rather than screen area, for scenes crowding a few
+ * tiles.
+ *
+ * @param textured run the shading path, else only depth
+ */
+void Rasterizer::draw_layers(bool textured) noexcept {
+  JobSystem &jobs = JobSystem::instance();
+  int layer_num = jobs.thread_count();
+  int face_num = model_->f_num();
+  int pixels = width_ * height_;
+  // the first range draws on the frame itself, on top of earlier draws
+  clear_tiles();
+  for (size_t i = layer_num - 1; i < layers_.size(); i++)
+    recycle_image(std::move(layers_[i].frame));
+  layers_.resize(layer_num - 1);
+  for (Layer &layer : layers_) {
+    if (!layer.frame)
+      layer.frame = acquire_image(color_->get_bytespp());
+    layer.zbuf.resize(pixels);
   }
+
+  jobs.parallel_for(0, layer_num, 1, [&](int layer, int) {
+    TR_TRACE_ARG("layer", "layer", layer);
+    TGAImage *frame = color_;
+    float *zbuf = zbuffer_.get();
+    if (layer > 0) {
+      Layer &buffers = layers_[layer - 1];
+      buffers.frame->clear();
+      frame = buffers.frame.get();
+      zbuf = buffers.zbuf.get();
+      std::fill_n(zbuf, pixels, -std::numeric_limits<float>::max());
+    }
+
+    TR_STAGE(RASTER);
+    Triangle cached_triangle(options_.shadingmode);
+    cached_triangle.set_origin(Vec2i(window_x_, window_y_));
+    int begin = int(int64_t(face_num) * layer / layer_num);
+    int end = int(int64_t(face_num) * (layer + 1) / layer_num);
+    for (int i = begin; i < end; i++) {
+      TR_COUNT(TRIANGLES_SUBMITTED, 1);
+      draw_face(cached_triangle, i, textured, *frame, zbuf);
+    }
+  });
+  merge_layers();
+  mark_tiles_dirty();
 }
 
 /**
- * @brief Render regarding rendering mode(shading mode will be used in triangle
- * render)
+ * @brief Composite the sort-last layers into color_ and zbuffer_ in face
+ * order, a layer only wins where it is strictly nearer, so depth ties keep
+ * the earlier face as the serial depth test does. Rows are merged in
+ * parallel, depths compared four at a time.
  *
  */
-void Rasterizer::render() noexcept {
-  frame_.get()->clear();
-  if (!is_mvp_calc)
-    calc_mvp();
+void Rasterizer::merge_layers() noexcept {
+  TR_TRACE("merge", "stage");
+  int width = options_.width;
+  int bpp = color_->get_bytespp();
+  JobSystem::instance().parallel_for(
+      0, options_.height, tile_size, [&](int begin, int end) {
+        TR_STAGE(RESOLVE);
+        for (const Layer &layer : layers_) {
+          size_t offset = size_t(begin) * width;
+          merge_depth(zbuffer_.get() + offset, color_->buffer() + offset * bpp,
+                      layer.zbuf.get() + offset,
+                      layer.frame->buffer() + offset * bpp,
+                      (end - begin) * width, bpp);
+        }
+      });
+}
+
+/**
+ * @brief Render in gray image zbuffer mode
+ *
+ */
+void Rasterizer::render_zbufgray() noexcept {
+  TR_TRACE("zbuf", "pass");
+  // render each piece/triangles, the depth is turned into an image at the
+  // end of the frame
+  process_vertices(false);
+  rasterize(false);
+}
+
+/**
+ * @brief Render in triangle piece mode: vertex stage, then rasterization
+ * spread over the threads as the parallel mode says
+ *
+ */
+void Rasterizer::render_triangle() noexcept {
+  TR_TRACE("triangles", "pass");
+  process_vertices(true);
+  rasterize(true);
+}
+
+/**
+ * @brief Turn the depth buffer into the gray preview image
+ *
+ */
+void Rasterizer::resolve_zbufgray() noexcept {
+  TR_TRACE("resolve", "stage");
+  TGAImage *out = target_;
+  if (!target_fits(TGAImage::GRAYSCALE)) {
+    if (!resolved_ || resolved_->get_bytespp() != TGAImage::GRAYSCALE) {
+      recycle_image(std::move(resolved_));
+      resolved_ = acquire_image(TGAImage::GRAYSCALE);
+    }
+    out = resolved_.get();
+  }
+  JobSystem::instance().parallel_for(
+      0, height_, tile_size, [&](int begin, int end) {
+        TR_STAGE(RESOLVE);
+        for (int j = begin; j < end; j++) {
+          for (int i = 0; i < width_; i++) {
+            out->set_pixel(i, j, TGAColor(zbuffer_.get()[i + j * width_], 1));
+          }
+        }
+      });
+  output_ = out;
+}
+
+/**
+ * @brief Show the rasterized fragment counts as the depth complexity heatmap
+ *
+ */
+void Rasterizer::resolve_overdraw() noexcept {
+  TR_STAGE(RESOLVE);
+  TR_TRACE("resolve", "stage");
+  TGAImage *out = target_;
+  if (!target_fits(TGAImage::RGB)) {
+    if (!resolved_ || resolved_->get_bytespp() != TGAImage::RGB) {
+      recycle_image(std::move(resolved_));
+      resolved_ = acquire_image(TGAImage::RGB);
+    }
+    out = resolved_.get();
+  }
+  overdraw_->heatmap(Overdraw::RASTERIZED, *out);
+  output_ = out;
+}
+
+/**
+ * @brief Start a frame: pick up size changes of the options and forget which
+ * tiles were cleared, the clears themselves happen when passes reach a tile
+ *
+ */
+void Rasterizer::begin_frame() noexcept {
+  if (options_.width != width_ || options_.height != height_)
+    reshape();
+  update_mvp();
+  std::fill(tile_cleared_.begin(), tile_cleared_.end(), 0);
+
+  // the color passes draw on the target straight away, other modes resolve
+  // into it; what another buffer holds is unknown, so switching buffers
+  // makes every tile dirty
+  bool draws_color = options_.mode == WIREFRAME || options_.mode == TRIANGLE;
+  color_ = draws_color && target_fits(TGAImage::RGB) ? target_ : frame_.get();
+  if (color_->buffer() != color_pixels_) {
+    color_pixels_ = color_->buffer();
+    mark_tiles_dirty();
+  }
+  output_ = color_;
+
+  if (options_.mode == OVERDRAW) {
+    if (!overdraw_ || overdraw_->get_width() != width_ ||
+        overdraw_->get_height() != height_)
+      overdraw_ = std::make_unique<Overdraw>(width_, height_);
+    else
+      overdraw_->clear();
+  }
+  in_frame_ = true;
+}
+
+/**
+ * @brief Render the bound model into the current frame regarding rendering
+ * mode (shading mode will be used in triangle render), depth tested against
+ * what the frame already holds
+ *
+ */
+void Rasterizer::draw() noexcept {
+  if (!in_frame_)
+    begin_frame();
 
   switch (options_.mode) {
   case WIREFRAME:
@@ -206,13 +978,45 @@ void Rasterizer::render() noexcept {
     render_zbufgray();
     break;
   case TRIANGLE:
+  case OVERDRAW:
     render_triangle();
     break;
   }
 
-  // flip image vertically ,
-  // cuz the drawing in TGAImage is upside down.
-  frame_.get()->flip_vertically();
+  // no flip needed here, the frame is stored bottom-up as we draw it and the
+  // origin goes into the tga header on save.
+}
+
+/**
+ * @brief Finish the frame: clear the tiles no pass reached and resolve the
+ * image of the mode, then dump the trace when tracing is on and the options
+ * don't leave it to the caller
+ *
+ */
+void Rasterizer::end_frame() noexcept {
+  if (!in_frame_)
+    begin_frame();
+  clear_tiles();
+  if (options_.mode == ZBUFGRAY)
+    resolve_zbufgray();
+  else if (options_.mode == OVERDRAW)
+    resolve_overdraw();
+  in_frame_ = false;
+  if (options_.dump_trace)
+    trace::dump();
+}
+
+/**
+ * @brief Render one frame of the bound model
+ *
+ */
+void Rasterizer::render() noexcept {
+  {
+    TR_TRACE("render", "frame");
+    begin_frame();
+    draw();
+  }
+  end_frame();
 }
 
 /**
@@ -220,6 +1024,8 @@ void Rasterizer::render() noexcept {
  *
  * @param filename image to store the output, suffix should be .tga
  */
-void Rasterizer::save_frame(std::string filename) noexcept {
-  frame_.get()->write_tga_file(filename.data());
+bool Rasterizer::save_frame(std::string filename) noexcept {
+  TR_STAGE(SAVE);
+  TR_TRACE("save", "stage");
+  return output_->write_tga_file(filename.data());
 }
\ No newline at end of file
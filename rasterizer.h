@@ -1,11 +1,21 @@
 #ifndef __RASTERIZER_H__
 #define __RASTERIZER_H__
 
+#include "buffer.hpp"
 #include "gmath.hpp"
 #include "model.h"
+#include "modelcache.h"
+#include "overdraw.h"
+#include "texcache.h"
+#include "texture.h"
 #include "tgaimage.h"
 #include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
+
+struct Rect;
+struct Triangle;
 
 enum ShadingType {
   DIFFUSE = 0x1,
@@ -17,6 +27,13 @@ enum RenderingMode {
   WIREFRAME,
   TRIANGLE,
   ZBUFGRAY,
+  OVERDRAW, // fragment count heatmap, triangles shaded as in TRIANGLE
+};
+
+// how the triangle passes spread over the threads of the job system
+enum ParallelMode {
+  TILES,     // faces binned into screen tiles, one job per tile
+  SORT_LAST, // face ranges drawn into per thread buffers, merged by depth
 };
 
 struct RenderOptions {
@@ -26,31 +43,142 @@ struct RenderOptions {
   int width = 1080;
   int height = 1080;
   int depth = 255;
+
+  // overdraw always uses tiles, its counters are shared by all threads
+  ParallelMode parallel = ParallelMode::TILES;
+
+  // sample block compressed copies of the bound textures
+  bool compress_textures = false;
+
+  // write the trace at the end of every frame; off when frames render
+  // concurrently, their caller dumps once they are all done
+  bool dump_trace = true;
+};
+
+// command line names: wireframe/zbuf/triangle/textured/shading/overdraw for
+// the mode, tiles/sort-last for the parallel mode; false on unknown names
+bool parse_mode(const std::string &name, RenderOptions &options) noexcept;
+bool parse_parallel(const std::string &name, RenderOptions &options) noexcept;
+// ShadingType bits of the texture maps a render with these options samples
+unsigned int used_maps(const RenderOptions &options) noexcept;
+
+// where the scene is looked at from. With fov left at 0 the projection is
+// the original one, a perspective divide by the camera z, else it is
+// projection_trans() with the vertical fov in degrees, near and far distances
+struct Camera {
+  Vec3f position = Vec3f(1, 0, 3);
+  Vec3f target = Vec3f(0, 0, 0);
+  Vec3f up = Vec3f(0, 1, 0);
+  float fov = 0;
+  float near = 0.1f;
+  float far = 100.0f;
+};
+
+// texture maps of a model in the order diffuse, normal, specular; a block
+// compressed copy is bound instead of the decoded map when it is set
+struct TextureMaps {
+  TextureHandle textures[3];
+  BlockHandle blocks[3];
+};
+
+// load the maps the options sample through TextureCache, from paths in the
+// order above; maps that can't be loaded stay empty
+TextureMaps load_maps(const RenderOptions &options,
+                      const std::string (&paths)[3]) noexcept;
+
+// vertex stage output, structure of arrays indexed like the model's vertex,
+// texture vertex and normal arrays so each stream is written contiguously;
+// faces gather their corners from it through the model's index lists
+struct VertexBuffer {
+  std::vector<float> x, y, z;    // screen space positions
+  std::vector<float> u, v;       // texture coordinates
+  std::vector<float> nx, ny, nz; // unit normals
+
+  Vec3f screen(int i) const { return Vec3f(x[i], y[i], z[i]); }
+  Vec2f uv(int i) const { return Vec2f(u[i], v[i]); }
+  Vec3f normal(int i) const { return Vec3f(nx[i], ny[i], nz[i]); }
 };
 
 class Rasterizer {
 private:
   // below block are resource needing clean
   RenderOptions &options_;
-  std::unique_ptr<float[]> zbuffer_;
+  AlignedBuffer<float> zbuffer_;
   std::unique_ptr<TGAImage> frame_;
-  Model *model_;
-
-  // texture maps
-  TGAImage diffusemap_;
-  TGAImage normalmap_;
-  TGAImage specularmap_;
-
-  // some hard code but important position
-  Vec3f camera = Vec3f(1, 0, 3);
-  Vec3f obj_center = Vec3f(0, 0, 0);
-
-  // mvp cache
-  Mat4f m_trans;
+  ModelHandle model_;
+  std::unique_ptr<Overdraw> overdraw_;
+
+  // what the frame resolves to in zbuf and overdraw modes, and the image
+  // get_frame() returns: frame_, resolved_ or target_
+  std::unique_ptr<TGAImage> resolved_;
+  const TGAImage *output_ = nullptr;
+
+  // image of the caller the output goes to when it fits, see set_target();
+  // color_ is what passes draw on this frame, frame_ or target_, and
+  // color_pixels_ the storage the tile clear flags are about
+  TGAImage *target_ = nullptr;
+  TGAImage *color_ = nullptr;
+  const unsigned char *color_pixels_ = nullptr;
+
+  // images of sizes or formats not in use right now, kept so switching back
+  // and forth between sizes doesn't allocate
+  std::vector<std::unique_ptr<TGAImage>> image_pool_;
+
+  // size the buffers have, options_ may have changed since
+  int width_ = 0;
+  int height_ = 0;
+
+  // the frame as a window of a larger image, see set_window(); full sizes
+  // are 0 when the frame is the whole image
+  int window_x_ = 0;
+  int window_y_ = 0;
+  int full_width_ = 0;
+  int full_height_ = 0;
+  bool in_frame_ = false;
+
+  // lazy clears of frame_ and zbuffer_: a dirty tile holds drawings of an
+  // older frame, and is only cleared once per frame, by the first pass
+  // touching it, begin_frame() just resets the cleared flags
+  std::vector<unsigned char> tile_dirty_;
+  std::vector<unsigned char> tile_cleared_;
+
+  // texture maps, shared with the texture cache and other rasterizers
+  Texture diffusemap_;
+  Texture normalmap_;
+  Texture specularmap_;
+
+  // view and object placement
+  Camera camera_;
+  Mat4f model_matrix_;
+
+  // per frame work buffers, kept to reuse their memory: vertex stage output,
+  // then per binning chunk and per tile the faces touching the tile, in
+  // submission order
+  VertexBuffer verts_;
+  std::vector<std::vector<int>> bins_;
+  int bin_chunks_ = 0;
+  int tiles_x_ = 0;
+  int tiles_y_ = 0;
+
+  // color and depth buffers of the sort-last mode, but for the first face
+  // range which is drawn straight into frame_ and zbuffer_
+  struct Layer {
+    std::unique_ptr<TGAImage> frame;
+    AlignedBuffer<float> zbuf;
+  };
+  std::vector<Layer> layers_;
+
+  // mvp cache, each part is recomputed only once its inputs changed and the
+  // product once any part did; mvp_raw_ is the copy vertices are moved with
   Mat4f v_trans;
   Mat4f p_trans;
   Mat4f viewport;
-  bool is_mvp_calc = false;
+  Mat4f mvp_;
+  float mvp_raw_[4][4];
+  bool view_dirty_ = true;
+  bool proj_dirty_ = true;
+  bool mvp_dirty_ = true;
+  int depth_ = 0;
 
 public:
   // constructors
@@ -59,21 +187,64 @@ public:
   ~Rasterizer() noexcept;
 
   // getter/setter
-  Mat4f get_mvp() const noexcept;
+  const Mat4f &get_mvp() noexcept;
   void bind_model(Model *model) noexcept;
-  void bind_texture(TGAImage &texture, ShadingType type) noexcept;
+  void bind_model(ModelHandle model) noexcept;
+  void bind_texture(TextureHandle texture, ShadingType type) noexcept;
+  void bind_texture(BlockHandle texture, ShadingType type) noexcept;
+  void bind_maps(const TextureMaps &maps) noexcept;
   void bind_options(RenderOptions &options) noexcept;
-
-  // functions
+  const TGAImage &get_frame() const noexcept { return *output_; }
+  int output_format() const noexcept;
+  void set_target(TGAImage *target) noexcept;
+  const Overdraw *get_overdraw() const noexcept { return overdraw_.get(); }
+  void resize(int width, int height) noexcept;
+  void set_window(int x, int y, int full_width, int full_height) noexcept;
+
+  // camera and model matrix, cheap to call every frame for animations
+  const Camera &get_camera() const noexcept { return camera_; }
+  void set_camera(const Camera &camera) noexcept;
+  void look_at(Vec3f position, Vec3f target,
+               Vec3f up = Vec3f(0, 1, 0)) noexcept;
+  void set_perspective(float fov, float near, float far) noexcept;
+  const Mat4f &get_model_matrix() const noexcept { return model_matrix_; }
+  void set_model_matrix(const Mat4f &matrix) noexcept;
+
+  // frame loop: draw() renders the bound model into the current frame, so
+  // several models can share a frame; render() is one frame of one model
+  void begin_frame() noexcept;
+  void draw() noexcept;
+  void end_frame() noexcept;
   void render() noexcept;
-  void save_frame(std::string filename) noexcept;
+  bool save_frame(std::string filename) noexcept;
 
 private:
-  void calc_mvp() noexcept;
+  void update_mvp() noexcept;
+  Texture *texture_slot(ShadingType type) noexcept;
+
+  void reshape() noexcept;
+  std::unique_ptr<TGAImage> acquire_image(int bpp) noexcept;
+  void recycle_image(std::unique_ptr<TGAImage> image) noexcept;
+  Rect tile_rect(int tile) const noexcept;
+  void clear_tile(int tile) noexcept;
+  void clear_tiles() noexcept;
+  void mark_tiles_dirty() noexcept;
+  bool target_fits(int bpp) const noexcept;
 
   void render_wireframe() noexcept;
   void render_zbufgray() noexcept;
   void render_triangle() noexcept;
+  void resolve_zbufgray() noexcept;
+  void resolve_overdraw() noexcept;
+
+  void process_vertices(bool attributes) noexcept;
+  void rasterize(bool textured) noexcept;
+  void draw_face(Triangle &triangle, int iface, bool textured, TGAImage &frame,
+                 float *zbuf) noexcept;
+  void bin_faces() noexcept;
+  void draw_tiles(bool textured) noexcept;
+  void draw_layers(bool textured) noexcept;
+  void merge_layers() noexcept;
 };
 
 #endif // __RASTERIZER_H__
\ No newline at end of file
@@ -0,0 +1,334 @@
+#include "server.h"
+#include "protocol.h"
+#include "rasterizer.h"
+#include "trace.h"
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// largest frame side a request may ask for
+const int max_side = 16384;
+
+// how long a reply waits for a client that stopped reading, the other
+// connections are on hold meanwhile
+const int write_timeout_ms = 2000;
+
+volatile sig_atomic_t stopping = 0;
+
+void on_signal(int) { stopping = 1; }
+
+/**
+ * @brief Write exactly size bytes to a non-blocking socket, waiting while
+ * the client drains it. A closed peer fails instead of raising SIGPIPE.
+ *
+ * @return true if everything was written, false on errors or once the
+ * client read nothing for write_timeout_ms
+ */
+bool write_full(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd out{fd, POLLOUT, 0};
+      int ready = poll(&out, 1, write_timeout_ms);
+      if (ready < 0 && errno == EINTR)
+        continue;
+      if (ready <= 0 || !(out.revents & POLLOUT))
+        return false;
+      continue;
+    }
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Check the camera of a request: finite values, and with a
+ * perspective projection a field of view below 180 degrees and planes with
+ * 0 < near < far
+ *
+ * @return true if the projection the camera gives is finite
+ */
+bool valid_camera(const protocol::Request &req) {
+  for (int i = 0; i < 3; i++)
+    if (!std::isfinite(req.position[i]) || !std::isfinite(req.target[i]) ||
+        !std::isfinite(req.up[i]))
+      return false;
+  if (!std::isfinite(req.fov) || !std::isfinite(req.near) ||
+      !std::isfinite(req.far))
+    return false;
+  return req.fov <= 0 || (req.fov < 180 && req.near > 0 && req.far > req.near);
+}
+
+} // namespace
+
+RenderServer::Connection::~Connection() noexcept {
+  if (shm)
+    munmap(shm, shm_size);
+  if (fd >= 0)
+    close(fd);
+}
+
+/**
+ * @brief Construct a server, nothing is listened to before listen()
+ *
+ * @param defaults options of the fields requests don't carry (depth,
+ * compressed textures)
+ * @param setup binds the resident assets to every new rasterizer
+ */
+RenderServer::RenderServer(const RenderOptions &defaults, Setup setup) noexcept
+    : defaults_(defaults), setup_(std::move(setup)) {}
+
+RenderServer::~RenderServer() noexcept {
+  connections_.clear();
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(path_.c_str());
+  }
+}
+
+/**
+ * @brief Bind the socket, a stale socket file at the path is replaced
+ *
+ * @param socket_path file system path of the Unix socket
+ * @return true if the server is listening
+ */
+bool RenderServer::listen(const std::string &socket_path) noexcept {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Error: socket path too long " << socket_path << std::endl;
+    return false;
+  }
+  memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    std::cerr << "Error: can't create socket: " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  unlink(socket_path.c_str());
+  if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      ::listen(listen_fd_, 16) != 0) {
+    std::cerr << "Error: can't listen on " << socket_path << ": "
+              << strerror(errno) << std::endl;
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  path_ = socket_path;
+  return true;
+}
+
+/**
+ * @brief Serve requests until SIGINT, SIGTERM or stop()
+ *
+ * @return int 0, or 1 if the server isn't listening
+ */
+int RenderServer::run() noexcept {
+  if (listen_fd_ < 0)
+    return 1;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal; // no SA_RESTART, poll() has to return
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  std::cerr << "# server: listening on " << path_ << std::endl;
+
+  std::vector<pollfd> fds;
+  while (!stopping) {
+    fds.assign(1, pollfd{listen_fd_, POLLIN, 0});
+    for (const auto &conn : connections_)
+      fds.push_back(pollfd{conn->fd, POLLIN, 0});
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "Error: poll failed: " << strerror(errno) << std::endl;
+      break;
+    }
+    // connections first, fds[i + 1] is connections_[i] until one closes
+    for (size_t i = connections_.size(); i-- > 0;) {
+      if (fds[i + 1].revents == 0)
+        continue;
+      if (!(fds[i + 1].revents & POLLIN) || !receive(*connections_[i]))
+        connections_.erase(connections_.begin() + i);
+    }
+    if (fds[0].revents & POLLIN)
+      accept_connection();
+  }
+  std::cerr << "# server: " << frames_ << " frames served" << std::endl;
+  return 0;
+}
+
+/**
+ * @brief Make run() return, safe from a signal handler
+ *
+ */
+void RenderServer::stop() noexcept { stopping = 1; }
+
+void RenderServer::accept_connection() noexcept {
+  // non-blocking so a client sending half a request can't stall the others
+  int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (fd < 0)
+    return;
+  auto conn = std::make_unique<Connection>();
+  conn->fd = fd;
+  conn->options = defaults_;
+  conn->rst = std::make_unique<Rasterizer>(conn->options);
+  setup_(*conn->rst);
+  connections_.push_back(std::move(conn));
+}
+
+/**
+ * @brief Map the client segment the pixels go to, the mapping is kept while
+ * the client keeps asking for the same segment and it's large enough
+ *
+ * @param conn connection asking
+ * @param name shm_open() name
+ * @param bytes frame size
+ * @return true if the segment can hold the frame
+ */
+bool RenderServer::map_shm(Connection &conn, const char *name,
+                           size_t bytes) noexcept {
+  if (conn.shm && conn.shm_name == name && conn.shm_size >= bytes)
+    return true;
+  if (conn.shm) {
+    munmap(conn.shm, conn.shm_size);
+    conn.shm = nullptr;
+    conn.shm_size = 0;
+  }
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= bytes)
+    addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+  conn.shm = addr;
+  conn.shm_size = st.st_size;
+  conn.shm_name = name;
+  return true;
+}
+
+/**
+ * @brief Read what a connection sent into its request, which is served once
+ * complete. Requests may arrive in any number of pieces.
+ *
+ * @param conn readable connection
+ * @return false once the connection has to be closed
+ */
+bool RenderServer::receive(Connection &conn) noexcept {
+  char *p = reinterpret_cast<char *>(&conn.request);
+  while (conn.received < sizeof(conn.request)) {
+    ssize_t n =
+        read(conn.fd, p + conn.received, sizeof(conn.request) - conn.received);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true; // the rest comes later
+    if (n <= 0)
+      return false;
+    conn.received += n;
+  }
+  conn.received = 0;
+  return serve(conn);
+}
+
+/**
+ * @brief Answer the request a connection has received
+ *
+ * @param conn connection with a complete request
+ * @return false once the connection has to be closed
+ */
+bool RenderServer::serve(Connection &conn) noexcept {
+  protocol::Request &req = conn.request;
+  TR_TRACE("request", "server");
+
+  protocol::Reply reply;
+  req.shm_name[sizeof(req.shm_name) - 1] = '\0';
+  if (req.magic != protocol::request_magic ||
+      req.version != protocol::version || req.width <= 0 ||
+      req.width > max_side || req.height <= 0 || req.height > max_side ||
+      req.mode < RenderingMode::WIREFRAME ||
+      req.mode > RenderingMode::OVERDRAW ||
+      req.parallel < ParallelMode::TILES ||
+      req.parallel > ParallelMode::SORT_LAST || !valid_camera(req)) {
+    reply.status = protocol::BAD_REQUEST;
+    // a wrong magic means the stream is out of sync, drop the client
+    return write_full(conn.fd, &reply, sizeof(reply)) &&
+           req.magic == protocol::request_magic;
+  }
+
+  RenderOptions &options = conn.options;
+  options.width = req.width;
+  options.height = req.height;
+  options.mode = (RenderingMode)req.mode;
+  options.shadingmode = req.shadingmode;
+  options.parallel = (ParallelMode)req.parallel;
+  Camera camera;
+  camera.position = Vec3f(req.position[0], req.position[1], req.position[2]);
+  camera.target = Vec3f(req.target[0], req.target[1], req.target[2]);
+  camera.up = Vec3f(req.up[0], req.up[1], req.up[2]);
+  camera.fov = req.fov;
+  camera.near = req.near;
+  camera.far = req.far;
+  conn.rst->set_camera(camera);
+
+  // the frame size follows from the request, a segment that can't hold it
+  // is turned down before rendering for nothing
+  uint64_t bytes =
+      (uint64_t)options.width * options.height * conn.rst->output_format();
+  if ((req.flags & protocol::REPLY_SHM) &&
+      !map_shm(conn, req.shm_name, bytes)) {
+    reply.status = protocol::BAD_SHM;
+    return write_full(conn.fd, &reply, sizeof(reply));
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  conn.rst->render();
+  reply.render_us = std::chrono::duration<float, std::micro>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count();
+
+  const TGAImage &frame = conn.rst->get_frame();
+  reply.width = frame.get_width();
+  reply.height = frame.get_height();
+  reply.bytespp = frame.get_bytespp();
+  reply.origin = frame.get_origin();
+  reply.bytes = (uint64_t)reply.width * reply.height * reply.bytespp;
+  reply.frame = ++frames_;
+
+  if (req.flags & protocol::REPLY_SHM) {
+    memcpy(conn.shm, frame.buffer(), reply.bytes);
+    reply.flags = protocol::REPLY_SHM;
+    return write_full(conn.fd, &reply, sizeof(reply));
+  }
+  return write_full(conn.fd, &reply, sizeof(reply)) &&
+         write_full(conn.fd, frame.buffer(), reply.bytes);
+}
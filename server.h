@@ -0,0 +1,64 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "protocol.h"
+#include "rasterizer.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Render daemon: keeps the model and textures resident and renders requests
+// (camera, mode, resolution, see protocol.h) coming over a Unix socket, so
+// a frame costs a render and no process startup or asset parsing. Every
+// connection owns a rasterizer whose buffers are reused from one request to
+// the next. Connections are served one request at a time on the calling
+// thread, rendering itself runs on the job system. Sockets are non-blocking:
+// a request is only served once all of it arrived, and a client that stops
+// reading its reply is dropped after a timeout.
+class RenderServer {
+public:
+  // binds the resident model and textures to a new rasterizer
+  typedef std::function<void(Rasterizer &)> Setup;
+
+private:
+  struct Connection {
+    int fd = -1;
+    // request being received, served once all its bytes are in
+    protocol::Request request;
+    size_t received = 0;
+    RenderOptions options;
+    std::unique_ptr<Rasterizer> rst;
+    // client segment the last shm reply went to, kept mapped
+    std::string shm_name;
+    void *shm = nullptr;
+    size_t shm_size = 0;
+
+    ~Connection() noexcept;
+  };
+
+  RenderOptions defaults_;
+  Setup setup_;
+  std::string path_;
+  int listen_fd_ = -1;
+  unsigned int frames_ = 0;
+  std::vector<std::unique_ptr<Connection>> connections_;
+
+  void accept_connection() noexcept;
+  bool receive(Connection &conn) noexcept;
+  bool serve(Connection &conn) noexcept;
+  bool map_shm(Connection &conn, const char *name, size_t bytes) noexcept;
+
+public:
+  RenderServer(const RenderOptions &defaults, Setup setup) noexcept;
+  RenderServer(const RenderServer &) = delete;
+  RenderServer &operator=(const RenderServer &) = delete;
+  ~RenderServer() noexcept;
+
+  bool listen(const std::string &socket_path) noexcept;
+  int run() noexcept;
+  static void stop() noexcept;
+};
+
+#endif // __SERVER_H__
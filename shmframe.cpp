@@ -0,0 +1,206 @@
+#include "shmframe.h"
+#include "tgaimage.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// slots start page aligned, and are page multiples
+const size_t page = 4096;
+
+size_t round_up(size_t bytes) { return (bytes + page - 1) / page * page; }
+
+// "/name" is a POSIX shared memory object, any other path a file
+int open_region(const std::string &name, int flags) {
+  if (!name.empty() && name[0] == '/' &&
+      name.find('/', 1) == std::string::npos)
+    return shm_open(name.c_str(), flags, 0644);
+  return open(name.c_str(), flags | O_CLOEXEC, 0644);
+}
+
+} // namespace
+
+SharedFrame::~SharedFrame() noexcept {
+  back_ = TGAImage();
+  if (region_)
+    munmap(region_, size_);
+}
+
+/**
+ * @brief Create (or take over) the region and size its slots for frames of
+ * up to width * height pixels of 4 bytes. The region stays after the writer
+ * is gone, so readers can still look at the last frame.
+ *
+ * @param name '/name' for POSIX shared memory, else a file path
+ * @param width height largest frame size
+ * @return true if the region is mapped
+ */
+bool SharedFrame::create(const std::string &name, int width,
+                         int height) noexcept {
+  size_t slot_bytes = round_up(size_t(width) * height * TGAImage::RGBA);
+  size_t size = page + slot_count * slot_bytes;
+  int fd = open_region(name, O_RDWR | O_CREAT);
+  if (fd < 0 || ftruncate(fd, size) != 0) {
+    std::cerr << "Error: can't create shared frame " << name << ": "
+              << strerror(errno) << std::endl;
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "Error: can't map shared frame " << name << std::endl;
+    return false;
+  }
+  region_ = static_cast<unsigned char *>(addr);
+  size_ = size;
+  name_ = name;
+
+  header_ = new (region_) SharedFrameHeader();
+  header_->version = version;
+  header_->slots = slot_count;
+  header_->slot_bytes = slot_bytes;
+  header_->offset = page;
+  header_->seq.store(0, std::memory_order_relaxed);
+  header_->slot = slot_count - 1; // the first frame goes to slot 0
+  header_->frame = 0;
+  // readers ignore the region until the magic is there
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = magic;
+  return true;
+}
+
+/**
+ * @brief Image over the slot the next frame goes to, hand it to
+ * Rasterizer::set_target() so the frame is rendered in place
+ *
+ * @param width height bpp frame size and format
+ * @return TGAImage* slot image, nullptr if the frame doesn't fit a slot
+ */
+TGAImage *SharedFrame::target(int width, int height, int bpp) noexcept {
+  if (!header_ || size_t(width) * height * bpp > header_->slot_bytes)
+    return nullptr;
+  uint32_t back = (header_->slot + 1) % slot_count;
+  unsigned char *pixels =
+      region_ + header_->offset + back * header_->slot_bytes;
+  if (back_.buffer() != pixels || back_.get_width() != width ||
+      back_.get_height() != height || back_.get_bytespp() != bpp)
+    back_.wrap(pixels, width, height, bpp, TGAImage::BOTTOM_LEFT);
+  return &back_;
+}
+
+/**
+ * @brief Make a frame the one readers get. A frame rendered into target()
+ * is published as is, any other is copied into the free slot first.
+ *
+ * @param frame frame to publish
+ * @return true unless the frame is larger than a slot
+ */
+bool SharedFrame::publish(const TGAImage &frame) noexcept {
+  size_t bytes = size_t(frame.get_width()) * frame.get_height() *
+                 frame.get_bytespp();
+  if (!header_ || !frame.buffer() || bytes > header_->slot_bytes)
+    return false;
+  uint32_t back = (header_->slot + 1) % slot_count;
+  unsigned char *pixels =
+      region_ + header_->offset + back * header_->slot_bytes;
+  if (frame.buffer() != pixels)
+    memcpy(pixels, frame.buffer(), bytes);
+
+  uint32_t seq = header_->seq.load(std::memory_order_relaxed);
+  header_->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->slot = back;
+  header_->frame++;
+  header_->width = frame.get_width();
+  header_->height = frame.get_height();
+  header_->bytespp = frame.get_bytespp();
+  header_->origin = frame.get_origin();
+  header_->seq.store(seq + 2, std::memory_order_release);
+  return true;
+}
+
+SharedFrameReader::~SharedFrameReader() noexcept {
+  if (region_)
+    munmap(const_cast<unsigned char *>(region_), size_);
+}
+
+/**
+ * @brief Map the region of a writer, read-only
+ *
+ * @param name name given to SharedFrame::create()
+ * @return true if it holds a shared frame region
+ */
+bool SharedFrameReader::open(const std::string &name) noexcept {
+  int fd = open_region(name, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SharedFrameHeader))
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+  region_ = static_cast<const unsigned char *>(addr);
+  size_ = st.st_size;
+  header_ = reinterpret_cast<const SharedFrameHeader *>(region_);
+  if (header_->magic != SharedFrame::magic ||
+      header_->version != SharedFrame::version ||
+      header_->offset + header_->slots * header_->slot_bytes > size_) {
+    munmap(addr, size_);
+    region_ = nullptr;
+    header_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Copy the latest frame if it is newer than a given one. Retries
+ * while the writer publishes meanwhile, without ever blocking it.
+ *
+ * @param image receives the frame, reallocated on size or format changes
+ * @param after frame number already seen
+ * @return uint64_t number of the frame read, 0 if none is newer than after
+ */
+uint64_t SharedFrameReader::read(TGAImage &image, uint64_t after) noexcept {
+  if (!header_)
+    return 0;
+  for (;;) {
+    uint32_t seq = header_->seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint64_t frame = header_->frame;
+    uint32_t slot = header_->slot;
+    int width = header_->width, height = header_->height;
+    int bpp = header_->bytespp;
+    TGAImage::Origin origin = (TGAImage::Origin)header_->origin;
+    size_t bytes = size_t(width) * height * bpp;
+    bool valid = frame > after && slot < header_->slots && width > 0 &&
+                 height > 0 && bytes <= header_->slot_bytes;
+    if (valid) {
+      if (image.get_width() != width || image.get_height() != height ||
+          image.get_bytespp() != bpp || image.get_origin() != origin ||
+          image.is_mapped())
+        image = TGAImage(width, height, bpp, origin);
+      memcpy(image.buffer(),
+             region_ + header_->offset + slot * header_->slot_bytes, bytes);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->seq.load(std::memory_order_relaxed) == seq)
+      return valid ? frame : 0;
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef __SHMFRAME_H__
+#define __SHMFRAME_H__
+
+#include "tgaimage.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Frames published in shared memory for consumers on the same machine, no
+// file and no TGA encoding in between. The region starts with a header,
+// followed by two pixel slots: the renderer draws into the slot readers
+// aren't looking at (see Rasterizer::set_target()), then publish() flips
+// it in under a seqlock. Names like "/name" are POSIX shared memory
+// (shm_open, under /dev/shm), other names are paths of memory-mapped files.
+
+struct SharedFrameHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t reserved;
+  uint64_t slot_bytes; // capacity of a slot
+  uint64_t offset;     // of the first slot from the region start
+
+  // seqlock: odd while the writer changes the fields below, readers copy
+  // the fields and the pixels, then retry if it changed meanwhile
+  std::atomic<uint32_t> seq;
+  uint32_t slot; // slot of the published frame
+  uint64_t frame; // frames published so far, 0 for none
+  int32_t width;
+  int32_t height;
+  int32_t bytespp;
+  int32_t origin; // TGAImage::Origin
+};
+
+class SharedFrame {
+private:
+  SharedFrameHeader *header_ = nullptr;
+  unsigned char *region_ = nullptr;
+  size_t size_ = 0;
+  std::string name_;
+  TGAImage back_; // wraps the slot not published
+
+public:
+  static const uint32_t magic = 0x42465254; // "TRFB"
+  static const uint32_t version = 1;
+  static const int slot_count = 2;
+
+  SharedFrame() = default;
+  SharedFrame(const SharedFrame &) = delete;
+  SharedFrame &operator=(const SharedFrame &) = delete;
+  ~SharedFrame() noexcept;
+
+  bool create(const std::string &name, int width, int height) noexcept;
+  TGAImage *target(int width, int height, int bpp) noexcept;
+  bool publish(const TGAImage &frame) noexcept;
+  uint64_t frames() const noexcept { return header_ ? header_->frame : 0; }
+};
+
+class SharedFrameReader {
+private:
+  const SharedFrameHeader *header_ = nullptr;
+  const unsigned char *region_ = nullptr;
+  size_t size_ = 0;
+
+public:
+  SharedFrameReader() = default;
+  SharedFrameReader(const SharedFrameReader &) = delete;
+  SharedFrameReader &operator=(const SharedFrameReader &) = delete;
+  ~SharedFrameReader() noexcept;
+
+  bool open(const std::string &name) noexcept;
+  uint64_t read(TGAImage &image, uint64_t after = 0) noexcept;
+};
+
+#endif // __SHMFRAME_H__
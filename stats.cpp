@@ -0,0 +1,262 @@
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace stats {
+
+namespace {
+
+const char *stage_names[STAGE_NUM] = {
+    "transform", "assembly", "raster", "shading", "depth", "resolve", "save",
+};
+
+const char *counter_names[COUNTER_NUM] = {
+    "vertices_transformed", "triangles_submitted", "triangles_culled",
+    "fragments_tested",     "fragments_passed",    "texels_fetched",
+};
+
+// live per-thread stats, and what threads left behind when exiting
+struct Registry {
+  std::mutex mutex;
+  std::vector<ThreadStats *> threads;
+  Totals retired;
+};
+
+Registry &registry() noexcept {
+  static Registry *reg = new Registry(); // never destroyed, threads may outlive
+  return *reg;
+}
+
+void merge(Totals &into, const Totals &from) noexcept {
+  for (int i = 0; i < STAGE_NUM; i++) {
+    into.ticks[i] += from.ticks[i];
+    into.calls[i] += from.calls[i];
+    for (int e = 0; e < perf::EVENT_NUM; e++)
+      into.events[i][e] += from.events[i][e];
+  }
+  for (int i = 0; i < COUNTER_NUM; i++)
+    into.counters[i] += from.counters[i];
+}
+
+// reference points for converting ticks to milliseconds
+const uint64_t epoch_ticks = now();
+const std::chrono::steady_clock::time_point epoch_time =
+    std::chrono::steady_clock::now();
+
+double ms_per_tick() noexcept {
+  auto elapsed = std::chrono::steady_clock::now() - epoch_time;
+  if (elapsed < std::chrono::milliseconds(10)) {
+    // too short to calibrate, wait a bit
+    std::this_thread::sleep_for(std::chrono::milliseconds(10) - elapsed);
+    elapsed = std::chrono::steady_clock::now() - epoch_time;
+  }
+  uint64_t ticks = now() - epoch_ticks;
+  double ms = std::chrono::duration<double, std::milli>(elapsed).count();
+  return ticks ? ms / ticks : 0.0;
+}
+
+// which events the counters of the first thread could open
+bool perf_valid[perf::EVENT_NUM] = {};
+
+} // namespace
+
+std::atomic<bool> perf_enabled(false);
+
+ThreadStats::ThreadStats() noexcept : since(now()) {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  reg.threads.push_back(this);
+}
+
+ThreadStats::~ThreadStats() noexcept {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  merge(reg.retired, *this);
+  reg.threads.erase(std::remove(reg.threads.begin(), reg.threads.end(), this),
+                    reg.threads.end());
+}
+
+/**
+ * @brief Charge hardware counter deltas since the last switch to the current
+ * stage, opening the counters of this thread on first call
+ *
+ */
+void ThreadStats::sample_perf() noexcept {
+  if (!perf_opened) {
+    perf_opened = true;
+    perf = std::make_unique<perf::Counters>();
+    if (!perf->available())
+      perf.reset();
+    else
+      perf->read(perf_last);
+    return;
+  }
+  if (!perf)
+    return;
+  uint64_t values[perf::EVENT_NUM];
+  perf->read(values);
+  for (int e = 0; e < perf::EVENT_NUM; e++) {
+    events[current][e] += values[e] - perf_last[e];
+    perf_last[e] = values[e];
+  }
+}
+
+/**
+ * @brief Turn on hardware counters for every stage scope. Counters are per
+ * thread, each thread opens its own on its first scope.
+ *
+ * @return true if the calling thread could open at least one counter
+ */
+bool enable_perf() noexcept {
+  perf::Counters probe;
+  if (!probe.available()) {
+    std::cerr << "# perf: counters unavailable, " << probe.error() << "\n";
+    return false;
+  }
+  if (!probe.error().empty())
+    std::cerr << "# perf: some counters unavailable, " << probe.error()
+              << "\n";
+  for (int e = 0; e < perf::EVENT_NUM; e++)
+    perf_valid[e] = probe.has((perf::Event)e);
+  perf_enabled = true;
+  return true;
+}
+
+/**
+ * @brief Get the stats of the calling thread
+ *
+ * @return ThreadStats& thread local accumulator
+ */
+ThreadStats &local() noexcept {
+  thread_local ThreadStats stats;
+  return stats;
+}
+
+const char *stage_name(Stage stage) noexcept {
+  return stage < STAGE_NUM ? stage_names[stage] : "none";
+}
+
+const char *counter_name(Counter counter) noexcept {
+  return counter < COUNTER_NUM ? counter_names[counter] : "none";
+}
+
+/**
+ * @brief Merge the stats of every thread, should be called while workers are
+ * idle (e.g. after render() returned)
+ *
+ * @return Report merged times and counters
+ */
+Report report() noexcept {
+  Totals total;
+  Registry &reg = registry();
+  {
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    merge(total, reg.retired);
+    for (const ThreadStats *thread : reg.threads)
+      merge(total, *thread);
+  }
+  Report res;
+  double scale = ms_per_tick();
+  res.perf = perf_enabled;
+  for (int i = 0; i < STAGE_NUM; i++) {
+    res.ms[i] = total.ticks[i] * scale;
+    res.calls[i] = total.calls[i];
+    for (int e = 0; e < perf::EVENT_NUM; e++) {
+      res.events[i].values[e] = total.events[i][e];
+      res.events[i].valid[e] = res.perf && perf_valid[e];
+    }
+    res.events[i].all_threads = true;
+  }
+  for (int i = 0; i < COUNTER_NUM; i++)
+    res.counters[i] = total.counters[i];
+  return res;
+}
+
+/**
+ * @brief Zero the stats of every thread
+ *
+ */
+void reset() noexcept {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  for (ThreadStats *thread : reg.threads)
+    static_cast<Totals &>(*thread) = Totals();
+  reg.retired = Totals();
+}
+
+/**
+ * @brief Print a human readable report
+ *
+ * @param out stream to print on, usually std::cerr
+ */
+void print(std::ostream &out) noexcept {
+  if (!enabled()) {
+    out << "# stats: not compiled in, rebuild with 'make STATS=1'\n";
+    return;
+  }
+  Report res = report();
+  double total = 0;
+  for (int i = 0; i < STAGE_NUM; i++)
+    total += res.ms[i];
+  out << "# stage          time(ms)   share     calls\n";
+  for (int i = 0; i < STAGE_NUM; i++) {
+    out << "  " << std::left << std::setw(12) << stage_names[i] << std::right
+        << std::fixed << std::setprecision(3) << std::setw(11) << res.ms[i]
+        << std::setprecision(1) << std::setw(7)
+        << (total > 0 ? res.ms[i] * 100.0 / total : 0.0) << "%"
+        << std::setw(10) << res.calls[i] << "\n";
+  }
+  out << "  " << std::left << std::setw(12) << "total" << std::right
+      << std::setprecision(3) << std::setw(11) << total << "\n";
+  out << "# counter\n";
+  for (int i = 0; i < COUNTER_NUM; i++)
+    out << "  " << std::left << std::setw(22) << counter_names[i] << std::right
+        << std::setw(12) << res.counters[i] << "\n";
+  out.unsetf(std::ios::floatfield);
+  if (res.perf)
+    for (int i = 0; i < STAGE_NUM; i++)
+      if (res.calls[i])
+        perf::print(out, stage_names[i], res.events[i]);
+}
+
+/**
+ * @brief Dump the report as json
+ *
+ * @param filename json file to write
+ * @return true if written
+ */
+bool write_json(const char *filename) noexcept {
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  Report res = report();
+  out << "{\n  \"enabled\": " << (enabled() ? "true" : "false") << ",\n"
+      << "  \"stages\": {\n";
+  for (int i = 0; i < STAGE_NUM; i++) {
+    out << "    \"" << stage_names[i] << "\": {\"ms\": " << std::fixed
+        << std::setprecision(4) << res.ms[i]
+        << ", \"calls\": " << res.calls[i];
+    if (res.perf) {
+      out << ", \"perf\": ";
+      perf::print_json(out, res.events[i]);
+    }
+    out << "}" << (i + 1 < STAGE_NUM ? "," : "") << "\n";
+  }
+  out << "  },\n  \"counters\": {\n";
+  for (int i = 0; i < COUNTER_NUM; i++)
+    out << "    \"" << counter_names[i] << "\": " << res.counters[i]
+        << (i + 1 < COUNTER_NUM ? "," : "") << "\n";
+  out << "  }\n}\n";
+  return out.good();
+}
+
+} // namespace stats
@@ -0,0 +1,161 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "perf.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Pipeline instrumentation: exclusive time spent per stage and event counters.
+// Scopes and counters are recorded through the TR_STAGE()/TR_COUNT() macros,
+// which compile to nothing unless TR_STATS is defined (make STATS=1), so the
+// hot loops pay nothing in regular builds. With enable_perf(), hardware
+// counters are sampled on every stage switch as well.
+
+namespace stats {
+
+enum Stage {
+  TRANSFORM,
+  ASSEMBLY,
+  RASTER,
+  SHADING,
+  DEPTH,
+  RESOLVE,
+  SAVE,
+  STAGE_NUM,
+  NO_STAGE = STAGE_NUM,
+};
+
+enum Counter {
+  VERTICES_TRANSFORMED,
+  TRIANGLES_SUBMITTED,
+  TRIANGLES_CULLED,
+  FRAGMENTS_TESTED,
+  FRAGMENTS_PASSED,
+  TEXELS_FETCHED,
+  COUNTER_NUM,
+};
+
+struct Totals {
+  uint64_t ticks[STAGE_NUM + 1] = {}; // last slot is time outside any stage
+  uint64_t calls[STAGE_NUM] = {};
+  uint64_t counters[COUNTER_NUM] = {};
+  uint64_t events[STAGE_NUM + 1][perf::EVENT_NUM] = {};
+};
+
+// per-thread accumulator, merged by report()
+struct ThreadStats : Totals {
+  Stage current = NO_STAGE;
+  uint64_t since = 0;
+
+  // hardware counters of this thread, opened on first use once enabled
+  std::unique_ptr<perf::Counters> perf;
+  uint64_t perf_last[perf::EVENT_NUM] = {};
+  bool perf_opened = false;
+
+  ThreadStats() noexcept;
+  ~ThreadStats() noexcept;
+
+  void sample_perf() noexcept;
+};
+
+struct Report {
+  double ms[STAGE_NUM] = {};
+  uint64_t calls[STAGE_NUM] = {};
+  uint64_t counters[COUNTER_NUM] = {};
+  bool perf = false;
+  perf::Sample events[STAGE_NUM];
+};
+
+extern std::atomic<bool> perf_enabled;
+
+constexpr bool enabled() noexcept {
+#ifdef TR_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Cheap timestamp, cpu cycles where available
+ *
+ * @return uint64_t ticks
+ */
+inline uint64_t now() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+ThreadStats &local() noexcept;
+
+inline void count(Counter counter, uint64_t n) noexcept {
+  local().counters[counter] += n;
+}
+
+// charges the time spent inside the scope to a stage, nested scopes are
+// subtracted from their parent so every stage reports exclusive time
+class ScopedStage {
+private:
+  ThreadStats &stats_;
+  Stage parent_;
+
+public:
+  explicit ScopedStage(Stage stage) noexcept
+      : stats_(local()), parent_(stats_.current) {
+    uint64_t t = now();
+    stats_.ticks[parent_] += t - stats_.since;
+    stats_.since = t;
+    if (perf_enabled.load(std::memory_order_relaxed))
+      stats_.sample_perf();
+    stats_.current = stage;
+    stats_.calls[stage]++;
+  }
+  ~ScopedStage() noexcept {
+    uint64_t t = now();
+    stats_.ticks[stats_.current] += t - stats_.since;
+    stats_.since = t;
+    if (perf_enabled.load(std::memory_order_relaxed))
+      stats_.sample_perf();
+    stats_.current = parent_;
+  }
+  ScopedStage(const ScopedStage &) = delete;
+  ScopedStage &operator=(const ScopedStage &) = delete;
+};
+
+const char *stage_name(Stage stage) noexcept;
+const char *counter_name(Counter counter) noexcept;
+
+bool enable_perf() noexcept;
+Report report() noexcept;
+void reset() noexcept;
+void print(std::ostream &out) noexcept;
+bool write_json(const char *filename) noexcept;
+
+} // namespace stats
+
+#define TR_STATS_CONCAT_(a, b) a##b
+#define TR_STATS_CONCAT(a, b) TR_STATS_CONCAT_(a, b)
+
+#ifdef TR_STATS
+#define TR_STAGE(stage)                                                        \
+  stats::ScopedStage TR_STATS_CONCAT(tr_stage_, __LINE__)(stats::stage)
+#define TR_COUNT(counter, n) stats::count(stats::counter, (n))
+#else
+#define TR_STAGE(stage) ((void)0)
+#define TR_COUNT(counter, n) ((void)0)
+#endif
+
+#endif // __STATS_H__
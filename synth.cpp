@@ -0,0 +1,237 @@
+#include "synth.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace synth {
+
+namespace {
+
+const float pi = 3.14159265f;
+const float sqrt3 = 1.7320508f;
+
+// the rasterizer maps [-1, 1] onto the central 3/4 of the frame
+float pixels_per_unit(int width) noexcept { return width * 3.f / 8.f; }
+
+// mean area of a triangle whose edge is size * exp(spread * N(0, 1))
+float mean_area(float size, float spread) noexcept {
+  return sqrt3 / 4.f * size * size * std::exp(2.f * spread * spread);
+}
+
+} // namespace
+
+/**
+ * @brief Parse a "key=value,key=value" scene spec, keys being triangles,
+ * size, spread, overdraw, texture, width and seed
+ *
+ * @param spec spec string, e.g. "triangles=1e6,spread=0.5,overdraw=4"
+ * @param params parameters to update
+ * @return false on unknown keys or bad values
+ */
+bool parse(const std::string &spec, SceneParams &params) noexcept {
+  std::istringstream in(spec);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    size_t eq = item.find('=');
+    if (eq == std::string::npos) {
+      std::cerr << "Error: expected key=value in scene spec, got " << item
+                << "\n";
+      return false;
+    }
+    std::string key = item.substr(0, eq);
+    const char *value = item.c_str() + eq + 1;
+    char *end = nullptr;
+    double number = std::strtod(value, &end);
+    if (end == value || *end != '\0' || number < 0) {
+      std::cerr << "Error: bad value for " << key << " in scene spec\n";
+      return false;
+    }
+    if (key == "triangles")
+      params.triangles = (long long)number;
+    else if (key == "size")
+      params.size = number;
+    else if (key == "spread")
+      params.spread = number;
+    else if (key == "overdraw")
+      params.overdraw = number;
+    else if (key == "texture")
+      params.texture_size = (int)number;
+    else if (key == "width")
+      params.width = (int)number;
+    else if (key == "seed")
+      params.seed = (uint32_t)number;
+    else {
+      std::cerr << "Error: unknown key " << key << " in scene spec\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Build a scene. Two of triangles, size and overdraw pick the third:
+ * with triangles or size left at 0 the soup covers the whole viewport at the
+ * given overdraw, with both set the region shrinks to honour the overdraw
+ * (and the overdraw grows once the region would exceed the viewport).
+ *
+ * @param params scene parameters
+ * @return Scene model, textures and the resolved parameters
+ */
+Scene generate(const SceneParams &params) noexcept {
+  Scene scene;
+  float ppu = pixels_per_unit(params.width);
+  float full = 4.f * ppu * ppu; // viewport area in pixels
+  float overdraw = std::max(params.overdraw, 0.01f);
+  float size = params.size;
+  long long triangles = params.triangles;
+  float region = full;
+
+  if (triangles <= 0) {
+    if (size <= 0)
+      size = 8;
+    triangles = llround(overdraw * full / mean_area(size, params.spread));
+  } else if (size <= 0) {
+    size = std::sqrt(overdraw * full / triangles /
+                     mean_area(1.f, params.spread));
+  } else {
+    region =
+        std::min(full, triangles * mean_area(size, params.spread) / overdraw);
+  }
+  triangles = std::clamp<long long>(triangles, 1, INT_MAX / 3);
+
+  scene.triangles = triangles;
+  scene.size = size;
+  scene.coverage = region / full;
+  scene.overdraw = triangles * mean_area(size, params.spread) / region;
+
+  // flat triangles at random depths, uvs projected from the xy plane
+  std::mt19937 rng(params.seed);
+  std::uniform_real_distribution<float> unit(-0.5f, 0.5f);
+  std::uniform_real_distribution<float> angle(0.f, 2.f * pi);
+  std::normal_distribution<float> normal(0.f, 1.f);
+  float extent = std::sqrt(region) / ppu; // side of the region, in units
+
+  auto model = std::make_unique<Model>();
+  model->reserve(int(triangles * 3), int(triangles));
+  int vn = model->add_normal(Vec3f(0, 0, 1));
+  for (long long t = 0; t < triangles; t++) {
+    // one draw per statement, argument evaluation order is up to the compiler
+    float x = unit(rng) * extent;
+    float y = unit(rng) * extent;
+    float z = unit(rng);
+    Vec3f center(x, y, z);
+    float edge = size * std::exp(params.spread * normal(rng)) / ppu;
+    float radius = edge / sqrt3;
+    float theta = angle(rng);
+    int vi[3], vni[3] = {vn, vn, vn};
+    for (int k = 0; k < 3; k++) {
+      float a = theta + k * 2.f * pi / 3.f;
+      Vec3f v(center.x + radius * std::cos(a), center.y + radius * std::sin(a),
+              center.z);
+      vi[k] = model->add_vertex(v);
+      model->add_uv(Vec2f(v.x * 0.5f + 0.5f, v.y * 0.5f + 0.5f));
+    }
+    model->add_face(vi, vi, vni, 3); // uvs are stored like the vertices
+  }
+  scene.model = std::move(model);
+
+  if (params.texture_size > 0) {
+    scene.diffuse = make_texture(params.texture_size, TGAImage::RGB,
+                                 params.seed);
+    scene.normal = make_texture(params.texture_size, TGAImage::RGBA,
+                                params.seed + 1);
+    scene.specular = make_texture(params.texture_size, TGAImage::GRAYSCALE,
+                                  params.seed + 2);
+  }
+  return scene;
+}
+
+/**
+ * @brief Procedural texture: a tinted checkerboard for rgb, a bumpy tangent
+ * normal map for rgba and a smooth ramp for grayscale
+ *
+ * @param size width and height
+ * @param bpp bytes per pixel (TGAImage::Format)
+ * @param seed varies the pattern
+ * @return std::unique_ptr<TGAImage> bottom-left texture
+ */
+std::unique_ptr<TGAImage> make_texture(int size, int bpp,
+                                       uint32_t seed) noexcept {
+  auto image = std::make_unique<TGAImage>(size, size, bpp,
+                                          TGAImage::BOTTOM_LEFT);
+  int cell = std::max(1, size / 16);
+  float phase = (seed % 97) / 97.f * 2.f * pi;
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      float u = float(x) / size, v = float(y) / size;
+      TGAColor color;
+      if (bpp == TGAImage::RGB) {
+        bool dark = ((x / cell) + (y / cell)) & 1;
+        unsigned char base = dark ? 60 : 200;
+        color = TGAColor(base, (unsigned char)(base * u + 30),
+                         (unsigned char)(base * v + 30), 255);
+      } else if (bpp == TGAImage::RGBA) {
+        float nx = 0.3f * std::sin(u * 8.f * pi + phase);
+        float ny = 0.3f * std::sin(v * 8.f * pi + phase);
+        color = TGAColor((unsigned char)(127.5f * (nx + 1.f)),
+                         (unsigned char)(127.5f * (ny + 1.f)), 255, 255);
+      } else {
+        color = TGAColor((unsigned char)(255.f * (0.5f + 0.5f * std::sin(
+                                                           u * pi + phase))),
+                         1);
+      }
+      image->set_pixel(x, y, color);
+    }
+  }
+  return image;
+}
+
+/**
+ * @brief Save a model as a wavefront .obj in the layout Model reads back
+ *
+ * @param model model to save
+ * @param filename .obj file to write
+ * @return true on success
+ */
+bool write_obj(const Model &model, const char *filename) noexcept {
+  FILE *file = std::fopen(filename, "w");
+  if (!file) {
+    std::cerr << "Error: can't write " << filename << "\n";
+    return false;
+  }
+  for (int i = 0; i < model.v_num(); i++) {
+    Vec3f v = model.getv(i);
+    std::fprintf(file, "v %g %g %g\n", v.x, v.y, v.z);
+  }
+  for (int i = 0; i < model.vt_num(); i++) {
+    Vec2f vt = model.getvt(i);
+    std::fprintf(file, "vt  %g %g 0\n", vt.x, vt.y);
+  }
+  for (int i = 0; i < model.vn_num(); i++) {
+    Vec3f vn = model.getvn(i);
+    std::fprintf(file, "vn  %g %g %g\n", vn.x, vn.y, vn.z);
+  }
+  for (int i = 0; i < model.f_num(); i++) {
+    std::vector<int> vi = model.getf_vi(i), vti = model.getf_vti(i),
+                     vni = model.getf_vni(i);
+    std::fputc('f', file);
+    for (size_t k = 0; k < vi.size(); k++)
+      std::fprintf(file, " %d/%d/%d", vi[k] + 1, vti[k] + 1, vni[k] + 1);
+    std::fputc('\n', file);
+  }
+  bool ok = !std::ferror(file);
+  return std::fclose(file) == 0 && ok;
+}
+
+void print(std::ostream &out, const Scene &scene) noexcept {
+  out << "# synth: " << scene.triangles << " triangles, median edge "
+      << scene.size << " px, " << scene.coverage * 100.f
+      << "% of the viewport at overdraw " << scene.overdraw << "\n";
+}
+
+} // namespace synth
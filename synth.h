@@ -0,0 +1,51 @@
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+#include "model.h"
+#include "texcache.h"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// Synthetic scenes for stress benchmarks: a soup of flat, randomly rotated
+// triangles facing the camera, with controlled count, edge length
+// distribution and depth complexity, plus procedural textures. Sizes are in
+// pixels of a frame of the given width under the rasterizer's default camera,
+// which is close enough to chart scaling curves.
+
+namespace synth {
+
+struct SceneParams {
+  long long triangles = 100000; // 0 to derive it from size and overdraw
+  float size = 0;               // median edge in pixels, 0 to derive it
+  float spread = 0;             // log-normal sigma of the edge length
+  float overdraw = 1;           // depth complexity over the covered region
+  int texture_size = 1024;      // square textures, 0 for none
+  int width = 1080;             // frame width the sizes refer to
+  uint32_t seed = 1;
+};
+
+struct Scene {
+  std::unique_ptr<Model> model; // release() into Rasterizer::bind_model()
+  TextureHandle diffuse;
+  TextureHandle normal;
+  TextureHandle specular;
+
+  // what the parameters resolved to
+  long long triangles = 0;
+  float size = 0;
+  float coverage = 0; // fraction of the viewport the region covers
+  float overdraw = 0;
+};
+
+bool parse(const std::string &spec, SceneParams &params) noexcept;
+Scene generate(const SceneParams &params) noexcept;
+std::unique_ptr<TGAImage> make_texture(int size, int bpp,
+                                       uint32_t seed) noexcept;
+bool write_obj(const Model &model, const char *filename) noexcept;
+void print(std::ostream &out, const Scene &scene) noexcept;
+
+} // namespace synth
+
+#endif // __SYNTH_H__
@@ -0,0 +1,172 @@
+#include "texcache.h"
+#include "texture.h"
+#include "tgaimage.h"
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+
+/**
+ * @brief Get the cache shared by the whole process
+ *
+ * @return TextureCache& the cache
+ */
+TextureCache &TextureCache::instance() noexcept {
+  static TextureCache cache;
+  return cache;
+}
+
+/**
+ * @brief Get the texture stored at path, loading it on first use. Uncompressed
+ * files are mapped in place, others are decoded once.
+ *
+ * @param path tga file path, used as the cache key
+ * @return TextureHandle shared texture, nullptr if it can't be loaded
+ */
+TextureHandle TextureCache::load(const std::string &path) {
+  if (TextureHandle cached = find(path))
+    return cached;
+
+  // decode outside of the lock so that different assets load concurrently
+  std::shared_ptr<TGAImage> image = std::make_shared<TGAImage>();
+  if (!image->map_tga_file(path.c_str())) {
+    std::cerr << "Error: Can't load texture from " << path << std::endl;
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // somebody may have loaded the same file meanwhile, keep the first one
+  auto res = entries_.emplace(path, std::move(image));
+  return res.first->second;
+}
+
+/**
+ * @brief Look up a texture without loading it
+ *
+ * @param path tga file path
+ * @return TextureHandle shared texture, nullptr if not cached
+ */
+TextureHandle TextureCache::find(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(path);
+  return it == entries_.end() ? nullptr : it->second;
+}
+
+/**
+ * @brief Get the block compressed copy of the texture at path. The copy is
+ * read from "<path>.blk" when that file is up to date, otherwise it's built
+ * from the source image and written there for the next run. The decoded
+ * source is not kept unless somebody loaded it through load().
+ *
+ * @param path tga file path, used as the cache key
+ * @return BlockHandle shared compressed texture, nullptr if it can't be loaded
+ */
+BlockHandle TextureCache::load_blocks(const std::string &path) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = block_entries_.find(path);
+    if (it != block_entries_.end())
+      return it->second;
+  }
+
+  std::string blockpath = path + ".blk";
+  struct stat src_st, block_st;
+  bool fresh = stat(blockpath.c_str(), &block_st) == 0 &&
+               (stat(path.c_str(), &src_st) != 0 ||
+                block_st.st_mtime >= src_st.st_mtime);
+  BlockHandle blocks;
+  if (fresh) {
+    auto cached = std::make_shared<BlockImage>();
+    if (cached->read_file(blockpath.c_str()))
+      blocks = std::move(cached);
+  }
+  if (!blocks) {
+    TextureHandle image = find(path);
+    if (!image) {
+      auto source = std::make_shared<TGAImage>();
+      if (!source->map_tga_file(path.c_str())) {
+        std::cerr << "Error: Can't load texture from " << path << std::endl;
+        return nullptr;
+      }
+      image = std::move(source);
+    }
+    blocks = BlockImage::compress(*image);
+    if (!blocks)
+      return nullptr;
+    blocks->write_file(blockpath.c_str());
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto res = block_entries_.emplace(path, std::move(blocks));
+  return res.first->second;
+}
+
+size_t TextureCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size() + block_entries_.size();
+}
+
+/**
+ * @brief Count heap bytes of the decoded textures and block compressed copies
+ *
+ * @return size_t bytes
+ */
+size_t TextureCache::resident_bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0;
+  for (const auto &entry : entries_) {
+    const TGAImage &image = *entry.second;
+    if (!image.is_mapped())
+      bytes += (size_t)image.get_width() * image.get_height() *
+               image.get_bytespp();
+  }
+  for (const auto &entry : block_entries_)
+    bytes += entry.second->size_bytes();
+  return bytes;
+}
+
+/**
+ * @brief Count pixel bytes of the mapped textures, they live in the page
+ * cache and are shared with other processes mapping the same files
+ *
+ * @return size_t bytes
+ */
+size_t TextureCache::mapped_bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0;
+  for (const auto &entry : entries_) {
+    const TGAImage &image = *entry.second;
+    if (image.is_mapped())
+      bytes += (size_t)image.get_width() * image.get_height() *
+               image.get_bytespp();
+  }
+  return bytes;
+}
+
+/**
+ * @brief Drop the textures nobody but the cache holds anymore
+ *
+ * @return size_t number of evicted textures
+ */
+size_t TextureCache::evict_unused() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t evicted = 0;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.use_count() == 1) {
+      it = entries_.erase(it);
+      evicted++;
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = block_entries_.begin(); it != block_entries_.end();) {
+    if (it->second.use_count() == 1) {
+      it = block_entries_.erase(it);
+      evicted++;
+    } else {
+      ++it;
+    }
+  }
+  return evicted;
+}
@@ -0,0 +1,45 @@
+#ifndef __TEXCACHE_H__
+#define __TEXCACHE_H__
+
+#include "tgaimage.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class BlockImage;
+
+// shared, immutable texture, alive as long as somebody holds a handle
+typedef std::shared_ptr<const TGAImage> TextureHandle;
+typedef std::shared_ptr<const BlockImage> BlockHandle;
+
+// Process wide texture cache keyed by file path, every asset is decoded (or
+// mapped) once and the same copy is handed out to all the rasterizers.
+// Block compressed copies are cached the same way, and persisted next to the
+// source file as "<path>.blk".
+class TextureCache {
+private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, TextureHandle> entries_;
+  std::unordered_map<std::string, BlockHandle> block_entries_;
+
+  TextureCache() = default;
+
+public:
+  TextureCache(const TextureCache &) = delete;
+  TextureCache &operator=(const TextureCache &) = delete;
+
+  static TextureCache &instance() noexcept;
+
+  TextureHandle load(const std::string &path);
+  TextureHandle find(const std::string &path);
+  BlockHandle load_blocks(const std::string &path);
+
+  size_t size();
+  size_t resident_bytes();
+  size_t mapped_bytes();
+  size_t evict_unused();
+};
+
+#endif // __TEXCACHE_H__
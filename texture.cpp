@@ -0,0 +1,364 @@
+#include "texture.h"
+#include "tgaimage.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+namespace {
+
+const char block_magic[4] = {'B', 'L', 'K', 'T'};
+const uint32_t block_version = 1;
+
+#pragma pack(push, 1)
+struct BlockFileHeader {
+  char magic[4];
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  int32_t bytespp;
+};
+#pragma pack(pop)
+
+// decoded blocks kept per thread, direct mapped
+const int block_cache_slots = 128;
+struct BlockCacheSlot {
+  uint64_t tag; // (image id << 32 | block index), 0 when empty
+  uint8_t texels[16 * 4];
+};
+thread_local BlockCacheSlot block_cache[block_cache_slots];
+
+std::atomic<uint64_t> next_block_image_id(1);
+
+inline uint16_t pack565(const float *c) {
+  int c2 = std::clamp((int)std::lround(c[2] * 31.0f / 255.0f), 0, 31);
+  int c1 = std::clamp((int)std::lround(c[1] * 63.0f / 255.0f), 0, 63);
+  int c0 = std::clamp((int)std::lround(c[0] * 31.0f / 255.0f), 0, 31);
+  return (uint16_t)(c2 << 11 | c1 << 5 | c0);
+}
+
+inline void unpack565(uint16_t v, int *c) {
+  int c2 = (v >> 11) & 0x1f, c1 = (v >> 5) & 0x3f, c0 = v & 0x1f;
+  c[2] = (c2 << 3) | (c2 >> 2);
+  c[1] = (c1 << 2) | (c1 >> 4);
+  c[0] = (c0 << 3) | (c0 >> 2);
+}
+
+/**
+ * @brief Build the 4 color palette of a color block from its endpoints
+ */
+inline void color_palette(uint16_t e0, uint16_t e1, int palette[4][3]) {
+  unpack565(e0, palette[0]);
+  unpack565(e1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+}
+
+/**
+ * @brief Encode the first 3 channels of a 4x4 block, endpoints are picked at
+ * the extremes of the principal axis of the block colors
+ *
+ * @param px 16 texels of 4 channels each
+ * @param out 8 bytes of output
+ */
+void encode_color_block(const uint8_t px[16][4], uint8_t *out) {
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 3; c++)
+      mean[c] += px[i][c] / 16.0f;
+
+  float cov[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float d[3] = {px[i][0] - mean[0], px[i][1] - mean[1], px[i][2] - mean[2]};
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+
+  // power iteration for the principal axis
+  float axis[3] = {1, 1, 1};
+  for (int it = 0; it < 8; it++) {
+    float n[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                  cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                  cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len < 1e-6f)
+      break;
+    for (int c = 0; c < 3; c++)
+      axis[c] = n[c] / len;
+  }
+
+  float tmin = 1e30f, tmax = -1e30f;
+  for (int i = 0; i < 16; i++) {
+    float t = 0;
+    for (int c = 0; c < 3; c++)
+      t += (px[i][c] - mean[c]) * axis[c];
+    tmin = std::min(tmin, t);
+    tmax = std::max(tmax, t);
+  }
+  float hi[3], lo[3];
+  for (int c = 0; c < 3; c++) {
+    hi[c] = mean[c] + axis[c] * tmax;
+    lo[c] = mean[c] + axis[c] * tmin;
+  }
+  uint16_t e0 = pack565(hi), e1 = pack565(lo);
+  // e0 > e1 selects the 4 color mode, equal endpoints mean a flat block
+  if (e0 < e1)
+    std::swap(e0, e1);
+
+  uint32_t indices = 0;
+  if (e0 != e1) {
+    int palette[4][3];
+    color_palette(e0, e1, palette);
+    for (int i = 0; i < 16; i++) {
+      int best = 0, best_dist = 1 << 30;
+      for (int k = 0; k < 4; k++) {
+        int dist = 0;
+        for (int c = 0; c < 3; c++) {
+          int d = px[i][c] - palette[k][c];
+          dist += d * d;
+        }
+        if (dist < best_dist) {
+          best_dist = dist;
+          best = k;
+        }
+      }
+      indices |= (uint32_t)best << (2 * i);
+    }
+  }
+  memcpy(out, &e0, 2);
+  memcpy(out + 2, &e1, 2);
+  memcpy(out + 4, &indices, 4);
+}
+
+void decode_color_block(const uint8_t *in, uint8_t *texels) {
+  uint16_t e0, e1;
+  uint32_t indices;
+  memcpy(&e0, in, 2);
+  memcpy(&e1, in + 2, 2);
+  memcpy(&indices, in + 4, 4);
+  int palette[4][3];
+  color_palette(e0, e1, palette);
+  for (int i = 0; i < 16; i++) {
+    int k = (indices >> (2 * i)) & 0x3;
+    for (int c = 0; c < 3; c++)
+      texels[i * 4 + c] = palette[k][c];
+  }
+}
+
+/**
+ * @brief Build the 8 level palette of a single channel block
+ */
+inline void alpha_palette(uint8_t a0, uint8_t a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  for (int k = 1; k < 7; k++)
+    palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+}
+
+/**
+ * @brief Encode a single channel of a 4x4 block between its min and max
+ *
+ * @param px 16 texels of 4 channels each
+ * @param channel channel to encode
+ * @param out 8 bytes of output
+ */
+void encode_alpha_block(const uint8_t px[16][4], int channel, uint8_t *out) {
+  uint8_t a0 = 0, a1 = 255;
+  for (int i = 0; i < 16; i++) {
+    a0 = std::max(a0, px[i][channel]);
+    a1 = std::min(a1, px[i][channel]);
+  }
+  uint64_t indices = 0;
+  if (a0 != a1) {
+    int palette[8];
+    alpha_palette(a0, a1, palette);
+    for (int i = 0; i < 16; i++) {
+      int best = 0, best_dist = 1 << 30;
+      for (int k = 0; k < 8; k++) {
+        int dist = std::abs(px[i][channel] - palette[k]);
+        if (dist < best_dist) {
+          best_dist = dist;
+          best = k;
+        }
+      }
+      indices |= (uint64_t)best << (3 * i);
+    }
+  }
+  out[0] = a0;
+  out[1] = a1;
+  memcpy(out + 2, &indices, 6); // little endian, 48 bits of indices
+}
+
+void decode_alpha_block(const uint8_t *in, int channel, uint8_t *texels) {
+  uint64_t indices = 0;
+  memcpy(&indices, in + 2, 6);
+  int palette[8];
+  alpha_palette(in[0], in[1], palette);
+  for (int i = 0; i < 16; i++)
+    texels[i * 4 + channel] = palette[(indices >> (3 * i)) & 0x7];
+}
+
+} // namespace
+
+BlockImage::BlockImage() noexcept : id_(next_block_image_id++) {}
+
+void BlockImage::init(int w, int h, int bpp) noexcept {
+  width_ = w;
+  height_ = h;
+  bytespp_ = bpp;
+  blocks_x_ = (w + 3) / 4;
+  blocks_y_ = (h + 3) / 4;
+  block_bytes_ = bpp == TGAImage::RGBA ? 16 : 8;
+  blocks_.assign((size_t)blocks_x_ * blocks_y_ * block_bytes_, 0);
+}
+
+/**
+ * @brief Compress an image into 4x4 blocks, edge blocks repeat the border
+ * texels
+ *
+ * @param image source image, any origin
+ * @return std::shared_ptr<const BlockImage> compressed copy, nullptr if image
+ * is empty
+ */
+std::shared_ptr<const BlockImage>
+BlockImage::compress(const TGAImage &image) noexcept {
+  int w = image.get_width(), h = image.get_height();
+  if (w <= 0 || h <= 0)
+    return nullptr;
+  auto result = std::make_shared<BlockImage>();
+  result->init(w, h, image.get_bytespp());
+
+  uint8_t px[16][4];
+  for (int by = 0; by < result->blocks_y_; by++) {
+    for (int bx = 0; bx < result->blocks_x_; bx++) {
+      for (int i = 0; i < 16; i++) {
+        int x = std::min(bx * 4 + (i & 3), w - 1);
+        int y = std::min(by * 4 + (i >> 2), h - 1);
+        TGAColor c = image.get_texel(x, y);
+        memcpy(px[i], c.raw, 4);
+      }
+      uint8_t *out = result->blocks_.data() +
+                     ((size_t)by * result->blocks_x_ + bx) *
+                         result->block_bytes_;
+      switch (result->bytespp_) {
+      case TGAImage::GRAYSCALE:
+        encode_alpha_block(px, 0, out);
+        break;
+      case TGAImage::RGB:
+        encode_color_block(px, out);
+        break;
+      case TGAImage::RGBA:
+        encode_alpha_block(px, 3, out);
+        encode_color_block(px, out + 8);
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+void BlockImage::decode_block(int index, uint8_t *texels) const noexcept {
+  const uint8_t *in = blocks_.data() + (size_t)index * block_bytes_;
+  switch (bytespp_) {
+  case TGAImage::GRAYSCALE:
+    decode_alpha_block(in, 0, texels);
+    break;
+  case TGAImage::RGB:
+    decode_color_block(in, texels);
+    break;
+  case TGAImage::RGBA:
+    decode_alpha_block(in, 3, texels);
+    decode_color_block(in + 8, texels);
+    break;
+  }
+}
+
+/**
+ * @brief Fetch a texel, decoding its block unless the thread has it cached
+ *
+ * @param x column
+ * @param y row counted from the bottom
+ * @return TGAColor texel, empty color if out of the image
+ */
+TGAColor BlockImage::get_texel(int x, int y) const noexcept {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_)
+    return TGAColor();
+  int index = (y >> 2) * blocks_x_ + (x >> 2);
+  uint64_t tag = id_ << 32 | (uint32_t)index;
+  BlockCacheSlot &slot =
+      block_cache[(index + id_ * 37) & (block_cache_slots - 1)];
+  if (slot.tag != tag) {
+    decode_block(index, slot.texels);
+    slot.tag = tag;
+  }
+  return TGAColor(slot.texels + ((y & 3) * 4 + (x & 3)) * 4, bytespp_);
+}
+
+/**
+ * @brief Load blocks from a cache file written by write_file()
+ *
+ * @param filename cache file
+ * @return true if loaded
+ */
+bool BlockImage::read_file(const char *filename) noexcept {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open())
+    return false;
+  BlockFileHeader header;
+  in.read((char *)&header, sizeof(header));
+  if (!in.good() || memcmp(header.magic, block_magic, 4) != 0 ||
+      header.version != block_version || header.width <= 0 ||
+      header.height <= 0 ||
+      (header.bytespp != TGAImage::GRAYSCALE &&
+       header.bytespp != TGAImage::RGB && header.bytespp != TGAImage::RGBA)) {
+    std::cerr << "bad block texture file " << filename << "\n";
+    return false;
+  }
+  init(header.width, header.height, header.bytespp);
+  in.read((char *)blocks_.data(), blocks_.size());
+  if (!in.good()) {
+    std::cerr << "an error occured while reading the blocks\n";
+    blocks_.clear();
+    width_ = height_ = 0;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Store blocks into a cache file, so that the next run can skip
+ * decoding and compressing the source image
+ *
+ * @param filename cache file
+ * @return true if written
+ */
+bool BlockImage::write_file(const char *filename) const noexcept {
+  std::ofstream out(filename, std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  BlockFileHeader header;
+  memcpy(header.magic, block_magic, 4);
+  header.version = block_version;
+  header.width = width_;
+  header.height = height_;
+  header.bytespp = bytespp_;
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)blocks_.data(), blocks_.size());
+  if (!out.good()) {
+    std::cerr << "can't dump the block file\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,73 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include "texcache.h"
+#include "tgaimage.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Block compressed image, texels are packed by 4x4 blocks in the spirit of
+// BC1 (rgb, 8 bytes/block), BC3 (rgba, 16 bytes/block) and BC4 (grayscale, 8
+// bytes/block). Blocks are decoded on fetch through a small per-thread cache.
+// Rows are stored in texture space, row 0 being the bottom of the image.
+class BlockImage {
+private:
+  std::vector<uint8_t> blocks_;
+  int width_ = 0;
+  int height_ = 0;
+  int bytespp_ = 0;
+  int blocks_x_ = 0;
+  int blocks_y_ = 0;
+  int block_bytes_ = 0;
+  uint64_t id_ = 0; // unique tag for the decoded-block cache
+
+  void init(int w, int h, int bpp) noexcept;
+  void decode_block(int index, uint8_t *texels) const noexcept;
+
+public:
+  BlockImage() noexcept;
+
+  static std::shared_ptr<const BlockImage>
+  compress(const TGAImage &image) noexcept;
+  bool read_file(const char *filename) noexcept;
+  bool write_file(const char *filename) const noexcept;
+
+  TGAColor get_texel(int x, int y) const noexcept;
+  int get_width() const noexcept { return width_; }
+  int get_height() const noexcept { return height_; }
+  int get_bytespp() const noexcept { return bytespp_; }
+  size_t size_bytes() const noexcept { return blocks_.size(); }
+};
+
+// Texture as bound to the rasterizer, either the plain shared pixels or their
+// block compressed copy, which is sampled instead when present.
+struct Texture {
+  TextureHandle image;
+  BlockHandle blocks;
+
+  explicit operator bool() const noexcept { return image || blocks; }
+
+  int get_width() const noexcept {
+    return blocks ? blocks->get_width() : image ? image->get_width() : 0;
+  }
+  int get_height() const noexcept {
+    return blocks ? blocks->get_height() : image ? image->get_height() : 0;
+  }
+
+  /**
+   * @brief Fetch a texel, row 0 is the bottom row of the texture
+   *
+   * @param x column
+   * @param y row counted from the bottom
+   * @return TGAColor texel, empty color if out of the texture
+   */
+  TGAColor get_texel(int x, int y) const noexcept {
+    if (blocks)
+      return blocks->get_texel(x, y);
+    return image ? image->get_texel(x, y) : TGAColor();
+  }
+};
+
+#endif // __TEXTURE_H__
@@ -1,59 +1,182 @@
 #include "tgaimage.h"
+#include "jobs.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <math.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {}
+TGAImage::TGAImage()
+    : data(NULL), width(0), height(0), bytespp(0), origin(TOP_LEFT) {}
 
-TGAImage::TGAImage(int w, int h, int bpp)
-    : data(NULL), width(w), height(h), bytespp(bpp) {
+TGAImage::TGAImage(int w, int h, int bpp, Origin o)
+    : data(NULL), width(w), height(h), bytespp(bpp), origin(o) {
   unsigned long nbytes = width * height * bytespp;
   data = new unsigned char[nbytes];
   memset(data, 0, nbytes);
 }
 
-TGAImage::TGAImage(const TGAImage &img) {
-  width = img.width;
-  height = img.height;
-  bytespp = img.bytespp;
-  unsigned long nbytes = width * height * bytespp;
-  data = new unsigned char[nbytes];
-  memcpy(data, img.data, nbytes);
-}
+TGAImage::TGAImage(const TGAImage &img) : data(NULL) { *this = img; }
 
-TGAImage::~TGAImage() {
-  if (data)
+TGAImage::~TGAImage() { release(); }
+
+/**
+ * @brief Drop pixel storage, unmapping the file if this was the last image
+ * referring to it
+ *
+ */
+void TGAImage::release() {
+  if (mapping)
+    mapping.reset();
+  else if (data && !borrowed)
     delete[] data;
+  data = NULL;
+  borrowed = false;
 }
 
 TGAImage &TGAImage::operator=(const TGAImage &img) {
   if (this != &img) {
-    if (data)
-      delete[] data;
+    release();
     width = img.width;
     height = img.height;
     bytespp = img.bytespp;
-    unsigned long nbytes = width * height * bytespp;
-    data = new unsigned char[nbytes];
-    memcpy(data, img.data, nbytes);
+    origin = img.origin;
+    if (img.mapping) {
+      // mapped pixels are read-only, so copies just share the mapping
+      mapping = img.mapping;
+      data = img.data;
+    } else if (img.data) {
+      unsigned long nbytes = width * height * bytespp;
+      data = new unsigned char[nbytes];
+      memcpy(data, img.data, nbytes);
+    }
   }
   return *this;
 }
 
+namespace {
+
+const unsigned char tga_developer_area_ref[4] = {0, 0, 0, 0};
+const unsigned char tga_extension_area_ref[4] = {0, 0, 0, 0};
+const unsigned char tga_footer[18] = {'T', 'R', 'U', 'E', 'V', 'I',
+                                      'S', 'I', 'O', 'N', '-', 'X',
+                                      'F', 'I', 'L', 'E', '.', '\0'};
+
+/**
+ * @brief Decode RLE packets from a memory block, pixel size known at compile
+ * time so that the copies below turn into plain moves
+ *
+ * @return consumed bytes of src, 0 if the stream is broken
+ */
+template <int BPP>
+unsigned long rle_decode(const unsigned char *src, unsigned long srclen,
+                         unsigned char *dst, unsigned long pixelcount) {
+  const unsigned char *in = src;
+  const unsigned char *in_end = src + srclen;
+  unsigned long currentpixel = 0;
+  while (currentpixel < pixelcount) {
+    if (in >= in_end) {
+      std::cerr << "an error occured while reading the data\n";
+      return 0;
+    }
+    unsigned char chunkheader = *in++;
+    unsigned long count = (chunkheader & 0x7f) + 1;
+    if (currentpixel + count > pixelcount) {
+      std::cerr << "Too many pixels read\n";
+      return 0;
+    }
+    if (chunkheader < 128) {
+      // raw packet, one copy for the whole chunk
+      unsigned long nbytes = count * BPP;
+      if ((unsigned long)(in_end - in) < nbytes) {
+        std::cerr << "an error occured while reading the data\n";
+        return 0;
+      }
+      memcpy(dst, in, nbytes);
+      in += nbytes;
+      dst += nbytes;
+    } else {
+      // run-length packet, replicate a single pixel
+      if (in_end - in < BPP) {
+        std::cerr << "an error occured while reading the data\n";
+        return 0;
+      }
+      if (BPP == 1) {
+        memset(dst, *in, count);
+        dst += count;
+      } else {
+        for (unsigned long i = 0; i < count; i++, dst += BPP)
+          memcpy(dst, in, BPP);
+      }
+      in += BPP;
+    }
+    currentpixel += count;
+  }
+  return in - src;
+}
+
+/**
+ * @brief Encode pixels into RLE packets starting at out, which must have room
+ * for the worst case. The packet layout is the same as the old stream based
+ * encoder produced, so outputs stay byte-identical.
+ *
+ * @return end of the encoded packets
+ */
+template <int BPP>
+unsigned char *rle_encode(const unsigned char *data, unsigned long npixels,
+                          unsigned char *out) {
+  const unsigned long max_chunk_length = 128;
+  unsigned long curpix = 0;
+  while (curpix < npixels) {
+    const unsigned char *chunk = data + curpix * BPP;
+    unsigned long limit = std::min(max_chunk_length, npixels - curpix);
+    unsigned long run_length = 1;
+    bool raw = true;
+    if (limit > 1) {
+      raw = memcmp(chunk, chunk + BPP, BPP) != 0;
+      if (raw) {
+        // extend raw packet until two successive pixels are equal
+        while (run_length < limit &&
+               (run_length + 1 >= limit ||
+                memcmp(chunk + run_length * BPP,
+                       chunk + (run_length + 1) * BPP, BPP) != 0))
+          run_length++;
+      } else {
+        run_length = 2;
+        while (run_length < limit &&
+               memcmp(chunk, chunk + run_length * BPP, BPP) == 0)
+          run_length++;
+      }
+    }
+    curpix += run_length;
+    *out++ = raw ? run_length - 1 : run_length + 127;
+    unsigned long nbytes = raw ? run_length * BPP : BPP;
+    memcpy(out, chunk, nbytes);
+    out += nbytes;
+  }
+  return out;
+}
+
+} // namespace
+
 bool TGAImage::read_tga_file(const char *filename) {
-  if (data)
-    delete[] data;
-  data = NULL;
+  release();
 
   std::ifstream in;
-  in.open(filename, std::ios::binary);
+  in.open(filename, std::ios::binary | std::ios::ate);
   if (!in.is_open()) {
     std::cerr << "can't open file " << filename << "\n";
     in.close();
     return false;
   }
+  unsigned long filesize = in.tellg();
+  in.seekg(0, std::ios::beg);
   TGA_Header header;
   in.read((char *)&header, sizeof(header));
   if (!in.good()) {
@@ -70,6 +193,7 @@ bool TGAImage::read_tga_file(const char *filename) {
     std::cerr << "bad bpp (or width/height) value\n";
     return false;
   }
+  in.seekg((unsigned char)header.idlength, std::ios::cur);
   unsigned long nbytes = bytespp * width * height;
   data = new unsigned char[nbytes];
   if (3 == header.datatypecode || 2 == header.datatypecode) {
@@ -80,7 +204,12 @@ bool TGAImage::read_tga_file(const char *filename) {
       return false;
     }
   } else if (10 == header.datatypecode || 11 == header.datatypecode) {
-    if (!load_rle_data(in)) {
+    // slurp the rest of the file in one read and decode from memory
+    unsigned long offset = sizeof(header) + (unsigned char)header.idlength;
+    std::vector<unsigned char> rledata(filesize > offset ? filesize - offset
+                                                         : 0);
+    in.read((char *)rledata.data(), rledata.size());
+    if (in.bad() || !load_rle_data(rledata.data(), in.gcount())) {
       in.close();
       std::cerr << "an error occured while reading the data\n";
       return false;
@@ -90,9 +219,8 @@ bool TGAImage::read_tga_file(const char *filename) {
     std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
     return false;
   }
-  if (!(header.imagedescriptor & 0x20)) {
-    flip_vertically();
-  }
+  // rows are kept in file order, the origin flag tells how to address them
+  origin = (header.imagedescriptor & 0x20) ? TOP_LEFT : BOTTOM_LEFT;
   if (header.imagedescriptor & 0x10) {
     flip_horizontally();
   }
@@ -104,60 +232,107 @@ bool TGAImage::read_tga_file(const char *filename) {
   return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-  unsigned long pixelcount = width * height;
-  unsigned long currentpixel = 0;
-  unsigned long currentbyte = 0;
-  TGAColor colorbuffer;
-  do {
-    unsigned char chunkheader = 0;
-    chunkheader = in.get();
-    if (!in.good()) {
-      std::cerr << "an error occured while reading the data\n";
-      return false;
-    }
-    if (chunkheader < 128) {
-      chunkheader++;
-      for (int i = 0; i < chunkheader; i++) {
-        in.read((char *)colorbuffer.raw, bytespp);
-        if (!in.good()) {
-          std::cerr << "an error occured while reading the header\n";
-          return false;
-        }
-        for (int t = 0; t < bytespp; t++)
-          data[currentbyte++] = colorbuffer.raw[t];
-        currentpixel++;
-        if (currentpixel > pixelcount) {
-          std::cerr << "Too many pixels read\n";
-          return false;
-        }
-      }
-    } else {
-      chunkheader -= 127;
-      in.read((char *)colorbuffer.raw, bytespp);
-      if (!in.good()) {
-        std::cerr << "an error occured while reading the header\n";
-        return false;
-      }
-      for (int i = 0; i < chunkheader; i++) {
-        for (int t = 0; t < bytespp; t++)
-          data[currentbyte++] = colorbuffer.raw[t];
-        currentpixel++;
-        if (currentpixel > pixelcount) {
-          std::cerr << "Too many pixels read\n";
-          return false;
-        }
-      }
-    }
-  } while (currentpixel < pixelcount);
+/**
+ * @brief Map an uncompressed TGA file read-only and use the pixels in place,
+ * without any copy. Rows are kept in file order and the origin flag tells how
+ * to address them. Files that can't be used in place (RLE, mirrored) are
+ * loaded with read_tga_file() instead.
+ *
+ * @param filename TGA file to map
+ * @return true if the image was mapped or loaded
+ */
+bool TGAImage::map_tga_file(const char *filename) {
+  release();
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  struct stat st;
+  TGA_Header header;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+    close(fd);
+    std::cerr << "an error occured while reading the header\n";
+    return false;
+  }
+  int w = header.width, h = header.height, bpp = header.bitsperpixel >> 3;
+  unsigned long offset = sizeof(header) + (unsigned char)header.idlength;
+  bool in_place = (2 == header.datatypecode || 3 == header.datatypecode) &&
+                  0 == header.colormaptype &&
+                  !(header.imagedescriptor & 0x10) && w > 0 && h > 0 &&
+                  (bpp == GRAYSCALE || bpp == RGB || bpp == RGBA) &&
+                  (unsigned long)st.st_size >=
+                      offset + (unsigned long)w * h * bpp;
+  if (!in_place) {
+    close(fd);
+    return read_tga_file(filename);
+  }
+
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "can't map file " << filename << ", reading it instead\n";
+    return read_tga_file(filename);
+  }
+  size_t length = st.st_size;
+  mapping = std::shared_ptr<void>(
+      addr, [length](void *p) { munmap(p, length); });
+  data = (unsigned char *)addr + offset;
+  width = w;
+  height = h;
+  bytespp = bpp;
+  origin = (header.imagedescriptor & 0x20) ? TOP_LEFT : BOTTOM_LEFT;
+#ifdef DEBUG
+  std::cerr << "Successfully map image from: " << filename << "\n"
+            << "\t" << width << " x " << height << " / " << bytespp * 8 << "\n";
+#endif
+  return true;
+}
+
+/**
+ * @brief Use memory of somebody else as pixel storage, a shared memory
+ * segment for instance, so that drawing into the image writes there. The
+ * memory must hold w * h * bpp bytes and outlive the image, it's never
+ * freed here and copies of the image get pixels of their own.
+ *
+ * @param pixels storage, contents are kept
+ * @param w h bpp o size, format and row order of the pixels
+ * @return true if the arguments describe an image
+ */
+bool TGAImage::wrap(unsigned char *pixels, int w, int h, int bpp, Origin o) {
+  release();
+  if (!pixels || w <= 0 || h <= 0 ||
+      (bpp != GRAYSCALE && bpp != RGB && bpp != RGBA))
+    return false;
+  data = pixels;
+  borrowed = true;
+  width = w;
+  height = h;
+  bytespp = bpp;
+  origin = o;
   return true;
 }
 
+bool TGAImage::load_rle_data(const unsigned char *src, unsigned long srclen) {
+  unsigned long pixelcount = width * height;
+  unsigned long consumed = 0;
+  switch (bytespp) {
+  case GRAYSCALE:
+    consumed = rle_decode<GRAYSCALE>(src, srclen, data, pixelcount);
+    break;
+  case RGB:
+    consumed = rle_decode<RGB>(src, srclen, data, pixelcount);
+    break;
+  case RGBA:
+    consumed = rle_decode<RGBA>(src, srclen, data, pixelcount);
+    break;
+  }
+  return consumed > 0;
+}
+
 bool TGAImage::write_tga_file(const char *filename, bool rle) const {
-  unsigned char developer_area_ref[4] = {0, 0, 0, 0};
-  unsigned char extension_area_ref[4] = {0, 0, 0, 0};
-  unsigned char footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O',
-                              'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
   std::ofstream out;
   out.open(filename, std::ios::binary);
   if (!out.is_open()) {
@@ -172,40 +347,34 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) const {
   header.height = height;
   header.datatypecode =
       (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
-  header.imagedescriptor = 0x20; // top-left origin
-  out.write((char *)&header, sizeof(header));
-  if (!out.good()) {
-    out.close();
-    std::cerr << "can't dump the tga file\n";
-    return false;
-  }
-  if (!rle) {
-    out.write((char *)data, width * height * bytespp);
+  header.imagedescriptor = origin;
+
+  unsigned long nbytes = width * height * bytespp;
+  std::vector<unsigned char> buf;
+  if (rle) {
+    // the whole file is assembled in memory and dumped with a single write
+    buf.reserve(sizeof(header) + nbytes + nbytes / 128 + 1 +
+                sizeof(tga_developer_area_ref) +
+                sizeof(tga_extension_area_ref) + sizeof(tga_footer));
+    buf.insert(buf.end(), (unsigned char *)&header,
+               (unsigned char *)&header + sizeof(header));
+    unload_rle_data(buf);
+  } else {
+    // raw pixels are written straight from the image, no need to copy them
+    out.write((char *)&header, sizeof(header));
+    out.write((char *)data, nbytes);
     if (!out.good()) {
       std::cerr << "can't unload raw data\n";
       out.close();
       return false;
     }
-  } else {
-    if (!unload_rle_data(out)) {
-      out.close();
-      std::cerr << "can't unload rle data\n";
-      return false;
-    }
-  }
-  out.write((char *)developer_area_ref, sizeof(developer_area_ref));
-  if (!out.good()) {
-    std::cerr << "can't dump the tga file\n";
-    out.close();
-    return false;
-  }
-  out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-  if (!out.good()) {
-    std::cerr << "can't dump the tga file\n";
-    out.close();
-    return false;
   }
-  out.write((char *)footer, sizeof(footer));
+  buf.insert(buf.end(), tga_developer_area_ref,
+             tga_developer_area_ref + sizeof(tga_developer_area_ref));
+  buf.insert(buf.end(), tga_extension_area_ref,
+             tga_extension_area_ref + sizeof(tga_extension_area_ref));
+  buf.insert(buf.end(), tga_footer, tga_footer + sizeof(tga_footer));
+  out.write((char *)buf.data(), buf.size());
   if (!out.good()) {
     std::cerr << "can't dump the tga file\n";
     out.close();
@@ -217,47 +386,36 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) const {
 
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the
 // matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) const {
-  const unsigned char max_chunk_length = 128;
-  unsigned long npixels = width * height;
-  unsigned long curpix = 0;
-  while (curpix < npixels) {
-    unsigned long chunkstart = curpix * bytespp;
-    unsigned long curbyte = curpix * bytespp;
-    unsigned char run_length = 1;
-    bool raw = true;
-    while (curpix + run_length < npixels && run_length < max_chunk_length) {
-      bool succ_eq = true;
-      for (int t = 0; succ_eq && t < bytespp; t++) {
-        succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-      }
-      curbyte += bytespp;
-      if (1 == run_length) {
-        raw = !succ_eq;
-      }
-      if (raw && succ_eq) {
-        run_length--;
-        break;
-      }
-      if (!raw && !succ_eq) {
-        break;
-      }
-      run_length++;
+void TGAImage::unload_rle_data(std::vector<unsigned char> &out) const {
+  // bands of rows are encoded on the job system then appended in order,
+  // packets never cross a band so the bytes don't depend on the thread count
+  const int band_rows = 64;
+  int band_num = JobSystem::chunk_count(0, height, band_rows);
+  std::vector<std::vector<unsigned char>> bands(band_num);
+  JobSystem::instance().parallel_for(0, height, band_rows, [&](int begin,
+                                                               int end) {
+    unsigned long npixels = (unsigned long)(end - begin) * width;
+    std::vector<unsigned char> &band = bands[begin / band_rows];
+    // worst case is a header byte per pixel: single raw pixels between
+    // runs of two, as gray depth gradients have
+    band.resize(npixels * (bytespp + 1));
+    const unsigned char *in = data + (unsigned long)begin * width * bytespp;
+    unsigned char *end_ptr = band.data();
+    switch (bytespp) {
+    case GRAYSCALE:
+      end_ptr = rle_encode<GRAYSCALE>(in, npixels, end_ptr);
+      break;
+    case RGB:
+      end_ptr = rle_encode<RGB>(in, npixels, end_ptr);
+      break;
+    case RGBA:
+      end_ptr = rle_encode<RGBA>(in, npixels, end_ptr);
+      break;
     }
-    curpix += run_length;
-    out.put(raw ? run_length - 1 : run_length + 127);
-    if (!out.good()) {
-      std::cerr << "can't dump the tga file\n";
-      return false;
-    }
-    out.write((char *)(data + chunkstart),
-              (raw ? run_length * bytespp : bytespp));
-    if (!out.good()) {
-      std::cerr << "can't dump the tga file\n";
-      return false;
-    }
-  }
-  return true;
+    band.resize(end_ptr - band.data());
+  });
+  for (const std::vector<unsigned char> &band : bands)
+    out.insert(out.end(), band.begin(), band.end());
 }
 
 TGAColor TGAImage::get_pixel(int x, int y) const {
@@ -267,8 +425,20 @@ TGAColor TGAImage::get_pixel(int x, int y) const {
   return TGAColor(data + (x + y * width) * bytespp, bytespp);
 }
 
+/**
+ * @brief Get pixel in texture space, where row 0 is the bottom row of the
+ * image whatever the storage order is
+ *
+ * @param x column
+ * @param y row counted from the bottom
+ * @return TGAColor texel, empty color if out of the image
+ */
+TGAColor TGAImage::get_texel(int x, int y) const {
+  return get_pixel(x, origin == BOTTOM_LEFT ? y : height - 1 - y);
+}
+
 bool TGAImage::set_pixel(int x, int y, TGAColor c) {
-  if (!data || x < 0 || y < 0 || x >= width || y >= height) {
+  if (!data || mapping || x < 0 || y < 0 || x >= width || y >= height) {
     return false;
   }
   memcpy(data + (x + y * width) * bytespp, c.raw, bytespp);
@@ -281,8 +451,12 @@ int TGAImage::get_width() const { return width; }
 
 int TGAImage::get_height() const { return height; }
 
+TGAImage::Origin TGAImage::get_origin() const { return origin; }
+
+bool TGAImage::is_mapped() const { return (bool)mapping; }
+
 bool TGAImage::flip_horizontally() {
-  if (!data)
+  if (!data || mapping)
     return false;
 
   int half = width >> 1;
@@ -298,7 +472,7 @@ bool TGAImage::flip_horizontally() {
 }
 
 bool TGAImage::flip_vertically() {
-  if (!data)
+  if (!data || mapping)
     return false;
   unsigned long bytes_per_line = width * bytespp;
   unsigned char *line = new unsigned char[bytes_per_line];
@@ -315,11 +489,15 @@ bool TGAImage::flip_vertically() {
 }
 
 unsigned char *TGAImage::buffer() { return data; }
+const unsigned char *TGAImage::buffer() const { return data; }
 
-void TGAImage::clear() { memset((void *)data, 0, width * height * bytespp); }
+void TGAImage::clear() {
+  if (data && !mapping)
+    memset((void *)data, 0, width * height * bytespp);
+}
 
 bool TGAImage::scale(int w, int h) {
-  if (w <= 0 || h <= 0 || !data)
+  if (w <= 0 || h <= 0 || !data || mapping)
     return false;
   unsigned char *tdata = new unsigned char[w * h * bytespp];
   int nscanline = 0;
@@ -349,9 +527,113 @@ bool TGAImage::scale(int w, int h) {
       nscanline += nlinebytes;
     }
   }
-  delete[] data;
+  release();
   data = tdata;
   width = w;
   height = h;
   return true;
-}
\ No newline at end of file
+}
+namespace {
+
+bool pwrite_full(int fd, const unsigned char *data, size_t size,
+                 off_t offset) {
+  while (size > 0) {
+    ssize_t n = pwrite(fd, data, size, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+} // namespace
+
+TGATileWriter::~TGATileWriter() { close(); }
+
+/**
+ * @brief Create the file with its header and footer, the pixels in between
+ * are a hole until tiles are written, so nothing is allocated up front
+ *
+ * @param filename tga file to create
+ * @param w h image size, up to 65535 as the header stores
+ * @param bpp bytes per pixel
+ * @return true if the file is ready for write()
+ */
+bool TGATileWriter::open(const char *filename, int w, int h, int bpp) {
+  close();
+  if (w <= 0 || h <= 0 || w > 65535 || h > 65535) {
+    std::cerr << "tga size out of range " << w << "x" << h << "\n";
+    return false;
+  }
+  fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  width = w;
+  height = h;
+  bytespp = bpp;
+
+  TGA_Header header;
+  memset((void *)&header, 0, sizeof(header));
+  header.bitsperpixel = bytespp << 3;
+  header.width = width;
+  header.height = height;
+  header.datatypecode = (bytespp == TGAImage::GRAYSCALE ? 3 : 2);
+  header.imagedescriptor = TGAImage::BOTTOM_LEFT;
+  std::vector<unsigned char> tail;
+  tail.insert(tail.end(), tga_developer_area_ref,
+              tga_developer_area_ref + sizeof(tga_developer_area_ref));
+  tail.insert(tail.end(), tga_extension_area_ref,
+              tga_extension_area_ref + sizeof(tga_extension_area_ref));
+  tail.insert(tail.end(), tga_footer, tga_footer + sizeof(tga_footer));
+  off_t end = sizeof(header) + off_t(width) * height * bytespp;
+  if (!pwrite_full(fd, (const unsigned char *)&header, sizeof(header), 0) ||
+      !pwrite_full(fd, tail.data(), tail.size(), end)) {
+    std::cerr << "can't write the tga header of " << filename << "\n";
+    close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Write a tile at its place in the image
+ *
+ * @param tile pixels, of the file format, either origin
+ * @param x y bottom-left pixel of the tile in the image
+ * @return true if the tile is inside the image and written
+ */
+bool TGATileWriter::write(const TGAImage &tile, int x, int y) {
+  int w = tile.get_width(), h = tile.get_height();
+  if (fd < 0 || !tile.buffer() || tile.get_bytespp() != bytespp || x < 0 ||
+      y < 0 || x + w > width || y + h > height)
+    return false;
+  size_t row_bytes = size_t(w) * bytespp;
+  bool flip = tile.get_origin() == TGAImage::TOP_LEFT;
+  for (int r = 0; r < h; r++) {
+    int j = y + (flip ? h - 1 - r : r);
+    off_t offset =
+        sizeof(TGA_Header) + (off_t(j) * width + x) * (off_t)bytespp;
+    if (!pwrite_full(fd, tile.buffer() + r * row_bytes, row_bytes, offset))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Close the file, tiles never written stay black
+ *
+ * @return true unless closing failed
+ */
+bool TGATileWriter::close() {
+  if (fd < 0)
+    return true;
+  bool ok = ::close(fd) == 0;
+  fd = -1;
+  return ok;
+}
@@ -2,6 +2,8 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <memory>
+#include <vector>
 
 #pragma pack(push, 1)
 struct TGA_Header {
@@ -13,8 +15,8 @@ struct TGA_Header {
   char colormapdepth;
   short x_origin;
   short y_origin;
-  short width;
-  short height;
+  unsigned short width;
+  unsigned short height;
   char bitsperpixel;
   char imagedescriptor;
 };
@@ -74,39 +76,80 @@ const TGAColor blue = TGAColor(0, 0, 255, 255);
 const TGAColor yellow = TGAColor(255, 255, 0, 255);
 
 class TGAImage {
+public:
+  enum Format {
+    GRAYSCALE = 1,
+    RGB = 3,
+    RGBA = 4,
+  };
+
+  // row order of the pixel storage, values match the imagedescriptor bit
+  enum Origin {
+    BOTTOM_LEFT = 0x00,
+    TOP_LEFT = 0x20,
+  };
+
 protected:
   unsigned char *data;
   int width;
   int height;
   int bytespp;
+  Origin origin;
 
-  bool load_rle_data(std::ifstream &in);
-  bool unload_rle_data(std::ofstream &out) const;
+  // keeps a read-only file mapping alive, shared between copies of the image
+  std::shared_ptr<void> mapping;
+  // pixels lent by the caller of wrap(), writable but never freed here
+  bool borrowed = false;
 
-public:
-  enum Format {
-    GRAYSCALE = 1,
-    RGB = 3,
-    RGBA = 4,
-  };
+  void release();
+  bool load_rle_data(const unsigned char *src, unsigned long srclen);
+  void unload_rle_data(std::vector<unsigned char> &out) const;
 
+public:
   TGAImage();
-  TGAImage(int w, int h, int bpp);
+  TGAImage(int w, int h, int bpp, Origin o = TOP_LEFT);
   TGAImage(const TGAImage &img);
   bool read_tga_file(const char *filename);
+  bool map_tga_file(const char *filename);
+  bool wrap(unsigned char *pixels, int w, int h, int bpp, Origin o = TOP_LEFT);
   bool write_tga_file(const char *filename, bool rle = true) const;
   bool flip_horizontally();
   bool flip_vertically();
   bool scale(int w, int h);
   TGAColor get_pixel(int x, int y) const;
+  TGAColor get_texel(int x, int y) const;
   bool set_pixel(int x, int y, TGAColor c);
   ~TGAImage();
   TGAImage &operator=(const TGAImage &img);
   int get_width() const;
   int get_height() const;
   int get_bytespp() const;
+  Origin get_origin() const;
+  bool is_mapped() const;
   unsigned char *buffer();
+  const unsigned char *buffer() const;
   void clear();
 };
 
+// Uncompressed tga file filled a rectangle at a time, for images too large
+// to be held in memory: open() gives the file its final size and every tile
+// is written straight to its rows, in any order. The pixels are stored
+// bottom-left like frames.
+class TGATileWriter {
+private:
+  int fd = -1;
+  int width = 0;
+  int height = 0;
+  int bytespp = 0;
+
+public:
+  TGATileWriter() = default;
+  TGATileWriter(const TGATileWriter &) = delete;
+  TGATileWriter &operator=(const TGATileWriter &) = delete;
+  ~TGATileWriter();
+  bool open(const char *filename, int w, int h, int bpp);
+  bool write(const TGAImage &tile, int x, int y);
+  bool close();
+};
+
 #endif //__IMAGE_H__
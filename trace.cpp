@@ -0,0 +1,191 @@
+#include "trace.h"
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+const uint64_t ring_size = 1 << 16; // events kept per thread, power of two
+
+// single producer ring, only the owning thread writes and bumps head
+struct Buffer {
+  Event events[ring_size];
+  std::atomic<uint64_t> head{0};
+  int tid = 0;
+  std::string name;
+};
+
+// buffers outlive their threads so late dumps still see them
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Buffer>> buffers;
+  std::string filename;
+  std::atomic<uint64_t> origin{0};
+};
+
+Registry &registry() noexcept {
+  static Registry *reg = new Registry(); // never destroyed, threads may outlive
+  return *reg;
+}
+
+Buffer &local() noexcept {
+  thread_local Buffer *buffer = nullptr;
+  if (!buffer) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.buffers.push_back(std::make_unique<Buffer>());
+    buffer = reg.buffers.back().get();
+    buffer->tid = reg.buffers.size();
+  }
+  return *buffer;
+}
+
+// names are program literals, escaping quotes and backslashes is enough
+void write_string(std::ostream &out, const char *str) {
+  out << '"';
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      out << '\\';
+    out << *str;
+  }
+  out << '"';
+}
+
+} // namespace
+
+std::atomic<bool> active(false);
+
+/**
+ * @brief Start recording, the trace goes to filename on every dump()
+ *
+ * @param filename json file to write
+ */
+void start(const char *filename) noexcept {
+  Registry &reg = registry();
+  {
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.filename = filename;
+    reg.origin.store(now(), std::memory_order_relaxed);
+  }
+  active.store(true, std::memory_order_release);
+}
+
+void stop() noexcept { active.store(false, std::memory_order_release); }
+
+/**
+ * @brief Label the calling thread in the viewer
+ *
+ * @param name thread name, e.g. "main" or "worker 3"
+ */
+void set_thread_name(const char *name) noexcept {
+  Buffer &buffer = local();
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  buffer.name = name;
+}
+
+/**
+ * @brief Append an event to the ring of the calling thread, overwriting the
+ * oldest one once the ring is full
+ *
+ * @param name event name, must be a static string
+ * @param cat category, must be a static string
+ * @param begin start timestamp from now()
+ * @param end end timestamp from now()
+ * @param arg index shown as args.index, negative for none
+ */
+void record(const char *name, const char *cat, uint64_t begin, uint64_t end,
+            int64_t arg) noexcept {
+  Buffer &buffer = local();
+  uint64_t origin = registry().origin.load(std::memory_order_relaxed);
+  uint64_t head = buffer.head.load(std::memory_order_relaxed);
+  Event &event = buffer.events[head & (ring_size - 1)];
+  event.name = name;
+  event.cat = cat;
+  event.begin = begin > origin ? begin - origin : 0;
+  event.duration = end - begin;
+  event.arg = arg;
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Write every buffered event as Chrome trace_event json. Meant to be
+ * called while the recording threads are idle, a thread writing meanwhile may
+ * tear its oldest event.
+ *
+ * @param out stream to write
+ */
+void write_json(std::ostream &out) noexcept {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  out << std::fixed << std::setprecision(3);
+  for (const auto &buffer : reg.buffers) {
+    if (!buffer->name.empty()) {
+      out << (first ? "\n" : ",\n")
+          << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+          << buffer->tid << ",\"args\":{\"name\":";
+      write_string(out, buffer->name.c_str());
+      out << "}}";
+      first = false;
+    }
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t tail = head > ring_size ? head - ring_size : 0;
+    for (uint64_t i = tail; i < head; i++) {
+      const Event &event = buffer->events[i & (ring_size - 1)];
+      out << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"name\":";
+      write_string(out, event.name);
+      out << ",\"cat\":";
+      write_string(out, event.cat);
+      out << ",\"pid\":1,\"tid\":" << buffer->tid
+          << ",\"ts\":" << event.begin / 1000.0
+          << ",\"dur\":" << event.duration / 1000.0;
+      if (event.arg >= 0)
+        out << ",\"args\":{\"index\":" << event.arg << "}";
+      out << "}";
+      first = false;
+    }
+  }
+  out << "\n]}\n";
+}
+
+/**
+ * @brief Rewrite the trace file given to start() with the buffered events
+ *
+ * @return true if tracing is on and the file was written
+ */
+bool dump() noexcept {
+  if (!enabled())
+    return false;
+  std::string filename;
+  {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    filename = registry().filename;
+  }
+  std::ofstream out(filename);
+  if (!out) {
+    std::cerr << "Error: can't write trace into " << filename << "\n";
+    return false;
+  }
+  write_json(out);
+  return bool(out);
+}
+
+/**
+ * @brief Drop every buffered event, buffers stay registered
+ *
+ */
+void reset() noexcept {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  for (auto &buffer : reg.buffers)
+    buffer->head.store(0, std::memory_order_release);
+}
+
+} // namespace trace
@@ -0,0 +1,81 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Timeline tracing: complete (begin + duration) events per thread, written
+// into a fixed size ring buffer owned by the recording thread, so recording
+// never takes a lock. The buffers are dumped as Chrome trace_event json
+// (chrome://tracing, ui.perfetto.dev) at the end of every render. Scopes are
+// coarse (frame, pass, tile/batch, save) and cost one relaxed load while
+// tracing is off.
+
+namespace trace {
+
+struct Event {
+  const char *name; // static strings only, stored by pointer
+  const char *cat;
+  uint64_t begin; // ns since start()
+  uint64_t duration;
+  int64_t arg; // tile/batch index or similar, negative for none
+};
+
+extern std::atomic<bool> active;
+
+inline bool enabled() noexcept {
+  return active.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Monotonic timestamp used by the events
+ *
+ * @return uint64_t nanoseconds
+ */
+inline uint64_t now() noexcept {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void start(const char *filename) noexcept;
+void stop() noexcept;
+void set_thread_name(const char *name) noexcept;
+void record(const char *name, const char *cat, uint64_t begin, uint64_t end,
+            int64_t arg = -1) noexcept;
+void write_json(std::ostream &out) noexcept;
+bool dump() noexcept;
+void reset() noexcept;
+
+// records the lifetime of the scope as one event on the calling thread
+class Scope {
+private:
+  const char *name_;
+  const char *cat_;
+  int64_t arg_;
+  uint64_t begin_;
+
+public:
+  Scope(const char *name, const char *cat, int64_t arg = -1) noexcept
+      : name_(name), cat_(cat), arg_(arg), begin_(enabled() ? now() : 0) {}
+  ~Scope() noexcept {
+    if (begin_)
+      record(name_, cat_, begin_, now(), arg_);
+  }
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+};
+
+} // namespace trace
+
+#define TR_TRACE_CONCAT_(a, b) a##b
+#define TR_TRACE_CONCAT(a, b) TR_TRACE_CONCAT_(a, b)
+
+#define TR_TRACE(name, cat)                                                    \
+  trace::Scope TR_TRACE_CONCAT(tr_trace_, __LINE__)((name), (cat))
+#define TR_TRACE_ARG(name, cat, arg)                                           \
+  trace::Scope TR_TRACE_CONCAT(tr_trace_, __LINE__)((name), (cat), (arg))
+
+#endif // __TRACE_H__
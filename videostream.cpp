@@ -0,0 +1,290 @@
+#include "videostream.h"
+#include "tgaimage.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// buffered stream bytes written at once
+const size_t flush_bytes = 4 << 20;
+
+/**
+ * @brief Split a row of BGR(A) or gray pixels into 16 bit planes
+ */
+void load_row(const unsigned char *src, int width, int bpp, uint16_t *r,
+              uint16_t *g, uint16_t *b) {
+  if (bpp == TGAImage::GRAYSCALE) {
+    for (int i = 0; i < width; i++)
+      r[i] = g[i] = b[i] = src[i];
+    return;
+  }
+  for (int i = 0; i < width; i++, src += bpp) {
+    b[i] = src[0];
+    g[i] = src[1];
+    r[i] = src[2];
+  }
+}
+
+/**
+ * @brief Weighted sum of three planes in 8 bit fixed point, into bytes:
+ * ((cr * r + cg * g + cb * b + 128) >> 8) + bias. The SSE2 loop computes the
+ * same integers as the scalar tail, 8 pixels at a time.
+ */
+void weigh_row(const uint16_t *r, const uint16_t *g, const uint16_t *b, int n,
+               int cr, int cg, int cb, int bias, unsigned char *out) {
+  int i = 0;
+#ifdef __SSE2__
+  // luma sums fit 16 bits unsigned, chroma ones signed: the shift has to
+  // match, the products are the same either way
+  const bool is_signed = cr < 0 || cg < 0 || cb < 0;
+  const __m128i wr = _mm_set1_epi16(cr), wg = _mm_set1_epi16(cg);
+  const __m128i wb = _mm_set1_epi16(cb), round = _mm_set1_epi16(128);
+  const __m128i offset = _mm_set1_epi16(bias);
+  for (; i + 8 <= n; i += 8) {
+    __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+    __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i sum = _mm_add_epi16(
+        _mm_add_epi16(_mm_mullo_epi16(vr, wr), _mm_mullo_epi16(vg, wg)),
+        _mm_add_epi16(_mm_mullo_epi16(vb, wb), round));
+    sum = is_signed ? _mm_srai_epi16(sum, 8) : _mm_srli_epi16(sum, 8);
+    sum = _mm_add_epi16(sum, offset);
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(sum, sum));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = ((cr * r[i] + cg * g[i] + cb * b[i] + 128) >> 8) + bias;
+}
+
+} // namespace
+
+/**
+ * @brief Convert a frame to planar YUV 4:2:0, rows top-down whatever the
+ * frame origin. Chroma is taken from the average of each 2x2 block, odd
+ * sizes repeat the last column or row.
+ *
+ * @param frame gray, BGR or BGRA frame
+ * @param y width * height bytes
+ * @param u v (width + 1) / 2 * (height + 1) / 2 bytes each
+ * @param scratch kept between calls to avoid allocations
+ */
+void rgb_to_yuv420(const TGAImage &frame, unsigned char *y, unsigned char *u,
+                   unsigned char *v, std::vector<uint16_t> &scratch) noexcept {
+  int width = frame.get_width(), height = frame.get_height();
+  int bpp = frame.get_bytespp();
+  int cw = (width + 1) / 2, ch = (height + 1) / 2;
+  // two rows of three planes, then three chroma planes
+  scratch.resize(size_t(width) * 6 + size_t(cw) * 3);
+  uint16_t *planes[2][3];
+  for (int row = 0; row < 2; row++)
+    for (int c = 0; c < 3; c++)
+      planes[row][c] = scratch.data() + size_t(width) * (row * 3 + c);
+  uint16_t *avg[3];
+  for (int c = 0; c < 3; c++)
+    avg[c] = scratch.data() + size_t(width) * 6 + size_t(cw) * c;
+
+  const unsigned char *pixels = frame.buffer();
+  bool flip = frame.get_origin() == TGAImage::BOTTOM_LEFT;
+  for (int cj = 0; cj < ch; cj++) {
+    for (int row = 0; row < 2; row++) {
+      int j = std::min(cj * 2 + row, height - 1);
+      int src = flip ? height - 1 - j : j;
+      uint16_t **p = planes[row];
+      load_row(pixels + size_t(src) * width * bpp, width, bpp, p[0], p[1],
+               p[2]);
+      // BT.601 studio range weights
+      if (cj * 2 + row < height)
+        weigh_row(p[0], p[1], p[2], width, 66, 129, 25, 16,
+                  y + size_t(j) * width);
+    }
+    for (int c = 0; c < 3; c++) {
+      const uint16_t *top = planes[0][c], *bottom = planes[1][c];
+      for (int i = 0; i < cw; i++) {
+        int i0 = i * 2, i1 = std::min(i * 2 + 1, width - 1);
+        avg[c][i] = (top[i0] + top[i1] + bottom[i0] + bottom[i1] + 2) >> 2;
+      }
+    }
+    weigh_row(avg[0], avg[1], avg[2], cw, -38, -74, 112, 128,
+              u + size_t(cj) * cw);
+    weigh_row(avg[0], avg[1], avg[2], cw, 112, -94, -18, 128,
+              v + size_t(cj) * cw);
+  }
+}
+
+VideoStream::~VideoStream() noexcept { close(); }
+
+/**
+ * @brief Stream format from its command line name
+ *
+ * @param name y4m or ppm
+ * @param format set when the name is known
+ * @return true if the name is known
+ */
+bool VideoStream::parse_format(const std::string &name,
+                               Format &format) noexcept {
+  if (name == "y4m")
+    format = Y4M;
+  else if (name == "ppm")
+    format = PPM;
+  else
+    return false;
+  return true;
+}
+
+/**
+ * @brief Open the stream, a fifo blocks here until its reader shows up
+ *
+ * @param path "-" for stdout, else a file or fifo
+ * @param format stream format
+ * @param fps frame rate written in the y4m header
+ * @return true if the stream is open
+ */
+bool VideoStream::open(const std::string &path, Format format,
+                       int fps) noexcept {
+  close();
+  if (path == "-") {
+    fd_ = STDOUT_FILENO;
+    owns_fd_ = false;
+  } else {
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    owns_fd_ = true;
+    if (fd_ < 0) {
+      std::cerr << "Error: Can't open stream " << path << ": "
+                << strerror(errno) << std::endl;
+      return false;
+    }
+  }
+  // an encoder quitting early closes the pipe, report it as a failed write
+  // instead of dying of SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  path_ = path;
+  format_ = format;
+  fps_ = std::max(fps, 1);
+  width_ = height_ = 0;
+  buffer_.clear();
+  buffer_.reserve(flush_bytes * 2);
+  return true;
+}
+
+/**
+ * @brief Append a frame, the buffer is written once it is large enough. Y4M
+ * streams keep the size of their first frame.
+ *
+ * @param frame frame to append
+ * @return false if the stream is closed, broken or the size changed
+ */
+bool VideoStream::write(const TGAImage &frame) noexcept {
+  int width = frame.get_width(), height = frame.get_height();
+  if (fd_ < 0 || !frame.buffer())
+    return false;
+  TR_TRACE("stream", "io");
+  char header[64];
+  size_t offset = buffer_.size();
+  if (format_ == Y4M) {
+    if (width_ == 0) {
+      width_ = width;
+      height_ = height;
+      int n = snprintf(header, sizeof(header),
+                       "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width,
+                       height, fps_);
+      buffer_.insert(buffer_.end(), header, header + n);
+      offset = buffer_.size();
+    } else if (width != width_ || height != height_) {
+      std::cerr << "Error: y4m frames must keep the size " << width_ << "x"
+                << height_ << std::endl;
+      return false;
+    }
+    static const char frame_header[] = "FRAME\n";
+    size_t luma_bytes = size_t(width) * height;
+    size_t chroma_bytes = size_t((width + 1) / 2) * ((height + 1) / 2);
+    buffer_.resize(offset + 6 + luma_bytes + chroma_bytes * 2);
+    unsigned char *out = buffer_.data() + offset;
+    memcpy(out, frame_header, 6);
+    out += 6;
+    rgb_to_yuv420(frame, out, out + luma_bytes,
+                  out + luma_bytes + chroma_bytes, planes_);
+  } else {
+    bool gray = frame.get_bytespp() == TGAImage::GRAYSCALE;
+    int n = snprintf(header, sizeof(header), "P%c\n%d %d\n255\n",
+                     gray ? '5' : '6', width, height);
+    int channels = gray ? 1 : 3, bpp = frame.get_bytespp();
+    buffer_.resize(offset + n + size_t(width) * height * channels);
+    unsigned char *out = buffer_.data() + offset;
+    memcpy(out, header, n);
+    out += n;
+    bool flip = frame.get_origin() == TGAImage::BOTTOM_LEFT;
+    for (int j = 0; j < height; j++) {
+      const unsigned char *src =
+          frame.buffer() + size_t(flip ? height - 1 - j : j) * width * bpp;
+      if (gray) {
+        memcpy(out, src, width);
+        out += width;
+        continue;
+      }
+      for (int i = 0; i < width; i++, src += bpp, out += 3) {
+        out[0] = src[2];
+        out[1] = src[1];
+        out[2] = src[0];
+      }
+    }
+  }
+  return buffer_.size() < flush_bytes || write_out();
+}
+
+/**
+ * @brief Write out whatever is buffered
+ *
+ * @return false if the write failed
+ */
+bool VideoStream::flush() noexcept { return fd_ < 0 || write_out(); }
+
+/**
+ * @brief Flush and close, stdout is left open
+ *
+ * @return false if the last write failed
+ */
+bool VideoStream::close() noexcept {
+  if (fd_ < 0)
+    return true;
+  bool ok = write_out();
+  if (owns_fd_)
+    ::close(fd_);
+  fd_ = -1;
+  return ok;
+}
+
+bool VideoStream::write_out() noexcept {
+  TR_TRACE("write", "io");
+  const unsigned char *data = buffer_.data();
+  size_t size = buffer_.size();
+  while (size > 0) {
+    ssize_t n = ::write(fd_, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      std::cerr << "Error: Can't write stream " << path_ << ": "
+                << strerror(errno) << std::endl;
+      // a closed pipe stays closed, the next frames fail without a word
+      if (owns_fd_)
+        ::close(fd_);
+      fd_ = -1;
+      buffer_.clear();
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  buffer_.clear();
+  return true;
+}
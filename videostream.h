@@ -0,0 +1,53 @@
+#ifndef __VIDEOSTREAM_H__
+#define __VIDEOSTREAM_H__
+
+#include "tgaimage.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Raw video out of a sequence of frames, for piping into an encoder rather
+// than writing a file per frame: a YUV4MPEG2 stream (4:2:0, BT.601 studio
+// range, what ffmpeg and x264 read from stdin) or concatenated binary PPMs.
+// Frames are converted into one large buffer that is only written once it
+// holds a few MB, so a frame costs no open/close and few system calls.
+// Not thread safe, FrameWriter drives it from its I/O thread.
+class VideoStream {
+public:
+  enum Format {
+    Y4M,
+    PPM,
+  };
+
+private:
+  int fd_ = -1;
+  bool owns_fd_ = false;
+  Format format_ = Y4M;
+  int fps_ = 30;
+  int width_ = 0; // of the stream, set by the first frame
+  int height_ = 0;
+  std::string path_;
+  std::vector<unsigned char> buffer_;
+  std::vector<uint16_t> planes_; // 16 bit planar rows for the conversion
+
+  bool write_out() noexcept;
+
+public:
+  VideoStream() = default;
+  VideoStream(const VideoStream &) = delete;
+  VideoStream &operator=(const VideoStream &) = delete;
+  ~VideoStream() noexcept;
+
+  static bool parse_format(const std::string &name, Format &format) noexcept;
+
+  bool open(const std::string &path, Format format, int fps) noexcept;
+  bool write(const TGAImage &frame) noexcept;
+  bool flush() noexcept;
+  bool close() noexcept;
+};
+
+void rgb_to_yuv420(const TGAImage &frame, unsigned char *y, unsigned char *u,
+                   unsigned char *v, std::vector<uint16_t> &scratch) noexcept;
+
+#endif // __VIDEOSTREAM_H__